@@ -0,0 +1,632 @@
+//*Hack assembly backend: the VM code of a whole program is lowered straight to `.asm` in memory,
+//*without writing `.vm` files for a separate translator.
+//*
+//*Stack caching: the top of the stack lives in D whenever `cached` is set, the rest of the stack is
+//*in memory as usual. A push only spills D when it is holding a value, a pop or a binary operator
+//*takes its operand from D, so `push a; push b; add; pop c` touches SP once instead of four times.
+//*At labels and calls D is spilled, every path into a label then agrees on the stack being in memory.
+//*An operand that can be addressed without D (constants, statics, temps, local 0 and 1) is fused into
+//*the operator that consumes it, comparisons feeding an `if-goto` jump on the difference directly.
+//*
+//*Calls go through two shared routines instead of expanding the frame code at every call site:
+//*    $CALL   D = return address, R13 = callee, R14 = number of arguments
+//*    $RETURN D = return value, which it hands back in D with SP at the old ARG
+//*so a call costs about ten instructions at the call site and a return two.
+//*
+//*With both options off the lowering follows the textbook VM translator, which is the baseline the
+//*instruction counts are compared against.
+
+typedef struct AsmOptions {
+    bool cache_tos;
+    bool trampolines;
+} AsmOptions;
+
+typedef struct Asm {
+    AsmOptions options;
+    char* text;
+    size_t num_insts;
+    //*statics are named `<file>.<index>` and labels `<function>$<label>` as in the VM spec
+    const char* file;
+    const char* func;
+    u32 num_labels;
+    bool cached;
+    bool mid_line;
+} Asm;
+
+//*appends lines of assembly, counting the instructions among them
+Internal void asm_emit(Asm* a, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    BUF_FIT(a->text, BUF_LEN(a->text) + n + 1);
+    char* start = BUF_END(a->text);
+    va_start(args, fmt);
+    vsnprintf(start, n + 1, fmt, args);
+    va_end(args);
+    _BUF_HDR(a->text)->len += n;
+    for (const char* c = start; *c; c++) {
+        a->num_insts += !a->mid_line && *c != '(';
+        a->mid_line = *c != '\n';
+    }
+}
+
+Internal void asm_spill(Asm* a) {
+    if (a->cached) {
+        asm_emit(a, "@SP\nAM=M+1\nA=A-1\nM=D\n");
+        a->cached = false;
+    }
+}
+
+Internal void asm_load(Asm* a) {
+    if (!a->cached) {
+        asm_emit(a, "@SP\nAM=M-1\nD=M\n");
+        a->cached = true;
+    }
+}
+
+Internal const char* asm_segment_base(VmSegment seg) {
+    switch (seg) {
+        case SEG_LOCAL: return "LCL";
+        case SEG_ARGUMENT: return "ARG";
+        case SEG_THIS: return "THIS";
+        case SEG_THAT: return "THAT";
+        default: return NULL;
+    }
+}
+
+//*Points A at the segment slot without touching D, false when that needs D
+Internal bool asm_address(Asm* a, VmSegment seg, i32 index) {
+    switch (seg) {
+        case SEG_POINTER: {
+            asm_emit(a, "@R%d\n", 3 + index);
+            return true;
+        }
+        case SEG_TEMP: {
+            asm_emit(a, "@R%d\n", 5 + index);
+            return true;
+        }
+        case SEG_STATIC: {
+            asm_emit(a, "@%s.%d\n", a->file, index);
+            return true;
+        }
+        case SEG_CONSTANT: {
+            return false;
+        }
+        default: {
+            if (index > 1) {
+                return false;
+            }
+            asm_emit(a, "@%s\nA=M%s\n", asm_segment_base(seg), index ? "+1" : "");
+            return true;
+        }
+    }
+}
+
+Internal void asm_push(Asm* a, const VmInst* inst) {
+    asm_spill(a);
+    if (inst->seg == SEG_CONSTANT) {
+        if (inst->arg <= 1) {
+            asm_emit(a, "D=%d\n", inst->arg);
+        }
+        else {
+            asm_emit(a, "@%d\nD=A\n", inst->arg);
+        }
+    }
+    else if (asm_address(a, inst->seg, inst->arg)) {
+        asm_emit(a, "D=M\n");
+    }
+    else {
+        asm_emit(a, "@%d\nD=A\n@%s\nA=D+M\nD=M\n", inst->arg, asm_segment_base(inst->seg));
+    }
+    a->cached = true;
+}
+
+Internal void asm_pop(Asm* a, const VmInst* inst) {
+    const char* base = asm_segment_base(inst->seg);
+    //*far slots of the pointer segments: the address is computed before the value is taken off the stack
+    if (base && inst->arg > 1 && (!a->options.cache_tos || inst->arg > 8)) {
+        asm_spill(a);
+        asm_emit(a, "@%d\nD=A\n@%s\nD=D+M\n@R13\nM=D\n@SP\nAM=M-1\nD=M\n@R13\nA=M\nM=D\n", inst->arg, base);
+        return;
+    }
+    asm_load(a);
+    if (base && inst->arg > 1) {
+        asm_emit(a, "@%s\nA=M+1\n", base);
+        for (i32 i = 1; i < inst->arg; i++) {
+            asm_emit(a, "A=A+1\n");
+        }
+    }
+    else {
+        asm_address(a, inst->seg, inst->arg);
+    }
+    asm_emit(a, "M=D\n");
+    a->cached = false;
+}
+
+Internal bool asm_is_binary(VmOp op) {
+    return op == VM_ADD || op == VM_SUB || op == VM_AND || op == VM_OR || op == VM_EQ || op == VM_GT || op == VM_LT;
+}
+
+//*jump condition on `second - top` for a comparison, inverted for `not`
+Internal const char* asm_jump(VmOp op, bool negate) {
+    switch (op) {
+        case VM_EQ: return negate ? "JNE" : "JEQ";
+        case VM_GT: return negate ? "JLE" : "JGT";
+        case VM_LT: return negate ? "JGE" : "JLT";
+        default: return negate ? "JEQ" : "JNE";
+    }
+}
+
+Internal void asm_label_name(Asm* a, const VmInst* inst) {
+    if (inst->arg >= 0) {
+        asm_emit(a, "%s$%s%d", a->func, inst->name, inst->arg);
+    }
+    else {
+        asm_emit(a, "%s$%s", a->func, inst->name);
+    }
+}
+
+//*Lowers `code[i]` and returns the number of instructions it consumed. `operand` is set when the
+//*right operand of the binary operator at code[i] is already addressed by A (`M`) or is in A (`A`).
+Internal size_t asm_binary(Asm* a, const VmInst* code, size_t i, size_t len, char operand) {
+    VmOp op = code[i].op;
+    if (!operand) {
+        asm_load(a);
+        asm_emit(a, "@SP\nAM=M-1\n");
+        //*D holds the right operand and M the left, turn it around for sub and the comparisons
+        switch (op) {
+            case VM_ADD: asm_emit(a, "D=D+M\n"); return 1;
+            case VM_AND: asm_emit(a, "D=D&M\n"); return 1;
+            case VM_OR: asm_emit(a, "D=D|M\n"); return 1;
+            default: asm_emit(a, "D=M-D\n"); break;
+        }
+    }
+    else {
+        switch (op) {
+            case VM_ADD: asm_emit(a, "D=D+%c\n", operand); return 1;
+            case VM_AND: asm_emit(a, "D=D&%c\n", operand); return 1;
+            case VM_OR: asm_emit(a, "D=D|%c\n", operand); return 1;
+            default: asm_emit(a, "D=D-%c\n", operand); break;
+        }
+    }
+    if (op == VM_SUB) {
+        return 1;
+    }
+
+    //*a comparison, D is `left - right`
+    size_t used = 1;
+    bool negate = false;
+    if (a->options.cache_tos && i + used < len && code[i + used].op == VM_NOT) {
+        negate = true;
+        used++;
+    }
+    if (a->options.cache_tos && i + used < len && code[i + used].op == VM_IF_GOTO) {
+        asm_emit(a, "@");
+        asm_label_name(a, &code[i + used]);
+        asm_emit(a, "\nD;%s\n", asm_jump(op, negate));
+        a->cached = false;
+        return used + 1;
+    }
+    u32 id = a->num_labels++;
+    asm_emit(a, "@$cmp%u\nD;%s\nD=0\n@$cmp_end%u\n0;JMP\n($cmp%u)\nD=-1\n($cmp_end%u)\n", id, asm_jump(op, negate), id, id, id);
+    a->cached = true;
+    return used;
+}
+
+Internal void asm_call(Asm* a, const VmInst* inst) {
+    asm_spill(a);
+    u32 id = a->num_labels++;
+    if (a->options.trampolines) {
+        if (inst->arg <= 1) {
+            asm_emit(a, "@R14\nM=%d\n", inst->arg);
+        }
+        else {
+            asm_emit(a, "@%d\nD=A\n@R14\nM=D\n", inst->arg);
+        }
+        asm_emit(a, "@%s\nD=A\n@R13\nM=D\n@$ret%u\nD=A\n@$CALL\n0;JMP\n($ret%u)\n", inst->name, id, id);
+        a->cached = true;
+        return;
+    }
+    asm_emit(a, "@$ret%u\nD=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n", id);
+    const char* saved[] = { "LCL", "ARG", "THIS", "THAT" };
+    for (size_t i = 0; i < 4; i++) {
+        asm_emit(a, "@%s\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n", saved[i]);
+    }
+    asm_emit(a, "@SP\nD=M\n@%d\nD=D-A\n@5\nD=D-A\n@ARG\nM=D\n@SP\nD=M\n@LCL\nM=D\n@%s\n0;JMP\n($ret%u)\n", inst->arg, inst->name, id);
+}
+
+Internal void asm_return(Asm* a) {
+    if (a->options.trampolines) {
+        asm_load(a);
+        asm_emit(a, "@$RETURN\n0;JMP\n");
+        a->cached = false;
+        return;
+    }
+    asm_spill(a);
+    asm_emit(a, "@LCL\nD=M\n@R13\nM=D\n@5\nA=D-A\nD=M\n@R14\nM=D\n@SP\nAM=M-1\nD=M\n@ARG\nA=M\nM=D\n@ARG\nD=M+1\n@SP\nM=D\n");
+    const char* restored[] = { "THAT", "THIS", "ARG", "LCL" };
+    for (size_t i = 0; i < 4; i++) {
+        asm_emit(a, "@R13\nAM=M-1\nD=M\n@%s\nM=D\n", restored[i]);
+    }
+    asm_emit(a, "@R14\nA=M\n0;JMP\n");
+}
+
+Internal void asm_function(Asm* a, const VmInst* inst) {
+    asm_spill(a);
+    a->func = inst->name;
+    asm_emit(a, "(%s)\n", inst->name);
+    if (!inst->arg) {
+        return;
+    }
+    if (a->options.cache_tos) {
+        asm_emit(a, "@SP\nA=M\n");
+        for (i32 i = 0; i < inst->arg; i++) {
+            asm_emit(a, i + 1 < inst->arg ? "M=0\nA=A+1\n" : "M=0\nD=A+1\n");
+        }
+        asm_emit(a, "@SP\nM=D\n");
+        return;
+    }
+    for (i32 i = 0; i < inst->arg; i++) {
+        asm_emit(a, "@SP\nA=M\nM=0\n@SP\nM=M+1\n");
+    }
+}
+
+Internal void asm_code(Asm* a, const VmInst* code, size_t len) {
+    for (size_t i = 0; i < len;) {
+        const VmInst* inst = &code[i];
+        size_t used = 1;
+        switch (inst->op) {
+            case VM_PUSH: {
+                //*`push x` right before the operator using it, with the left operand in D
+                if (a->options.cache_tos && a->cached && i + 1 < len && asm_is_binary(code[i + 1].op)) {
+                    if (inst->seg == SEG_CONSTANT) {
+                        asm_emit(a, "@%d\n", inst->arg);
+                        used += asm_binary(a, code, i + 1, len, 'A');
+                        break;
+                    }
+                    if (asm_address(a, inst->seg, inst->arg)) {
+                        used += asm_binary(a, code, i + 1, len, 'M');
+                        break;
+                    }
+                }
+                asm_push(a, inst);
+                break;
+            }
+            case VM_POP: {
+                asm_pop(a, inst);
+                break;
+            }
+            case VM_NEG:
+            case VM_NOT: {
+                //*`not` is non-zero for every value but -1, not only for 0
+                if (inst->op == VM_NOT && a->options.cache_tos && i + 1 < len && code[i + 1].op == VM_IF_GOTO) {
+                    asm_load(a);
+                    asm_emit(a, "D=D+1\n@");
+                    asm_label_name(a, &code[i + 1]);
+                    asm_emit(a, "\nD;JNE\n");
+                    a->cached = false;
+                    used++;
+                    break;
+                }
+                asm_load(a);
+                asm_emit(a, inst->op == VM_NEG ? "D=-D\n" : "D=!D\n");
+                break;
+            }
+            case VM_ADD:
+            case VM_SUB:
+            case VM_AND:
+            case VM_OR:
+            case VM_EQ:
+            case VM_GT:
+            case VM_LT: {
+                used = asm_binary(a, code, i, len, 0);
+                break;
+            }
+            case VM_LABEL: {
+                asm_spill(a);
+                asm_emit(a, "(");
+                asm_label_name(a, inst);
+                asm_emit(a, ")\n");
+                break;
+            }
+            case VM_GOTO: {
+                asm_spill(a);
+                asm_emit(a, "@");
+                asm_label_name(a, inst);
+                asm_emit(a, "\n0;JMP\n");
+                break;
+            }
+            case VM_IF_GOTO: {
+                asm_load(a);
+                asm_emit(a, "@");
+                asm_label_name(a, inst);
+                asm_emit(a, "\nD;JNE\n");
+                a->cached = false;
+                break;
+            }
+            case VM_FUNCTION: {
+                asm_function(a, inst);
+                break;
+            }
+            case VM_CALL: {
+                asm_call(a, inst);
+                break;
+            }
+            case VM_RETURN: {
+                asm_return(a);
+                break;
+            }
+        }
+        //*the textbook translator keeps the whole stack in memory between instructions
+        if (!a->options.cache_tos) {
+            asm_spill(a);
+        }
+        i += used;
+    }
+    asm_spill(a);
+}
+
+Internal void asm_runtime(Asm* a) {
+    asm_emit(a, "($CALL)\n@SP\nAM=M+1\nA=A-1\nM=D\n");
+    const char* saved[] = { "LCL", "ARG", "THIS", "THAT" };
+    for (size_t i = 0; i < 4; i++) {
+        asm_emit(a, "@%s\nD=M\n@SP\nAM=M+1\nA=A-1\nM=D\n", saved[i]);
+    }
+    asm_emit(a, "@R14\nD=M\n@5\nD=D+A\n@SP\nD=M-D\n@ARG\nM=D\n@SP\nD=M\n@LCL\nM=D\n@R13\nA=M\n0;JMP\n");
+
+    asm_emit(a, "($RETURN)\n@R13\nM=D\n@LCL\nD=M\n@R14\nM=D\n@5\nA=D-A\nD=M\n@R15\nM=D\n@ARG\nD=M\n@SP\nM=D\n");
+    const char* restored[] = { "THAT", "THIS", "ARG", "LCL" };
+    for (size_t i = 0; i < 4; i++) {
+        asm_emit(a, "@R14\nAM=M-1\nD=M\n@%s\nM=D\n", restored[i]);
+    }
+    asm_emit(a, "@R13\nD=M\n@R15\nA=M\n0;JMP\n");
+}
+
+//*Lowers a whole program, one VM code buffer per file with `files` naming their statics. The
+//*bootstrap sets SP to 256, calls `entry` and parks in a loop should it ever return.
+Internal char* asm_program(AsmOptions options, VmInst** programs[], const char** files, size_t num_programs, const char* entry, size_t* num_insts) {
+    Asm a = { .options = options, .func = "" };
+    asm_emit(&a, "@256\nD=A\n@SP\nM=D\n");
+    VmInst boot = { VM_CALL, 0, 0, entry };
+    asm_call(&a, &boot);
+    asm_emit(&a, "($HALT)\n@$HALT\n0;JMP\n");
+    if (options.trampolines) {
+        asm_runtime(&a);
+    }
+    a.cached = false;
+    for (size_t p = 0; p < num_programs; p++) {
+        a.file = files[p];
+        asm_code(&a, *programs[p], BUF_LEN(*programs[p]));
+    }
+    *num_insts = a.num_insts;
+    return a.text;
+}
+
+//*Hack assembler and CPU, enough to run the output of both lowerings against each other
+typedef struct HackSym {
+    const char* name;
+    u16 val;
+} HackSym;
+
+Internal i32 hack_comp(const char* start, const char* end) {
+    LocalPersist const struct {
+        const char* comp;
+        u16 bits;
+    } comps[] = {
+        { "0", 0x2a }, { "1", 0x3f }, { "-1", 0x3a }, { "D", 0x0c }, { "A", 0x30 }, { "!D", 0x0d }, { "!A", 0x31 },
+        { "-D", 0x0f }, { "-A", 0x33 }, { "D+1", 0x1f }, { "A+1", 0x37 }, { "D-1", 0x0e }, { "A-1", 0x32 },
+        { "D+A", 0x02 }, { "D-A", 0x13 }, { "A-D", 0x07 }, { "D&A", 0x00 }, { "D|A", 0x15 },
+    };
+    char comp[8];
+    size_t len = end - start;
+    if (len >= sizeof(comp)) {
+        return -1;
+    }
+    memcpy(comp, start, len);
+    comp[len] = 0;
+    u16 a_bit = 0;
+    for (char* c = comp; *c; c++) {
+        if (*c == 'M') {
+            *c = 'A';
+            a_bit = 0x40;
+        }
+    }
+    for (size_t i = 0; i < sizeof(comps) / sizeof(comps[0]); i++) {
+        if (strcmp(comps[i].comp, comp) == 0) {
+            return a_bit | comps[i].bits;
+        }
+    }
+    return -1;
+}
+
+Internal u16 hack_lookup(HackSym** syms, const char* name, u16* next_var) {
+    for (HackSym* it = *syms; it != BUF_END(*syms); it++) {
+        if (it->name == name) {
+            return it->val;
+        }
+    }
+    BUF_PUSH(*syms, (HackSym) { name, (*next_var)++ });
+    return (*syms)[BUF_LEN(*syms) - 1].val;
+}
+
+//*Assembles `text` into a buffer of instructions, NULL on the first line it does not understand
+Internal u16* hack_assemble(const char* text) {
+    HackSym* syms = NULL;
+    LocalPersist const char* predefined[] = { "SP", "LCL", "ARG", "THIS", "THAT" };
+    for (u16 i = 0; i < 5; i++) {
+        BUF_PUSH(syms, (HackSym) { str_intern(predefined[i]), i });
+    }
+    for (u16 i = 0; i < 16; i++) {
+        char name[4];
+        snprintf(name, sizeof(name), "R%u", i);
+        BUF_PUSH(syms, (HackSym) { str_intern(name), i });
+    }
+    BUF_PUSH(syms, (HackSym) { str_intern("SCREEN"), 16384 });
+    BUF_PUSH(syms, (HackSym) { str_intern("KBD"), 24576 });
+
+    u16 pc = 0;
+    for (const char* line = text; *line; line = strchr(line, '\n') + 1) {
+        if (*line == '(') {
+            BUF_PUSH(syms, (HackSym) { str_intern_range(line + 1, strchr(line, ')')), pc });
+        }
+        else {
+            pc++;
+        }
+    }
+
+    u16* rom = NULL;
+    u16 next_var = 16;
+    for (const char* line = text; *line; line = strchr(line, '\n') + 1) {
+        const char* end = strchr(line, '\n');
+        if (*line == '(') {
+            continue;
+        }
+        if (*line == '@') {
+            if (line[1] >= '0' && line[1] <= '9') {
+                BUF_PUSH(rom, (u16)strtoul(line + 1, NULL, 10));
+            }
+            else {
+                BUF_PUSH(rom, hack_lookup(&syms, str_intern_range(line + 1, end), &next_var));
+            }
+            continue;
+        }
+        const char* eq = memchr(line, '=', end - line);
+        const char* semi = memchr(line, ';', end - line);
+        u16 dest = 0;
+        for (const char* c = line; eq && c != eq; c++) {
+            dest |= *c == 'A' ? 4 : *c == 'D' ? 2 : *c == 'M' ? 1 : 0;
+        }
+        u16 jump = 0;
+        if (semi) {
+            LocalPersist const char* jumps[] = { "", "JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP" };
+            while (jump < 8 && !(strlen(jumps[jump]) == (size_t)(end - semi - 1) && strncmp(jumps[jump], semi + 1, end - semi - 1) == 0)) {
+                jump++;
+            }
+        }
+        i32 comp = hack_comp(eq ? eq + 1 : line, semi ? semi : end);
+        if (comp < 0 || jump == 8) {
+            BUF_FREE(rom);
+            break;
+        }
+        BUF_PUSH(rom, (u16)(0xe000 | comp << 6 | dest << 3 | jump));
+    }
+    BUF_FREE(syms);
+    return rom;
+}
+
+//*Runs until the program jumps to the loop it is in or `max_cycles` pass, returns the cycles taken
+Internal size_t hack_run(const u16* rom, size_t rom_len, i16* ram, size_t max_cycles) {
+    u16 a = 0;
+    i16 d = 0;
+    u16 pc = 0;
+    size_t cycles = 0;
+    while (cycles < max_cycles && pc < rom_len) {
+        u16 inst = rom[pc];
+        cycles++;
+        if (!(inst & 0x8000)) {
+            a = inst;
+            pc++;
+            continue;
+        }
+        i16 x = d;
+        i16 y = (inst & 0x1000) ? ram[a & 0x7fff] : (i16)a;
+        u16 c = (inst >> 6) & 0x3f;
+        if (c & 0x20) {
+            x = 0;
+        }
+        if (c & 0x10) {
+            x = (i16)~x;
+        }
+        if (c & 0x08) {
+            y = 0;
+        }
+        if (c & 0x04) {
+            y = (i16)~y;
+        }
+        i16 out = (c & 0x02) ? (i16)(x + y) : (i16)(x & y);
+        if (c & 0x01) {
+            out = (i16)~out;
+        }
+        u16 target = a;
+        if (inst & 0x08) {
+            ram[a & 0x7fff] = out;
+        }
+        if (inst & 0x20) {
+            a = (u16)out;
+        }
+        if (inst & 0x10) {
+            d = out;
+        }
+        bool jump = ((inst & 4) && out < 0) || ((inst & 2) && out == 0) || ((inst & 1) && out > 0);
+        if (jump && target == pc - 1 && rom[pc - 1] == target) {
+            break;
+        }
+        pc = jump ? target : (u16)(pc + 1);
+    }
+    return cycles;
+}
+
+//*Programs for the backend tests and benchmark, a bump allocator stands in for the OS
+const char* asm_test_classes[] = {
+    "class Memory { static int next; function int alloc(int size) { var int p; if (next = 0) { let next = 2048; } let p = next; let next = next + size; return p; } }",
+    "class Acc { field int total, count; constructor Acc new() { let total = 0; let count = 0; return this; } method void add(int x) { let total = total + x; let count = count + 1; return; } method int get() { return total; } }",
+    "class Main { function int fib(int n) { if (n < 2) { return n; } return Main.fib(n - 1) + Main.fib(n - 2); } "
+    "function void main() { var int i; var Acc acc; var Array out; let acc = Acc.new(); let i = 0; while (i < 100) { do acc.add(i); let i = i + 1; } "
+    "let out = 8000; let out[0] = acc.get(); let out[1] = Main.fib(12); let out[2] = (i > 50) & ~(i = 3) | (-i < 0); "
+    "let out[3] = 0; if (i) { let out[3] = 1; } return; } }",
+};
+
+//*compiles asm_test_classes with both lowerings and runs them, returns false if the results differ
+Internal bool asm_run_tests_program(size_t* cycles, size_t* insts) {
+    VmInst* code[3];
+    VmInst** programs[3];
+    const char* files[3];
+    for (size_t i = 0; i < 3; i++) {
+        init_keywords();
+        init_stream("asm_tests", asm_test_classes[i]);
+        ClassDecl* c = parse_class();
+        code[i] = gen_class(c);
+        vm_optimize(&code[i]);
+        programs[i] = &code[i];
+        files[i] = c->name;
+    }
+    i16* ram[2];
+    for (size_t mode = 0; mode < 2; mode++) {
+        AsmOptions options = { mode == 1, mode == 1 };
+        char* text = asm_program(options, programs, files, 3, str_intern("Main.main"), &insts[mode]);
+        BUF_PUSH(text, 0);
+        u16* rom = hack_assemble(text);
+        assert(rom);
+        ram[mode] = xcalloc(32768, sizeof(i16));
+        cycles[mode] = hack_run(rom, BUF_LEN(rom), ram[mode], 10000000);
+        BUF_FREE(rom);
+        BUF_FREE(text);
+    }
+    //*an int condition of 100 is false, only -1 is true
+    bool same = ram[0][8000] == 4950 && ram[0][8001] == 144 && ram[0][8002] == -1 && ram[0][8003] == 0;
+    for (size_t i = 8000; i < 8004; i++) {
+        same &= ram[0][i] == ram[1][i];
+    }
+    for (size_t i = 0; i < 3; i++) {
+        BUF_FREE(code[i]);
+    }
+    free(ram[0]);
+    free(ram[1]);
+    return same;
+}
+
+Internal void asm_tests(void) {
+    assert(hack_comp("D+M", "D+M" + 3) == 0x42 && hack_comp("M-D", "M-D" + 3) == 0x47 && hack_comp("D+", "D+" + 2) < 0);
+    u16* rom = hack_assemble("@3\nD=A\n@R5\nM=D\n(L)\n@L\n0;JMP\n");
+    assert(rom && BUF_LEN(rom) == 6 && rom[0] == 3 && rom[2] == 5 && rom[4] == 4);
+    i16 ram[32] = { 0 };
+    hack_run(rom, BUF_LEN(rom), ram, 100);
+    assert(ram[5] == 3);
+    BUF_FREE(rom);
+
+    size_t cycles[2];
+    size_t insts[2];
+    assert(asm_run_tests_program(cycles, insts));
+    assert(insts[1] < insts[0] && cycles[1] < cycles[0]);
+}
@@ -16,9 +16,54 @@ void* ast_dup(const void* src, size_t size) {
     return ptr;
 }
 
-void* ast_rep(const void* src, size_t size) {
-    void* ptr = ast_dup(src, size);
-    BUF_FREE(src);
+//*Lists under construction (arguments, statements, declarations) grow on ast_scratch, a byte BUF kept
+//*across parses, and are copied into ast_arena once complete. Lists nest like the grammar does, a list
+//*is always committed before its parent gets its next element, so they stack up at the end of the
+//*scratch buffer and a committed list frees its space by truncating it. Once the buffer has reached
+//*the deepest nesting the parser needs, building lists allocates nothing but the final copy.
+char* ast_scratch;
+
+typedef struct AstList {
+    //*scratch length before the list, start is that aligned up
+    size_t base;
+    size_t start;
+    size_t len;
+} AstList;
+
+#define AST_LIST_ALIGNMENT 16
+
+Internal AstList ast_list_begin(void) {
+    size_t base = BUF_LEN(ast_scratch);
+    size_t start = ALIGN_UP(base, AST_LIST_ALIGNMENT);
+    BUF_FIT(ast_scratch, start);
+    if (ast_scratch) {
+        _BUF_HDR(ast_scratch)->len = start;
+    }
+    return (AstList) { base, start, 0 };
+}
+
+Internal void ast_list_push(AstList* list, const void* elem, size_t size) {
+    assert(list->start + list->len * size == BUF_LEN(ast_scratch));
+    BUF_FIT(ast_scratch, BUF_LEN(ast_scratch) + size);
+    memcpy(ast_scratch + BUF_LEN(ast_scratch), elem, size);
+    _BUF_HDR(ast_scratch)->len += size;
+    list->len++;
+}
+
+//*the element is evaluated before anything is reserved, it may build lists of its own
+#define AST_LIST_PUSH(list, T, ...) \
+    do { \
+        T ast_list_elem_ = (__VA_ARGS__); \
+        ast_list_push(&(list), &ast_list_elem_, sizeof(T)); \
+    } while (0)
+
+//*copies the list into ast_arena and drops it from the scratch buffer, NULL when it is empty
+Internal void* ast_list_commit(AstList* list, size_t size) {
+    assert(list->start + list->len * size == BUF_LEN(ast_scratch));
+    void* ptr = ast_dup(ast_scratch + list->start, list->len * size);
+    if (ast_scratch) {
+        _BUF_HDR(ast_scratch)->len = list->base;
+    }
     return ptr;
 }
 
@@ -32,10 +77,126 @@ Type* type_new(TypeKind kind, const char* name) {
 ClassDecl* class_new(const char* name, ClassVarDecl* vars, size_t num_vars, Subroutine* subs, size_t num_subs) {
     ClassDecl* c = ast_alloc(sizeof(ClassDecl));
     c->name = name;
-    c->vars = ast_rep(vars, num_vars * sizeof(*vars));
+    c->vars = vars;
     c->num_vars = num_vars;
-    c->subs = ast_rep(subs, num_subs * sizeof(*subs));
+    c->subs = subs;
     c->num_subs = num_subs;
 
     return c;
-}
\ No newline at end of file
+}
+
+Expr* expr_new(ExprKind kind, SrcPos pos) {
+    Expr* e = ast_alloc(sizeof(Expr));
+    e->kind = kind;
+    e->pos = pos;
+    return e;
+}
+
+Expr* expr_int(SrcPos pos, i32 int_val) {
+    Expr* e = expr_new(EXPR_INT, pos);
+    e->int_val = int_val;
+    return e;
+}
+
+Expr* expr_str(SrcPos pos, const char* str_val) {
+    Expr* e = expr_new(EXPR_STR, pos);
+    e->str_val = str_val;
+    return e;
+}
+
+Expr* expr_keyword(SrcPos pos, const char* keyword) {
+    Expr* e = expr_new(EXPR_KEYWORD, pos);
+    e->keyword = keyword;
+    return e;
+}
+
+Expr* expr_name(SrcPos pos, const char* name) {
+    Expr* e = expr_new(EXPR_NAME, pos);
+    e->name = name;
+    return e;
+}
+
+Expr* expr_index(SrcPos pos, const char* name, Expr* index) {
+    Expr* e = expr_new(EXPR_INDEX, pos);
+    e->index.name = name;
+    e->index.expr = index;
+    return e;
+}
+
+Expr* expr_call(SrcPos pos, CallKind kind, const char* field_name, const char* sub_name, Expr** args, size_t num_args) {
+    Expr* e = expr_new(EXPR_CALL, pos);
+    e->call.kind = kind;
+    e->call.field_name = field_name;
+    e->call.sub_name = sub_name;
+    e->call.expr_list.exprs = args;
+    e->call.expr_list.num_exprs = num_args;
+    return e;
+}
+
+Expr* expr_unary(SrcPos pos, TokenKind op, Expr* expr) {
+    Expr* e = expr_new(EXPR_UNARY, pos);
+    e->unary.op = op;
+    e->unary.expr = expr;
+    return e;
+}
+
+Expr* expr_binary(SrcPos pos, TokenKind op, Expr* left, Expr* right) {
+    Expr* e = expr_new(EXPR_BINARY, pos);
+    e->binary.op = op;
+    e->binary.left = left;
+    e->binary.right = right;
+    return e;
+}
+
+Expr* expr_paren(SrcPos pos, Expr* expr) {
+    Expr* e = expr_new(EXPR_PAREN, pos);
+    e->paren.expr = expr;
+    return e;
+}
+
+StmtList stmt_list(SrcPos pos, Stmt** stmts, size_t num_stmts) {
+    return (StmtList) { pos, stmts, num_stmts };
+}
+
+Stmt* stmt_new(StmtKind kind, SrcPos pos) {
+    Stmt* s = ast_alloc(sizeof(Stmt));
+    s->kind = kind;
+    s->pos = pos;
+    return s;
+}
+
+Stmt* stmt_let(SrcPos pos, const char* name, Expr* index_expr, Expr* assign_expr) {
+    Stmt* s = stmt_new(STMT_LET, pos);
+    s->let_stmt.name = name;
+    s->let_stmt.index_expr = index_expr;
+    s->let_stmt.assign_expr = assign_expr;
+    return s;
+}
+
+Stmt* stmt_if(SrcPos pos, Expr* cond, StmtList then_block, StmtList else_block, bool has_else) {
+    Stmt* s = stmt_new(STMT_IF, pos);
+    s->if_stmt.cond = cond;
+    s->if_stmt.then_block = then_block;
+    s->if_stmt.else_block = else_block;
+    s->if_stmt.has_else = has_else;
+    return s;
+}
+
+Stmt* stmt_while(SrcPos pos, Expr* cond, StmtList block) {
+    Stmt* s = stmt_new(STMT_WHILE, pos);
+    s->while_stmt.cond = cond;
+    s->while_stmt.block = block;
+    return s;
+}
+
+Stmt* stmt_do(SrcPos pos, Expr* subroutine_call) {
+    Stmt* s = stmt_new(STMT_DO, pos);
+    s->do_stmt.subroutine_call = subroutine_call;
+    return s;
+}
+
+Stmt* stmt_return(SrcPos pos, Expr* expr) {
+    Stmt* s = stmt_new(STMT_RETURN, pos);
+    s->return_stmt.expr = expr;
+    return s;
+}
@@ -35,6 +35,7 @@ typedef enum ExprKind {
     EXPR_CALL,
     EXPR_BINARY,
     EXPR_UNARY,
+    EXPR_PAREN,
 } ExprKind;
 
 typedef struct ExprList {
@@ -42,6 +43,8 @@ typedef struct ExprList {
     size_t num_exprs;
 } ExprList;
 
+//*`foo()` is parsed as a method call on this and `Foo.bar()` as a function call, which of the two a
+//*qualified call really is depends on whether `Foo` names a variable
 typedef enum CallKind {
     CALL_FUNCTION,
     CALL_METHOD,
@@ -55,14 +58,18 @@ typedef struct SubCall {
 } SubCall;
 
 //? Keyword Constant
+//*binary expressions follow the precedence bands of TokenKind, EXPR_PAREN keeps explicit parentheses
+//*so the tree still matches the source
 typedef struct Expr {
     ExprKind kind;
+    SrcPos pos;
     union {
         i32 int_val;
         const char* str_val;
         const char* name;
         const char* keyword;
         struct {
+            const char* name;
             Expr* expr;
         } index;
         SubCall call;
@@ -75,6 +82,9 @@ typedef struct Expr {
             Expr* left;
             Expr* right;
         } binary;
+        struct {
+            Expr* expr;
+        } paren;
     };
 } Expr;
 
@@ -94,6 +104,7 @@ typedef struct StmtList {
 
 typedef struct Stmt {
     StmtKind kind;
+    SrcPos pos;
     union {
         struct {
             const char* name;
@@ -104,6 +115,7 @@ typedef struct Stmt {
             Expr* cond;
             StmtList then_block;
             StmtList else_block;
+            bool has_else;
         } if_stmt;
         struct {
             Expr* cond;
@@ -124,6 +136,8 @@ typedef enum VarType {
     VAR_FIELD,
 } VarType;
 
+//*Names declared together (`var int i, j;`) share the same Type node, a new declaration always gets
+//*a Type of its own, which is how the grouping of the source is kept
 typedef struct VarDecl {
     Type* type;
     const char* name;
@@ -0,0 +1,613 @@
+//*Microbenchmarks, run with `main --bench <dir or file>`. Sources are loaded up front so only
+//*the measured phase is timed, every measurement keeps the best of several repetitions.
+
+#define BENCH_REPS 5
+#define BENCH_SYNTHETIC_SIZE (32 * 1024 * 1024)
+
+typedef void (*ScanFunc)(void);
+
+typedef struct BenchSource {
+    const char* name;
+    const char* buf;
+    size_t len;
+} BenchSource;
+
+Internal BenchSource* bench_load_sources(const char* path) {
+    BenchSource* sources = NULL;
+    char** paths = NULL;
+    if (!walk_sources(path, &paths)) {
+        BUF_PUSH(sources, (BenchSource) { path, read_file(path), 0 });
+    }
+    for (size_t i = 0; i < BUF_LEN(paths); i++) {
+        BUF_PUSH(sources, (BenchSource) { paths[i], read_file(paths[i]), 0 });
+    }
+    BUF_FREE(paths);
+
+    for (BenchSource* it = sources; it != BUF_END(sources); it++) {
+        it->len = strlen(it->buf);
+    }
+    return sources;
+}
+
+//*xorshift generator so the synthetic corpus is identical between runs
+Internal u32 bench_rand(u64* state) {
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (u32)(x >> 32);
+}
+
+//*Builds roughly `size` bytes of Jack shaped like the test programs: many classes of short
+//*subroutines with a spread of identifiers, integer and string constants and both comment kinds.
+Internal char* bench_synthetic_corpus(size_t size) {
+    LocalPersist const char* names[] = { "x", "size", "game", "square", "direction", "counter", "Memory", "a", "i", "sum" };
+    u64 state = 0x9e3779b97f4a7c15;
+    char* buf = NULL;
+    u32 num_classes = 0;
+    while (BUF_LEN(buf) < size) {
+        BUF_PRINTF(buf, "/** Generated class %u. */\nclass Gen%u {\n    field int x, y;\n    static boolean flag;\n\n", num_classes, num_classes);
+        for (u32 sub = 0; sub < 32; sub++) {
+            BUF_PRINTF(buf, "    method int run%u(int a, int b) {\n        var int i, sum;\n", sub);
+            for (u32 stmt = 0; stmt < 16; stmt++) {
+                const char* n0 = names[bench_rand(&state) % 10];
+                const char* n1 = names[bench_rand(&state) % 10];
+                u32 id = bench_rand(&state) % 4096;
+                u32 val = bench_rand(&state) % 32768;
+                switch (bench_rand(&state) % 6) {
+                    case 0: BUF_PRINTF(buf, "        let %s%u = %s%u + %u;\n", n0, id, n1, id, val); break;
+                    case 1: BUF_PRINTF(buf, "        do Output.printString(\"%s value %u\");\n", n0, val); break;
+                    case 2: BUF_PRINTF(buf, "        // adjust %s by %u\n", n0, val); break;
+                    case 3: BUF_PRINTF(buf, "        /* block %u */ let %s = %s * 2;\n", val, n0, n1); break;
+                    case 4: BUF_PRINTF(buf, "        if ((%s%u < %u) & ~(%s = 0)) { let %s = %s / 2; }\n", n0, id, val, n1, n0, n1); break;
+                    case 5: BUF_PRINTF(buf, "        while (%s%u > %u) { let %s[%u] = %s - 1; }\n", n0, id, val, n1, id % 64, n1); break;
+                }
+            }
+            BUF_PRINTF(buf, "        return sum;\n    }\n\n");
+        }
+        BUF_PRINTF(buf, "}\n\n");
+        num_classes++;
+    }
+    return buf;
+}
+
+Internal size_t bench_scan(const char* buf, size_t len, ScanFunc scan) {
+    stream = buf;
+    stream_end = buf + len;
+    line_start = buf;
+    token.pos.name = "bench";
+    token.pos.line = 1;
+
+    size_t num_tokens = 0;
+    do {
+        scan();
+        if (token.kind == TOKEN_STR) {
+            BUF_FREE(token.str_val);
+        }
+        num_tokens++;
+    } while (!is_token_eof());
+
+    return num_tokens;
+}
+
+Internal f64 bench_scan_sources(BenchSource* sources, size_t num_sources, size_t reps, ScanFunc scan, size_t* num_tokens) {
+    f64 best = 0;
+    for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+        *num_tokens = 0;
+        f64 start = time_now();
+        for (size_t r = 0; r < reps; r++) {
+            for (size_t i = 0; i < num_sources; i++) {
+                *num_tokens += bench_scan(sources[i].buf, sources[i].len, scan);
+            }
+        }
+        f64 elapsed = time_now() - start;
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+Internal void bench_lex_corpus(const char* label, BenchSource* sources, size_t num_sources, size_t reps) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < num_sources; i++) {
+        bytes += sources[i].len;
+    }
+    bytes *= reps;
+
+    size_t ref_tokens = 0;
+    size_t table_tokens = 0;
+    f64 ref_time = bench_scan_sources(sources, num_sources, reps, next_token_ref, &ref_tokens);
+    f64 table_time = bench_scan_sources(sources, num_sources, reps, next_token, &table_tokens);
+    if (ref_tokens != table_tokens) {
+        fatal("lexers disagree on %s: %zu vs %zu tokens", label, ref_tokens, table_tokens);
+    }
+
+    f64 mb = (f64)bytes / (1024.0 * 1024.0);
+    printf("%-12s %8.2f MiB %10zu tokens\n", label, mb, table_tokens);
+    printf("  switch     %8.2f ms %8.1f MiB/s %8.1f Mtok/s\n", ref_time * 1e3, mb / ref_time, table_tokens / ref_time * 1e-6);
+    printf("  table      %8.2f ms %8.1f MiB/s %8.1f Mtok/s\n", table_time * 1e3, mb / table_time, table_tokens / table_time * 1e-6);
+    printf("  speedup    %8.2fx\n", ref_time / table_time);
+}
+
+//*Numeric heavy source in the style of generated lookup tables: long runs of array stores whose
+//*values spread over every literal length Jack allows.
+Internal char* bench_numeric_corpus(size_t size) {
+    u64 state = 0x2545f4914f6cdd1d;
+    char* buf = NULL;
+    u32 num_tables = 0;
+    while (BUF_LEN(buf) < size) {
+        BUF_PRINTF(buf, "class Table%u {\n    function void init(Array t) {\n", num_tables);
+        for (u32 i = 0; i < 1024; i++) {
+            u32 val = bench_rand(&state) % 32768 >> (bench_rand(&state) % 15);
+            BUF_PRINTF(buf, "        let t[%u] = %u; let t[%u] = %u;\n", 2 * i, val, 2 * i + 1, 32767 - val);
+        }
+        BUF_PRINTF(buf, "        return;\n    }\n}\n");
+        num_tables++;
+    }
+    return buf;
+}
+
+//*Runs only the integer scanner over every literal of the buffer, the remaining bytes are skipped
+Internal size_t bench_scan_ints(const char* buf, size_t len, ScanFunc scan) {
+    stream = buf;
+    stream_end = buf + len;
+    token.pos.name = "bench";
+    token.pos.line = 1;
+
+    size_t sum = 0;
+    while (*stream) {
+        if (char_classes[(u8)*stream] == CHAR_DIGIT) {
+            token.start = stream;
+            scan();
+            sum += token.int_val;
+        }
+        else if (char_classes[(u8)*stream] == CHAR_ALPHA) {
+            //*skip whole identifiers so digits inside names are not scanned as literals
+            while (IS_IDENT_CHAR(*stream)) {
+                stream++;
+            }
+        }
+        else {
+            stream++;
+        }
+    }
+    return sum;
+}
+
+Internal void bench_ints(void) {
+    char* buf = bench_numeric_corpus(BENCH_SYNTHETIC_SIZE / 2);
+    size_t len = BUF_LEN(buf);
+
+    f64 times[2] = { 0 };
+    size_t sums[2] = { 0 };
+    ScanFunc scans[2] = { scan_int_ref, scan_int };
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+            f64 start = time_now();
+            sums[i] = bench_scan_ints(buf, len, scans[i]);
+            f64 elapsed = time_now() - start;
+            if (rep == 0 || elapsed < times[i]) {
+                times[i] = elapsed;
+            }
+        }
+    }
+    if (sums[0] != sums[1]) {
+        fatal("integer scanners disagree: %zu vs %zu", sums[0], sums[1]);
+    }
+
+    f64 mb = (f64)len / (1024.0 * 1024.0);
+    printf("%-12s %8.2f MiB\n", "numeric", mb);
+    printf("  digits     %8.2f ms %8.1f MiB/s\n", times[0] * 1e3, mb / times[0]);
+    printf("  swar       %8.2f ms %8.1f MiB/s\n", times[1] * 1e3, mb / times[1]);
+    printf("  speedup    %8.2fx\n", times[0] / times[1]);
+
+    BenchSource numeric = { "numeric", buf, len };
+    bench_lex_corpus("numeric lex", &numeric, 1, 1);
+    BUF_FREE(buf);
+}
+
+Internal void bench_lex(BenchSource* sources) {
+    init_keywords();
+
+    //*the test sources are tiny, repeat them so the timer resolution does not dominate
+    bench_lex_corpus("sources", sources, BUF_LEN(sources), 256);
+
+    BenchSource synthetic = { "synthetic", bench_synthetic_corpus(BENCH_SYNTHETIC_SIZE), 0 };
+    synthetic.len = BUF_LEN(synthetic.buf);
+    bench_lex_corpus("synthetic", &synthetic, 1, 1);
+    BUF_FREE(synthetic.buf);
+}
+
+//*Parse tree emission alone, the classes are parsed once and written to an in memory Writer
+Internal void bench_tree(BenchSource* sources) {
+    size_t num_sources = BUF_LEN(sources);
+    ClassDecl** classes = NULL;
+    for (size_t i = 0; i < num_sources; i++) {
+        init_stream(sources[i].name, sources[i].buf);
+        BUF_PUSH(classes, parse_class());
+    }
+
+    size_t reps = 256;
+    size_t bytes = 0;
+    f64 best = 0;
+    for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+        Writer w = writer_new(NULL);
+        f64 start = time_now();
+        for (size_t r = 0; r < reps; r++) {
+            for (size_t i = 0; i < num_sources; i++) {
+                tree_class(&w, classes[i]);
+            }
+            writer_flush(&w);
+            bytes = BUF_LEN(w.mem);
+            BUF_CLEAR(w.mem);
+        }
+        f64 elapsed = time_now() - start;
+        writer_close(&w);
+        BUF_FREE(w.mem);
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    f64 mb = (f64)(bytes * reps) / (1024.0 * 1024.0);
+    printf("%-12s %8.2f MiB\n", "tree xml", mb);
+    printf("  emit       %8.2f ms %8.1f MiB/s\n", best * 1e3, mb / best);
+    BUF_FREE(classes);
+}
+
+//*Generated VM size before and after the peephole pass, instruction count is the runtime cost on
+//*the emulated CPU so this is reported next to the time the pass takes
+Internal void bench_vm(BenchSource* sources) {
+    size_t num_sources = BUF_LEN(sources);
+    size_t before = 0;
+    size_t after = 0;
+    f64 opt_time = 0;
+    printf("%-12s\n", "vm insts");
+    for (size_t i = 0; i < num_sources; i++) {
+        init_stream(sources[i].name, sources[i].buf);
+        ClassDecl* c = parse_class();
+        VmInst* code = gen_class(c);
+        size_t len = BUF_LEN(code);
+        BUF_FREE(code);
+        f64 start = time_now();
+        fold_class(c);
+        code = gen_class(c);
+        vm_optimize(&code);
+        opt_time += time_now() - start;
+        printf("  %-40s %6zu -> %6zu\n", sources[i].name, len, BUF_LEN(code));
+        before += len;
+        after += BUF_LEN(code);
+        BUF_FREE(code);
+    }
+    printf("  total      %8zu -> %6zu (%.1f%% fewer) in %.2f ms\n", before, after, 100.0 * (before - after) / MAX(1, before), opt_time * 1e3);
+    printf("  folded %zu expressions, dropped %zu statements\n", fold_stats.folded, fold_stats.dropped_stmts);
+}
+
+//*Static size and cycles on the Hack CPU of asm_test_classes with the textbook lowering and the
+//*cached one with trampolines
+Internal void bench_asm(void) {
+    size_t cycles[2];
+    size_t insts[2];
+    bool same = asm_run_tests_program(cycles, insts);
+    printf("%-12s\n", "hack asm");
+    printf("  standard   %8zu instructions %10zu cycles\n", insts[0], cycles[0]);
+    printf("  cached     %8zu instructions %10zu cycles (%.2fx faster)%s\n", insts[1], cycles[1], (f64)cycles[0] / MAX(1, cycles[1]), same ? "" : " RESULTS DIFFER");
+}
+
+//*Map against the typed NameIndex on pointer keys spaced like interned names, lookups alternate
+//*between hits and misses. Times are the best of BENCH_REPS, in ns per operation.
+Internal void bench_maps(void) {
+    LocalPersist const size_t sizes[] = { 64, 4096, 1 << 20 };
+    printf("%-12s\n", "maps");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        char* names = xmalloc(2 * n * 16);
+        size_t reps = MAX(1, (1 << 20) / n);
+        f64 times[2][2] = { { 0 } };
+        size_t found[2] = { 0 };
+        for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+            f64 start = time_now();
+            Map map = { 0 };
+            for (size_t r = 0; r < reps; r++) {
+                free(map.keys);
+                free(map.vals);
+                map = (Map) { 0 };
+                for (size_t i = 0; i < n; i++) {
+                    map_put(&map, names + 32 * i, (void*)(i + 1));
+                }
+            }
+            f64 put_time = time_now() - start;
+            start = time_now();
+            found[0] = 0;
+            for (size_t r = 0; r < reps; r++) {
+                for (size_t i = 0; i < 2 * n; i++) {
+                    found[0] += map_get(&map, names + 16 * i) != NULL;
+                }
+            }
+            f64 get_time = time_now() - start;
+            free(map.keys);
+            free(map.vals);
+            if (rep == 0 || put_time < times[0][0]) {
+                times[0][0] = put_time;
+            }
+            if (rep == 0 || get_time < times[0][1]) {
+                times[0][1] = get_time;
+            }
+
+            start = time_now();
+            NameIndex index = { 0 };
+            for (size_t r = 0; r < reps; r++) {
+                name_index_free(&index);
+                for (size_t i = 0; i < n; i++) {
+                    name_index_put(&index, names + 32 * i, (u32)i);
+                }
+            }
+            put_time = time_now() - start;
+            start = time_now();
+            found[1] = 0;
+            for (size_t r = 0; r < reps; r++) {
+                for (size_t i = 0; i < 2 * n; i++) {
+                    found[1] += name_index_get(&index, names + 16 * i) != NULL;
+                }
+            }
+            get_time = time_now() - start;
+            name_index_free(&index);
+            if (rep == 0 || put_time < times[1][0]) {
+                times[1][0] = put_time;
+            }
+            if (rep == 0 || get_time < times[1][1]) {
+                times[1][1] = get_time;
+            }
+        }
+        if (found[0] != found[1]) {
+            fatal("maps disagree: %zu vs %zu hits", found[0], found[1]);
+        }
+        f64 ops = (f64)(reps * n);
+        printf("  %8zu keys  Map put %6.1f ns get %6.1f ns   NameIndex put %6.1f ns get %6.1f ns\n", n,
+            times[0][0] / ops * 1e9, times[0][1] / ops / 2 * 1e9, times[1][0] / ops * 1e9, times[1][1] / ops / 2 * 1e9);
+        free(names);
+    }
+}
+
+//*Regrowth with and without the size hints for the front end of a compile: lex, token xml and
+//*parse. Each run starts from an intern table holding just the keywords and from a fresh ast_arena.
+//*A positive `ast_reserve` is used instead of the hinted arena size, to measure the tree.
+Internal void bench_hints_run(BenchSource* source, size_t ast_reserve, GrowStats* stats, size_t* num_tokens, size_t* num_names, size_t* ast_bytes) {
+    InternMap saved_interns = interns;
+    Arena saved_arena = ast_arena;
+    interns = (InternMap) { 0 };
+    for (const char** it = keywords; it != BUF_END(keywords); it++) {
+        Intern* intern = (Intern*)(*it - offsetof(Intern, str));
+        intern_map_put(&interns, hash_bytes(intern->str, intern->len), intern);
+    }
+    ast_arena = (Arena) { 0 };
+    grow_stats = (GrowStats) { 0 };
+
+    size_t names_before = interns.len;
+    if (size_hints) {
+        intern_map_reserve(&interns, interns.len + HINT_NAMES_PER_SQRT_BYTE * isqrt(source->len));
+        arena_reserve(&ast_arena, ast_reserve ? ast_reserve : source->len * HINT_AST_BYTES_PER_BYTE);
+    }
+    Token* tokens = lex_tokens(source->name, source->buf);
+    char* out = NULL;
+    xml_tokens(&out, tokens, BUF_LEN(tokens));
+    init_replay(source->name, tokens, BUF_LEN(tokens));
+    while (!is_token_eof()) {
+        parse_class();
+    }
+    close_replay();
+    *stats = grow_stats;
+    *num_tokens = BUF_LEN(tokens);
+    *num_names = interns.len - names_before;
+    *ast_bytes = BUF_LEN(ast_arena.blocks) == 1 ? (size_t)(ast_arena.ptr - ast_arena.blocks[0]) : 0;
+
+    BUF_FREE(out);
+    free_tokens(tokens);
+    arena_free(&ast_arena);
+    intern_map_free(&interns);
+    interns = saved_interns;
+    ast_arena = saved_arena;
+}
+
+Internal void bench_hints(BenchSource* sources) {
+    BenchSource synthetic = { "synthetic", bench_synthetic_corpus(BENCH_SYNTHETIC_SIZE), 0 };
+    synthetic.len = BUF_LEN(synthetic.buf);
+    BenchSource* inputs = NULL;
+    for (size_t i = 0; i < BUF_LEN(sources); i++) {
+        BUF_PUSH(inputs, sources[i]);
+    }
+    BUF_PUSH(inputs, synthetic);
+
+    printf("%-12s\n", "size hints");
+    for (BenchSource* it = inputs; it != BUF_END(inputs); it++) {
+        GrowStats stats[2];
+        size_t num_tokens;
+        size_t num_names;
+        size_t ast_bytes;
+        for (size_t hints = 0; hints < 2; hints++) {
+            size_hints = hints;
+            bench_hints_run(it, 0, &stats[hints], &num_tokens, &num_names, &ast_bytes);
+        }
+        GrowStats measure;
+        bench_hints_run(it, 16 * it->len + ARENA_BLOCK_SIZE, &measure, &num_tokens, &num_names, &ast_bytes);
+        printf("  %-40s reallocs %5zu -> %5zu, rehashes %2zu -> %2zu, arena blocks %3zu -> %3zu\n", it->name, stats[0].buf_reallocs,
+            stats[1].buf_reallocs, stats[0].map_rehashes, stats[1].map_rehashes, stats[0].arena_blocks, stats[1].arena_blocks);
+        printf("  %-40s %.1f bytes per token, %.1f per new name, %.2f ast bytes per byte\n", "", (f64)it->len / MAX(1, num_tokens),
+            (f64)it->len / MAX(1, num_names), (f64)ast_bytes / MAX(1, it->len));
+    }
+    size_hints = true;
+    BUF_FREE(inputs);
+    BUF_FREE(synthetic.buf);
+}
+
+//*Interpreter speed on the program of the assembly tests, compiled once and run repeatedly
+Internal void bench_interp(void) {
+    VmInst* code[3];
+    VmInst** programs[3];
+    const char* files[3];
+    for (size_t i = 0; i < 3; i++) {
+        init_keywords();
+        init_stream("bench_interp", asm_test_classes[i]);
+        ClassDecl* c = parse_class();
+        code[i] = gen_class(c);
+        vm_optimize(&code[i]);
+        programs[i] = &code[i];
+        files[i] = c->name;
+    }
+    u64 executed = 0;
+    f64 seconds = 0;
+    for (size_t run = 0; run < 200; run++) {
+        Interp in = { 0 };
+        interp_load(&in, programs, files, 3, str_intern("Main.main"));
+        f64 start = time_now();
+        interp_run(&in);
+        seconds += time_now() - start;
+        executed += in.executed;
+        interp_free_all(&in);
+    }
+    printf("%-12s\n", "interp");
+    printf("  %s dispatch %10llu instructions in %.2f ms (%.1fM instructions/s)\n", INTERP_THREADED ? "threaded" : "switch",
+        (unsigned long long)executed, seconds * 1e3, executed / MAX(seconds, 1e-9) * 1e-6);
+    for (size_t i = 0; i < 3; i++) {
+        BUF_FREE(code[i]);
+    }
+}
+
+//*Arithmetic in the style of the screen and game code, scaling by small constants
+Internal char* bench_mul_corpus(void) {
+    LocalPersist const i32 factors[] = { 2, 4, 8, 16, 32, 3, 5, 10, 12, 100, 512, 1000 };
+    u64 state = 0x853c49e6748fea9b;
+    char* buf = NULL;
+    BUF_PRINTF(buf, "class Scale {\n    function int run(int x, int y) {\n        var int a, b;\n");
+    for (u32 i = 0; i < 256; i++) {
+        i32 k = factors[bench_rand(&state) % 12];
+        switch (bench_rand(&state) % 4) {
+            case 0: BUF_PRINTF(buf, "        let a = x * %d;\n", k); break;
+            case 1: BUF_PRINTF(buf, "        let b = %d * (y + a);\n", k); break;
+            case 2: BUF_PRINTF(buf, "        let a = (x * %d) + (y * 32);\n", k); break;
+            case 3: BUF_PRINTF(buf, "        let b = b / %d;\n", k); break;
+        }
+    }
+    BUF_PRINTF(buf, "        return a + b;\n    }\n}\n");
+    return buf;
+}
+
+Internal void bench_strength_source(const char* label, const char* src) {
+    size_t insts[2];
+    GenStats stats[2];
+    for (size_t reduce = 0; reduce < 2; reduce++) {
+        gen_reduce_strength = reduce;
+        gen_stats = (GenStats) { 0 };
+        init_stream(label, src);
+        VmInst* code = gen_class(parse_class());
+        vm_optimize(&code);
+        insts[reduce] = BUF_LEN(code);
+        stats[reduce] = gen_stats;
+        BUF_FREE(code);
+    }
+    gen_reduce_strength = true;
+    printf("  %-40s %6zu -> %6zu insts, multiply calls %4zu -> %4zu, divide calls %4zu -> %4zu\n", label, insts[0], insts[1],
+        stats[0].mul_calls, stats[1].mul_calls, stats[0].div_calls, stats[1].div_calls);
+}
+
+//*Static VM size and the Math.multiply/divide calls left with and without strength reduction, every
+//*call removed saves a full software multiply at run time
+Internal void bench_strength(BenchSource* sources) {
+    printf("%-12s\n", "strength");
+    for (size_t i = 0; i < BUF_LEN(sources); i++) {
+        bench_strength_source(sources[i].name, sources[i].buf);
+    }
+    char* corpus = bench_mul_corpus();
+    bench_strength_source("scale (synthetic)", corpus);
+    BUF_FREE(corpus);
+}
+
+//*Language server edits on one class of a few thousand lines: opening it against typing a character
+//*into a subroutine in the middle and taking it out again
+Internal void bench_lsp(void) {
+    char* src = NULL;
+    BUF_PRINTF(src, "class Big {\n    field int x, y;\n");
+    for (u32 sub = 0; sub < 300; sub++) {
+        BUF_PRINTF(src, "    method int run%u(int a, int b) {\n        var int i, sum;\n        let i = 0;\n", sub);
+        BUF_PRINTF(src, "        while (i < a) {\n            let sum = sum + (i * b) - x;\n            if (sum > 100) {\n");
+        BUF_PRINTF(src, "                do Output.printString(\"big\");\n            }\n            let i = i + 1;\n        }\n        return sum;\n    }\n");
+    }
+    BUF_PRINTF(src, "}\n");
+    BUF_PUSH(src, 0);
+    size_t num_lines = lsp_count_lines(src, strlen(src));
+    bool collect = lex_collect_diags;
+    lex_collect_diags = true;
+
+    f64 open_time = 1e9;
+    for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+        f64 start = time_now();
+        LspDoc* doc = lsp_open("bench", src, 0);
+        f64 seconds = time_now() - start;
+        open_time = seconds < open_time ? seconds : open_time;
+        lsp_close(doc);
+    }
+
+    LspDoc* doc = lsp_open("bench", src, 0);
+    size_t at = lsp_offset(doc, (i64)num_lines / 2, 12, true);
+    size_t num_edits = 2000;
+    lsp_stats = (LspStats) { 0 };
+    f64 start = time_now();
+    for (size_t i = 0; i < num_edits; i++) {
+        if (i % 2 == 0) {
+            lsp_change(doc, at, at, "z", 1);
+        }
+        else {
+            lsp_change(doc, at, at + 1, "", 0);
+        }
+    }
+    f64 edit_time = (time_now() - start) / num_edits;
+    printf("%-12s\n", "lsp");
+    printf("  open %zu lines %8.3f ms, edit %8.3f ms (%.1f tokens relexed, %.1f of %zu segments reparsed per edit)\n",
+        num_lines, open_time * 1e3, edit_time * 1e3, (f64)lsp_stats.relexed_tokens / num_edits, (f64)lsp_stats.reparsed_segments / num_edits, BUF_LEN(doc->segments));
+    lsp_close(doc);
+    lex_collect_diags = collect;
+    BUF_FREE(src);
+}
+
+//*Source discovery of the benchmarked directory, the walk is repeated so the listing is cached
+Internal void bench_walk(const char* path) {
+    f64 best = 1e9;
+    size_t num_paths = 0;
+    for (size_t rep = 0; rep < BENCH_REPS; rep++) {
+        char** paths = NULL;
+        f64 start = time_now();
+        if (!walk_sources(path, &paths)) {
+            return;
+        }
+        f64 seconds = time_now() - start;
+        best = seconds < best ? seconds : best;
+        num_paths = BUF_LEN(paths);
+        for (size_t i = 0; i < num_paths; i++) {
+            free(paths[i]);
+        }
+        BUF_FREE(paths);
+    }
+    printf("%-12s\n", "walk");
+    printf("  %zu sources in %.3f ms\n", num_paths, best * 1e3);
+}
+
+Internal void bench(const char* path) {
+    BenchSource* sources = bench_load_sources(path);
+    if (!BUF_LEN(sources)) {
+        fatal("No .jack sources to benchmark in %s", path);
+    }
+
+    bench_walk(path);
+    bench_lex(sources);
+    bench_ints();
+    bench_maps();
+    bench_hints(sources);
+    bench_tree(sources);
+    bench_vm(sources);
+    bench_strength(sources);
+    bench_asm();
+    bench_interp();
+    bench_lsp();
+}
@@ -61,19 +61,41 @@ Internal char* strf(const char* fmt, ...) {
     return str;
 }
 
+//*wall clock time in seconds, only meaningful as a difference between two calls
+Internal f64 time_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+//*size in bytes of an open file, 64 bit even where long is 32 bit
+Internal i64 file_size(FILE* file) {
+#if _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    i64 len = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+#else
+    fseeko(file, 0, SEEK_END);
+    i64 len = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+#endif
+    return len;
+}
+
 Internal char* read_file(const char* path) {
     FILE* file = fopen(path, "rb");
     if (!file) {
         fatal("Could not find file: %s", path);
     }
 
-    fseek(file, 0, SEEK_END);
-    long len = ftell(file);
-
-    fseek(file, 0, SEEK_SET);
+    i64 len = file_size(file);
+    if (len < 0 || (u64)len >= SIZE_MAX) {
+        fclose(file);
+        fatal("File too large to load, use --stream: %s", path);
+    }
 
-    char* buf = xmalloc(len + 1);
-    if (len && fread(buf, len, 1, file) != 1) {
+    char* buf = xmalloc((size_t)len + 1);
+    if (len && fread(buf, (size_t)len, 1, file) != 1) {
         fclose(file);
         free(buf);
         fatal("Error reading file: %s", path);
@@ -119,21 +141,29 @@ Internal const char* get_extension(const char* path) {
     return ext;
 }
 
+//*`ext` as returned by get_extension(), only exactly `jack` matches
 Internal bool check_jack_extension(const char* ext) {
-    if (!ext || *ext == 0) {
-        return false;
-    }
+    return ext && strcmp(ext, "jack") == 0;
+}
 
-    const char* ext_chars = "jack";
-    while (*ext && *ext_chars) {
-        if (*ext != *ext_chars) {
-            return false;
-        }
-        ext++;
-        ext_chars++;
+//*Regrowth that size hints are meant to avoid, counted per thread. See BUF_RESERVE(), arena_reserve(),
+//*map_reserve() and the `_reserve` of HASH_MAP().
+typedef struct GrowStats {
+    size_t buf_reallocs;
+    size_t map_rehashes;
+    size_t arena_blocks;
+} GrowStats;
+
+ThreadLocal GrowStats grow_stats;
+//*callers estimating sizes up front check this, bench_hints() turns it off for the comparison
+bool size_hints = true;
+
+Internal size_t next_pow2(size_t x) {
+    size_t p = 1;
+    while (p < x) {
+        p *= 2;
     }
-
-    return true;
+    return p;
 }
 
 typedef struct BufHdr {
@@ -156,6 +186,8 @@ typedef struct BufHdr {
 #define BUF_PUSH(b, ...) (BUF_FIT((b), 1 + BUF_LEN(b)), (b)[_BUF_HDR(b)->len++] = (__VA_ARGS__))
 #define BUF_PRINTF(b, ...) ((b) = _buf_printf((b), __VA_ARGS__))
 #define BUF_CLEAR(b) ((b) ? _BUF_HDR(b)->len = 0 : 0)
+//*room for `n` more elements without regrowth
+#define BUF_RESERVE(b, n) BUF_FIT((b), BUF_LEN(b) + (n))
 
 Internal void* _buf_grow(const void* buf, size_t new_len, size_t elem_size) {
     assert(BUF_CAP(buf) <= (SIZE_MAX - 1) / 2);
@@ -166,6 +198,7 @@ Internal void* _buf_grow(const void* buf, size_t new_len, size_t elem_size) {
     BufHdr* new_hdr;
 
     if (buf) {
+        grow_stats.buf_reallocs++;
         new_hdr = xrealloc(_BUF_HDR(buf), new_size);
     }
     else {
@@ -220,6 +253,15 @@ Internal void buffer_tests(void) {
     assert(buf == NULL);
     assert(BUF_LEN(buf) == 0);
 
+    //*pushes into reserved room never reallocate
+    BUF_RESERVE(buf, n);
+    size_t reallocs = grow_stats.buf_reallocs;
+    for (int i = 0; i < n; i++) {
+        BUF_PUSH(buf, i);
+    }
+    assert(grow_stats.buf_reallocs == reallocs && BUF_CAP(buf) == (size_t)n);
+    BUF_FREE(buf);
+
     char* str = NULL;
     BUF_PRINTF(str, "One: %d\n", 1);
     assert(strcmp(str, "One: 1\n") == 0);
@@ -227,6 +269,98 @@ Internal void buffer_tests(void) {
     assert(strcmp(str, "One: 1\nHex: 0x12345678\n") == 0);
 }
 
+//*Buffered writer: output is gathered in a fixed size buffer that is handed to the sink whenever it
+//*fills up, the sink is either a file or a growable BUF when `file` is NULL
+#define WRITER_BUF_SIZE (64 * 1024)
+
+typedef struct Writer {
+    char* buf;
+    size_t len;
+    FILE* file;
+    char* mem;
+    bool error;
+} Writer;
+
+Internal Writer writer_new(FILE* file) {
+    return (Writer) { .buf = xmalloc(WRITER_BUF_SIZE), .file = file };
+}
+
+Internal void writer_sink(Writer* w, const char* data, size_t len) {
+    if (w->file) {
+        w->error |= fwrite(data, len, 1, w->file) != 1;
+    }
+    else {
+        BUF_FIT(w->mem, BUF_LEN(w->mem) + len);
+        memcpy(BUF_END(w->mem), data, len);
+        _BUF_HDR(w->mem)->len += len;
+    }
+}
+
+Internal void writer_flush(Writer* w) {
+    if (w->len) {
+        writer_sink(w, w->buf, w->len);
+        w->len = 0;
+    }
+}
+
+Internal void writer_write(Writer* w, const char* data, size_t len) {
+    if (len > WRITER_BUF_SIZE - w->len) {
+        writer_flush(w);
+        if (len > WRITER_BUF_SIZE) {
+            writer_sink(w, data, len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+Internal void writer_puts(Writer* w, const char* str) {
+    writer_write(w, str, strlen(str));
+}
+
+Internal void writer_u32(Writer* w, u32 val) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    writer_write(w, digits + sizeof(digits) - n, n);
+}
+
+//*flushes and releases the buffer, returns false if any write to the file failed
+Internal bool writer_close(Writer* w) {
+    writer_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+    return !w->error;
+}
+
+Internal void writer_tests(void) {
+    Writer w = writer_new(NULL);
+    for (u32 i = 0; i < 20000; i++) {
+        writer_puts(&w, "n=");
+        writer_u32(&w, i);
+        writer_write(&w, "\n", 1);
+    }
+    char* big = xcalloc(WRITER_BUF_SIZE + 10, 1);
+    memset(big, 'x', WRITER_BUF_SIZE + 9);
+    writer_puts(&w, big);
+    assert(writer_close(&w));
+
+    char* expected = NULL;
+    for (u32 i = 0; i < 20000; i++) {
+        BUF_PRINTF(expected, "n=%u\n", i);
+    }
+    BUF_PRINTF(expected, "%s", big);
+    assert(BUF_LEN(w.mem) == BUF_LEN(expected));
+    assert(memcmp(w.mem, expected, BUF_LEN(expected)) == 0);
+    BUF_FREE(expected);
+    BUF_FREE(w.mem);
+    free(big);
+}
+
 //Arena allocator
 typedef struct Arena {
     char* ptr;
@@ -241,6 +375,7 @@ Internal void arena_grow(Arena* arena, size_t min_size) {
     size_t size = ALIGN_UP(MAX(ARENA_BLOCK_SIZE, min_size), ARENA_ALIGNMENT);
     arena->ptr = xmalloc(size);
     assert(arena->ptr == ALIGN_DOWN_PTR(arena->ptr, ARENA_ALIGNMENT));
+    grow_stats.arena_blocks++;
 
     arena->end = arena->ptr + size;
     BUF_PUSH(arena->blocks, arena->ptr);
@@ -259,29 +394,41 @@ Internal void* arena_alloc(Arena* arena, size_t size) {
     return ptr;
 }
 
+//*Makes the next `size` bytes come out of the current block, starting a block of that size if
+//*needed, so a large known allocation volume takes one block instead of a chain of
+//*ARENA_BLOCK_SIZE ones. The rest of the current block is given up then.
+Internal void arena_reserve(Arena* arena, size_t size) {
+    if (size > (size_t)(arena->end - arena->ptr)) {
+        arena_grow(arena, size);
+    }
+}
+
 Internal void arena_free(Arena* arena) {
     for (char** it = arena->blocks; it != BUF_END(arena->blocks); it++) {
         free(*it);
     }
     BUF_FREE(arena->blocks);
+    arena->ptr = NULL;
+    arena->end = NULL;
 }
 
 //*Hash map
 
-//*usage example
-// Map test_map = { 0 };
-// i32 a = 56;
-// i32 b = 89;
-// u64 ha = hash_u64(a);
-// u64 hb = hash_u64(b);
-// void* ka = (void*)(uintptr_t)(ha ? ha : 1);
-// void* kb = (void*)(uintptr_t)(hb ? hb : 1);
-
-// map_put(&test_map, ka, &a);
-// map_put(&test_map, kb, &b);
-
-// i32* ia = map_get(&test_map, ka);
-// i32* ib = map_get(&test_map, kb);
+//*Map is the untyped pointer to pointer map the compiler started out with, keys and values live in
+//*two arrays and NULL keys and values are not allowed. The compiler uses the typed HASH_MAP() maps
+//*below now, Map stays as the baseline of bench_maps().
+
+//*count of trailing zero bits, x must be non zero
+Internal u32 ctz64(u64 x) {
+    assert(x);
+#if _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (u32)index;
+#else
+    return (u32)__builtin_ctzll(x);
+#endif
+}
 
 u64 hash_u64(u64 x) {
     x *= 0xff51afd7ed558ccd;
@@ -337,6 +484,7 @@ Internal void map_put(Map* map, void* key, void* val);
 
 Internal void map_grow(Map* map, size_t new_cap) {
     new_cap = MAX(16, new_cap);
+    grow_stats.map_rehashes += map->cap != 0;
     Map new_map = {
         .keys = xcalloc(new_cap, sizeof(void*)),
         .vals = xmalloc(new_cap * sizeof(void*)),
@@ -382,6 +530,13 @@ Internal void map_put(Map* map, void* key, void* val) {
     }
 }
 
+//*room for `n` entries in total without rehashing
+Internal void map_reserve(Map* map, size_t n) {
+    if (2 * n >= map->cap) {
+        map_grow(map, next_pow2(2 * n + 1));
+    }
+}
+
 Internal void map_tests(void) {
     Map map = { 0 };
     int n = 1024;
@@ -392,6 +547,235 @@ Internal void map_tests(void) {
         void* val = map_get(&map, (void*)i);
         assert(val == (void*)(i + 1));
     }
+
+    //*a reserved map takes its entries without rehashing
+    Map reserved = { 0 };
+    map_reserve(&reserved, n);
+    size_t rehashes = grow_stats.map_rehashes;
+    for (size_t i = 1; i <= (size_t)n; i++) {
+        map_put(&reserved, (void*)i, (void*)i);
+    }
+    assert(grow_stats.map_rehashes == rehashes);
+    free(map.keys);
+    free(map.vals);
+    free(reserved.keys);
+    free(reserved.vals);
+}
+
+//*Typed hash maps. HASH_MAP() generates a map type and its functions for a key and value type, with
+//*the key/value pairs stored inline in one array of slots so a hit touches one cache line and values
+//*need no boxing. Keys compare with ==, linear probing, at most half full, deletion shifts the rest
+//*of the probe run back instead of leaving tombstones.
+//*
+//*    HASH_MAP(NameIndex, name_index, const char*, u32, hash_name)
+//*    NameIndex index = { 0 };
+//*    name_index_put(&index, name, 3);
+//*    u32* found = name_index_get(&index, name);
+//*    for (NameIndexSlot* it = name_index_next(&index, NULL); it; it = name_index_next(&index, it)) { ... }
+//*
+//*With HASH_MAP() a zero key marks an empty slot, like Map. HASH_MAP_HASHED() stores the hash in each
+//*slot instead, which allows any key and skips rehashing keys when the map grows and on collisions,
+//*worth it when the hash function is not trivial.
+#define HASH_MAP(Name, prefix, Key, Val, hash_fn) \
+    typedef struct Name##Slot { \
+        Key key; \
+        Val val; \
+    } Name##Slot; \
+    HASH_MAP_IMPL(Name, prefix, Key, Val, hash_fn, HASH_MAP_KEY_EMPTY, HASH_MAP_KEY_HASH, HASH_MAP_KEY_SET_HASH)
+
+#define HASH_MAP_HASHED(Name, prefix, Key, Val, hash_fn) \
+    typedef struct Name##Slot { \
+        Key key; \
+        Val val; \
+        u64 hash; \
+    } Name##Slot; \
+    HASH_MAP_IMPL(Name, prefix, Key, Val, hash_fn, HASH_MAP_STORED_EMPTY, HASH_MAP_STORED_HASH, HASH_MAP_STORED_SET_HASH)
+
+#define HASH_MAP_KEY_EMPTY(slot) (!(slot)->key)
+#define HASH_MAP_KEY_HASH(slot, hash_fn) hash_fn((slot)->key)
+#define HASH_MAP_KEY_SET_HASH(slot, h) ((void)(h))
+//*a stored hash of 0 marks an empty slot, real hashes get their top bit set
+#define HASH_MAP_STORED_EMPTY(slot) (!(slot)->hash)
+#define HASH_MAP_STORED_HASH(slot, hash_fn) ((slot)->hash)
+#define HASH_MAP_STORED_SET_HASH(slot, h) ((slot)->hash = (h))
+
+#define HASH_MAP_IMPL(Name, prefix, Key, Val, hash_fn, EMPTY, SLOT_HASH, SET_HASH) \
+    typedef struct Name { \
+        Name##Slot* slots; \
+        size_t len; \
+        size_t cap; \
+    } Name; \
+    \
+    Internal u64 prefix##_hash(Key key) { \
+        return (u64)hash_fn(key) | 0x8000000000000000ull; \
+    } \
+    \
+    Internal Name##Slot* prefix##_find(Name* map, Key key, u64 hash) { \
+        for (size_t i = (size_t)hash;; i++) { \
+            Name##Slot* slot = &map->slots[i & (map->cap - 1)]; \
+            if (EMPTY(slot) || slot->key == key) { \
+                return slot; \
+            } \
+        } \
+    } \
+    \
+    Internal Val* prefix##_get(Name* map, Key key) { \
+        if (!map->len) { \
+            return NULL; \
+        } \
+        Name##Slot* slot = prefix##_find(map, key, prefix##_hash(key)); \
+        return EMPTY(slot) ? NULL : &slot->val; \
+    } \
+    \
+    Internal void prefix##_rehash(Name* map, size_t new_cap) { \
+        Name##Slot* old = map->slots; \
+        size_t old_cap = map->cap; \
+        grow_stats.map_rehashes += old_cap != 0; \
+        map->slots = xcalloc(new_cap, sizeof(Name##Slot)); \
+        map->cap = new_cap; \
+        for (Name##Slot* it = old; it != old + old_cap; it++) { \
+            if (!EMPTY(it)) { \
+                *prefix##_find(map, it->key, SLOT_HASH(it, prefix##_hash)) = *it; \
+            } \
+        } \
+        free(old); \
+    } \
+    \
+    /*room for `n` entries in total without rehashing*/ \
+    Internal void prefix##_reserve(Name* map, size_t n) { \
+        size_t cap = MAX(16, next_pow2(2 * n)); \
+        if (cap > map->cap) { \
+            prefix##_rehash(map, cap); \
+        } \
+    } \
+    \
+    /*inserts or overwrites, returns the value's slot*/ \
+    Internal Val* prefix##_put(Name* map, Key key, Val val) { \
+        if (2 * (map->len + 1) > map->cap) { \
+            prefix##_rehash(map, MAX(16, 2 * map->cap)); \
+        } \
+        u64 hash = prefix##_hash(key); \
+        Name##Slot* slot = prefix##_find(map, key, hash); \
+        if (EMPTY(slot)) { \
+            slot->key = key; \
+            SET_HASH(slot, hash); \
+            map->len++; \
+        } \
+        slot->val = val; \
+        return &slot->val; \
+    } \
+    \
+    /*returns false when the key was not there*/ \
+    Internal bool prefix##_del(Name* map, Key key) { \
+        if (!map->len) { \
+            return false; \
+        } \
+        Name##Slot* hole = prefix##_find(map, key, prefix##_hash(key)); \
+        if (EMPTY(hole)) { \
+            return false; \
+        } \
+        size_t mask = map->cap - 1; \
+        size_t i = (size_t)(hole - map->slots); \
+        for (size_t j = (i + 1) & mask;; j = (j + 1) & mask) { \
+            Name##Slot* slot = &map->slots[j]; \
+            if (EMPTY(slot)) { \
+                break; \
+            } \
+            /*a slot moves into the hole unless its home lies in (hole, slot]*/ \
+            size_t home = (size_t)SLOT_HASH(slot, prefix##_hash) & mask; \
+            if (((j - home) & mask) >= ((j - i) & mask)) { \
+                map->slots[i] = *slot; \
+                i = j; \
+            } \
+        } \
+        memset(&map->slots[i], 0, sizeof(Name##Slot)); \
+        map->len--; \
+        return true; \
+    } \
+    \
+    /*the occupied slot after `it`, or the first one when it is NULL, order is arbitrary*/ \
+    Internal Name##Slot* prefix##_next(Name* map, Name##Slot* it) { \
+        Name##Slot* end = map->slots + map->cap; \
+        for (it = it ? it + 1 : map->slots; it && it < end; it++) { \
+            if (!EMPTY(it)) { \
+                return it; \
+            } \
+        } \
+        return NULL; \
+    } \
+    \
+    Internal void prefix##_clear(Name* map) { \
+        if (map->len) { \
+            memset(map->slots, 0, map->cap * sizeof(Name##Slot)); \
+            map->len = 0; \
+        } \
+    } \
+    \
+    Internal void prefix##_free(Name* map) { \
+        free(map->slots); \
+        memset(map, 0, sizeof(*map)); \
+    }
+
+Internal u64 hash_name(const char* name) {
+    return hash_ptr((void*)name);
+}
+
+//*interned names to an index, the most common map in the compiler
+HASH_MAP(NameIndex, name_index, const char*, u32, hash_name)
+//*u64 keys to u64 values with stored hashes, for the tests and the benchmark
+HASH_MAP_HASHED(U64Map, u64_map, u64, u64, hash_u64)
+
+Internal void hash_map_tests(void) {
+    //*the map_tests() of Map
+    NameIndex map = { 0 };
+    size_t n = 1024;
+    for (size_t i = 1; i < n; i++) {
+        name_index_put(&map, (const char*)i, (u32)(i + 1));
+    }
+    for (size_t i = 1; i < n; i++) {
+        u32* val = name_index_get(&map, (const char*)i);
+        assert(val && *val == i + 1);
+    }
+    assert(!name_index_get(&map, (const char*)n));
+
+    //*delete every third key, the others stay reachable past the holes
+    for (size_t i = 1; i < n; i += 3) {
+        assert(name_index_del(&map, (const char*)i));
+        assert(!name_index_del(&map, (const char*)i));
+    }
+    size_t count = 0;
+    for (NameIndexSlot* it = name_index_next(&map, NULL); it; it = name_index_next(&map, it)) {
+        assert((size_t)it->key % 3 != 1 && it->val == (size_t)it->key + 1);
+        count++;
+    }
+    assert(count == map.len && count == n - 1 - (n + 1) / 3);
+    for (size_t i = 1; i < n; i++) {
+        assert(!name_index_get(&map, (const char*)i) == (i % 3 == 1));
+    }
+    name_index_free(&map);
+
+    //*stored hashes allow a zero key, colliding keys delete in any order
+    U64Map hashed = { 0 };
+    for (u64 i = 0; i < 100; i++) {
+        u64_map_put(&hashed, i * 16, i);
+    }
+    *u64_map_get(&hashed, 0) = 7;
+    assert(*u64_map_get(&hashed, 0) == 7 && hashed.len == 100);
+    for (u64 i = 99; i < 100; i--) {
+        assert(u64_map_del(&hashed, i * 16));
+        for (u64 j = 0; j < i; j++) {
+            assert(u64_map_get(&hashed, j * 16));
+        }
+    }
+    assert(hashed.len == 0 && !u64_map_next(&hashed, NULL));
+
+    u64_map_reserve(&hashed, 1000);
+    size_t rehashes = grow_stats.map_rehashes;
+    for (u64 i = 0; i < 1000; i++) {
+        u64_map_put(&hashed, i, i);
+    }
+    assert(grow_stats.map_rehashes == rehashes);
+    u64_map_free(&hashed);
 }
 
 //*String interning
@@ -404,17 +788,19 @@ typedef struct Intern {
 
 //*The memory for all the strings
 Arena intern_arena;
-Map interns;
+//*hash of the string to the chain of strings with that hash
+HASH_MAP_HASHED(InternMap, intern_map, u64, Intern*, hash_u64)
+InternMap interns;
 
 //*checks if the new string is part of the existing list of strings in the intern table
 //*if it already exists, return a pointer to the underlying char buffer
 //*if it does not exist, allocate memory for it and add it to the intern table.
-Internal const char* str_intern_range(const char* start, const char* end) {
+//*same as str_intern_range() with the hash of the range already computed, lets threads that are not
+//*allowed to touch the intern table do the hashing
+Internal const char* str_intern_hashed(const char* start, const char* end, u64 hash) {
     size_t len = end - start;
-    u64 hash = hash_bytes(start, len);
-    //*the key is a pointer from the hash of string
-    void* key = (void*)(uintptr_t)(hash ? hash : 1);
-    Intern* intern = map_get(&interns, key);
+    Intern** found = intern_map_get(&interns, hash);
+    Intern* intern = found ? *found : NULL;
 
     //*find correct str in case key collision, if loop completes, means the string
     //*being interned is new
@@ -431,11 +817,15 @@ Internal const char* str_intern_range(const char* start, const char* end) {
 
     memcpy(new_intern->str, start, len);
     new_intern->str[len] = 0;
-    map_put(&interns, key, new_intern);
+    intern_map_put(&interns, hash, new_intern);
 
     return new_intern->str;
 }
 
+Internal const char* str_intern_range(const char* start, const char* end) {
+    return str_intern_hashed(start, end, hash_bytes(start, end - start));
+}
+
 //*assumes null terminated strings because of strlen, wrapper for str_intern_range
 Internal const char* str_intern(const char* str) {
     return str_intern_range(str, str + strlen(str));
@@ -465,6 +855,8 @@ Internal void intern_tests(void) {
 
 Internal void common_tests(void) {
     buffer_tests();
+    writer_tests();
     intern_tests();
     map_tests();
+    hash_map_tests();
 }
\ No newline at end of file
@@ -0,0 +1,739 @@
+//*Compilation driver: turns the command line path into a list of jobs and runs them either one after
+//*another or through the staged pipeline.
+
+//*Output formats, a job can fan out into any combination of them from one lex and parse
+typedef enum EmitKind {
+    EMIT_TOKENS,
+    EMIT_TOKENS_BIN,
+    EMIT_TREE,
+    EMIT_VM,
+    EMIT_ASM,
+    NUM_EMITS,
+} EmitKind;
+
+#define EMIT_BIT(kind) (1u << (kind))
+
+typedef struct CompileOptions {
+    u32 emits;
+    size_t pipeline_depth;
+    size_t stream_window;
+    size_t lex_threads;
+    bool optimize;
+    bool whole_program;
+    size_t inline_budget;
+    //*run the program in the VM interpreter after compiling it, see run_program()
+    bool run;
+    u64 run_limit;
+    const char* run_input;
+    //*batched reads and background writes, see uring.c
+    bool io_uring;
+    //*Chrome trace of the phases, see trace.c
+    const char* trace_path;
+    //*hardware counters per phase, see perf.c
+    bool perf_counters;
+} CompileOptions;
+
+CompileOptions options;
+//*set up by init_io() when --io-uring is given and the kernel allows it
+IoRing io_ring;
+bool io_ring_active;
+
+typedef struct CompileJob {
+    const char* path;
+    const char* src;
+    Token* tokens;
+    ClassDecl* ast;
+    VmInst* vm;
+    char* out_buf;
+} CompileJob;
+
+typedef void (*EmitFunc)(Writer* w, CompileJob* job);
+
+Internal void emit_tokens_xml(Writer* w, CompileJob* job) {
+    xml_tokens(&job->out_buf, job->tokens, BUF_LEN(job->tokens));
+    writer_write(w, job->out_buf, BUF_LEN(job->out_buf));
+    BUF_FREE(job->out_buf);
+}
+
+Internal void emit_tokens_bin(Writer* w, CompileJob* job) {
+    tokbin_write(w, job->tokens, BUF_LEN(job->tokens));
+}
+
+Internal void emit_tree_xml(Writer* w, CompileJob* job) {
+    tree_class(w, job->ast);
+}
+
+Internal void emit_vm(Writer* w, CompileJob* job) {
+    vm_write(w, job->vm, BUF_LEN(job->vm));
+}
+
+//*An emitter only reads what the front end of the job produced, so emitters can run on another thread
+typedef struct Emitter {
+    const char* name;
+    const char* suffix;
+    bool needs_tokens;
+    bool needs_ast;
+    EmitFunc emit;
+} Emitter;
+
+Emitter emitters[NUM_EMITS] = {
+    [EMIT_TOKENS] = { "tokens", "TT.xml", true, false, emit_tokens_xml },
+    [EMIT_TOKENS_BIN] = { "tokens-bin", ".tok", true, false, emit_tokens_bin },
+    [EMIT_TREE] = { "tree", ".xml", false, true, emit_tree_xml },
+    [EMIT_VM] = { "vm", ".vm", false, true, emit_vm },
+    //*one file for the whole program, written by compile_whole_program()
+    [EMIT_ASM] = { "asm", ".asm", false, true, NULL },
+};
+
+//*`tokens,tree,vm` to a mask of EMIT_BIT()s
+Internal u32 parse_emit_list(const char* list) {
+    u32 emits = 0;
+    while (*list) {
+        const char* end = strchr(list, ',');
+        if (!end) {
+            end = list + strlen(list);
+        }
+        size_t len = end - list;
+        EmitKind kind = 0;
+        while (kind < NUM_EMITS && !(strlen(emitters[kind].name) == len && strncmp(emitters[kind].name, list, len) == 0)) {
+            kind++;
+        }
+        if (kind == NUM_EMITS) {
+            fatal("Unknown --emit format: %.*s", (int)len, list);
+        }
+        emits |= EMIT_BIT(kind);
+        list = *end ? end + 1 : end;
+    }
+    if (!emits) {
+        fatal("--emit needs at least one format");
+    }
+    return emits;
+}
+
+Internal bool emits_need_tokens(void) {
+    for (EmitKind kind = 0; kind < NUM_EMITS; kind++) {
+        if ((options.emits & EMIT_BIT(kind)) && emitters[kind].needs_tokens) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Internal bool emits_need_ast(void) {
+    for (EmitKind kind = 0; kind < NUM_EMITS; kind++) {
+        if ((options.emits & EMIT_BIT(kind)) && emitters[kind].needs_ast) {
+            return true;
+        }
+    }
+    return options.run;
+}
+
+Internal bool needs_vm(void) {
+    return (options.emits & (EMIT_BIT(EMIT_VM) | EMIT_BIT(EMIT_ASM))) || options.run;
+}
+
+Internal int is_dir_error(void) {
+    switch (errno) {
+        case EACCES:
+        case EBADF:
+        case EMFILE:
+        case ENFILE:
+        case ENOENT:
+        case ENOMEM:
+        case ENOTDIR: {
+            return errno;
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+//*`<path without extension><suffix>`, ext points just past the '.' of the extension in path
+Internal char* make_out_path(const char* path, const char* ext, const char* suffix) {
+    size_t stem_len = ext - path - 1;
+    char* out_path = xcalloc(stem_len + strlen(suffix) + 1, sizeof(char));
+    strncpy(out_path, path, stem_len);
+    strcat(out_path, suffix);
+    return out_path;
+}
+
+Internal void add_job(CompileJob** jobs, const char* path) {
+    BUF_PUSH(*jobs, (CompileJob) { .path = path });
+}
+
+//*Every `.jack` file below a directory, in path order, or the single file given
+Internal CompileJob* collect_jobs(const char* path) {
+    CompileJob* jobs = NULL;
+    char** paths = NULL;
+
+    if (walk_sources(path, &paths)) {
+        BUF_RESERVE(jobs, BUF_LEN(paths));
+        for (size_t i = 0; i < BUF_LEN(paths); i++) {
+            add_job(&jobs, paths[i]);
+        }
+        BUF_FREE(paths);
+
+        if (!jobs) {
+            printf("No .jack file found in directory\n");
+        }
+    }
+    else {
+        if (is_dir_error() != ENOTDIR) {
+            perror("Error");
+            exit(1);
+        }
+
+        if (!check_jack_extension(get_extension(path))) {
+            fatal("File is not a .jack file");
+        }
+
+        add_job(&jobs, strf("%s", path));
+    }
+
+    return jobs;
+}
+
+Internal void free_job(CompileJob* job) {
+    free((void*)job->path);
+    free((void*)job->src);
+    free_tokens(job->tokens);
+    BUF_FREE(job->vm);
+    BUF_FREE(job->out_buf);
+    job->path = NULL;
+    job->src = NULL;
+    job->tokens = NULL;
+    job->ast = NULL;
+}
+
+//*Files below this size are not worth splitting across threads
+#define PARALLEL_LEX_MIN_SIZE (1024 * 1024)
+
+Internal void read_job(CompileJob* job) {
+    if (!job->src) {
+        f64 start = trace_begin();
+        job->src = read_file(job->path);
+        trace_end("read", job->path, start);
+    }
+}
+
+Internal void lex_job(CompileJob* job) {
+    f64 start = trace_begin();
+    size_t len = strlen(job->src);
+    if (options.lex_threads > 1 && len >= PARALLEL_LEX_MIN_SIZE) {
+        job->tokens = lex_tokens_parallel(job->path, job->src, len, options.lex_threads);
+    }
+    else if (options.perf_counters) {
+        //*names are interned in a pass of their own, so the intern table gets its own counts
+        perf.source_bytes += len;
+        PerfSample sample = perf_begin();
+        lex_defer_intern = true;
+        job->tokens = lex_tokens(job->path, job->src);
+        lex_defer_intern = false;
+        perf_end(PERF_LEX, sample);
+        sample = perf_begin();
+        for (Token* it = job->tokens; it != BUF_END(job->tokens); it++) {
+            if (it->kind == TOKEN_NAME) {
+                intern_token(it);
+            }
+        }
+        perf_end(PERF_INTERN, sample);
+    }
+    else {
+        job->tokens = lex_tokens(job->path, job->src);
+    }
+    trace_end("lex", job->path, start);
+}
+
+Internal ClassDecl* parse_file(void) {
+    ClassDecl* ast = parse_class();
+    if (!is_token_eof()) {
+        fatal_syntax_error("expected end of file, got %s", token_info());
+    }
+    return ast;
+}
+
+//*Folding rewrites the tree, so when the tree is written as well the folded copy is a clone
+Internal void gen_job(CompileJob* job) {
+    f64 start = trace_begin();
+    PerfSample sample = perf_begin();
+    ClassDecl* c = job->ast;
+    if (options.optimize) {
+        if (options.emits & EMIT_BIT(EMIT_TREE)) {
+            c = class_clone(c);
+        }
+        fold_class(c);
+    }
+    job->vm = gen_class(c);
+    if (options.optimize) {
+        vm_optimize(&job->vm);
+    }
+    //*whole program mode inlines across classes once all of them are generated
+    if (options.inline_budget && !options.whole_program) {
+        VmInst** programs[] = { &job->vm };
+        vm_inline_program(programs, 1, 1, options.inline_budget);
+    }
+    perf_end(PERF_GEN, sample);
+    trace_end("gen", job->path, start);
+}
+
+//*Size hints from the length of a source file, measured with bench_hints(). Distinct names grow
+//*with the square root of the source size rather than linearly: a class repeats the names of its
+//*fields, locals and the OS, the test programs have one per 80 to 130 bytes and the 32 MiB bench
+//*corpus one per 800. The tree takes 3 to 8 bytes per source byte.
+#define HINT_NAMES_PER_SQRT_BYTE 8
+#define HINT_AST_BYTES_PER_BYTE 9
+
+Internal size_t isqrt(size_t x) {
+    size_t r = x;
+    size_t next = (r + 1) / 2;
+    while (next < r) {
+        r = next;
+        next = (r + x / r) / 2;
+    }
+    return r;
+}
+
+Internal void reserve_for_source(size_t len) {
+    if (!size_hints) {
+        return;
+    }
+    intern_map_reserve(&interns, interns.len + HINT_NAMES_PER_SQRT_BYTE * isqrt(len));
+    if (emits_need_ast()) {
+        arena_reserve(&ast_arena, len * HINT_AST_BYTES_PER_BYTE);
+    }
+}
+
+//*Front end of a job, run on the thread owning the lexer and intern state. The file is lexed and
+//*parsed once whatever the number of outputs: the parser replays the lexed tokens when a token
+//*output is wanted as well and otherwise pulls tokens straight from the source. Counting the phases
+//*with --perf-counters always replays, so lexing and parsing are measured apart.
+Internal void front_job(CompileJob* job) {
+    reserve_for_source(strlen(job->src));
+    bool need_tokens = emits_need_tokens() || options.perf_counters;
+    if (need_tokens) {
+        lex_job(job);
+    }
+    if (emits_need_ast()) {
+        f64 start = trace_begin();
+        PerfSample sample = perf_begin();
+        init_keywords();
+        if (need_tokens) {
+            init_replay(job->path, job->tokens, BUF_LEN(job->tokens));
+        }
+        else {
+            init_stream(job->path, job->src);
+        }
+        job->ast = parse_file();
+        close_replay();
+        perf_end(PERF_PARSE, sample);
+        trace_end("parse", job->path, start);
+    }
+    if (needs_vm()) {
+        gen_job(job);
+    }
+}
+
+Internal void emit_file(CompileJob* job, const Emitter* emitter) {
+    char* out_path = make_out_path(job->path, get_extension(job->path), emitter->suffix);
+    if (io_ring_active) {
+        f64 start = trace_begin();
+        Writer w = writer_new(NULL);
+        emitter->emit(&w, job);
+        writer_close(&w);
+        trace_end("emit", out_path, start);
+        start = trace_begin();
+        io_ring_write_file(&io_ring, out_path, w.mem);
+        trace_end("write", out_path, start);
+        printf("filename: %s\n", out_path);
+        free(out_path);
+        return;
+    }
+    //*the writer flushes as it fills, so the emit span covers those writes and the write span the rest
+    f64 start = trace_begin();
+    FILE* out = fopen(out_path, "wb");
+    if (!out) {
+        fatal("Could not write file: %s", out_path);
+    }
+    Writer w = writer_new(out);
+    emitter->emit(&w, job);
+    trace_end("emit", out_path, start);
+    start = trace_begin();
+    bool ok = writer_close(&w);
+    ok &= fclose(out) == 0;
+    if (!ok) {
+        fatal("Could not write file: %s", out_path);
+    }
+    trace_end("write", out_path, start);
+    printf("filename: %s\n", out_path);
+    free(out_path);
+}
+
+//*runs every selected emitter, each into its own file
+Internal void emit_job(CompileJob* job) {
+    PerfSample sample = perf_begin();
+    for (EmitKind kind = 0; kind < NUM_EMITS; kind++) {
+        if ((options.emits & EMIT_BIT(kind)) && emitters[kind].emit) {
+            emit_file(job, &emitters[kind]);
+        }
+    }
+    perf_end(PERF_EMIT, sample);
+}
+
+//*With io_uring the sources of all jobs are read up front in batches, otherwise each job reads its
+//*source when it starts
+Internal void read_sources(CompileJob* jobs, size_t num_jobs) {
+    if (!io_ring_active) {
+        return;
+    }
+    f64 start = trace_begin();
+    const char** paths = NULL;
+    char** bufs = NULL;
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        BUF_PUSH(paths, job->path);
+        BUF_PUSH(bufs, NULL);
+    }
+    io_ring_read_files(&io_ring, paths, bufs, num_jobs);
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].src = bufs[i];
+    }
+    BUF_FREE(paths);
+    BUF_FREE(bufs);
+    trace_end("read all", NULL, start);
+}
+
+Internal void init_io(void) {
+    if (options.io_uring) {
+        io_ring_active = io_ring_init(&io_ring);
+        if (!io_ring_active) {
+            printf("io_uring unavailable, using stdio\n");
+        }
+    }
+}
+
+//*waits for the outputs still being written
+Internal void finish_io(void) {
+    if (io_ring_active) {
+        f64 start = trace_begin();
+        io_ring_drain(&io_ring);
+        trace_end("write all", NULL, start);
+        io_ring_free(&io_ring);
+        io_ring_active = false;
+    }
+}
+
+Internal void compile_sequential(CompileJob* jobs, size_t num_jobs) {
+    read_sources(jobs, num_jobs);
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        read_job(job);
+        front_job(job);
+        emit_job(job);
+        free_job(job);
+    }
+}
+
+//*Library code for the `.asm` output: the `.vm` files of the directory that are not compiled from a
+//*`.jack` file next to them, typically the OS
+typedef struct VmLibrary {
+    const char* path;
+    const char* name;
+    VmInst* code;
+} VmLibrary;
+
+Internal int cmp_vm_libraries(const void* a, const void* b) {
+    return strcmp(((const VmLibrary*)a)->path, ((const VmLibrary*)b)->path);
+}
+
+//*Sorted by path like the sources, the order of the listing would otherwise decide the layout and
+//*the label addresses of the `.asm` output
+Internal VmLibrary* collect_vm_libraries(const char* path, CompileJob* jobs, size_t num_jobs) {
+    VmLibrary* libs = NULL;
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return NULL;
+    }
+    size_t pathlen = strlen(path);
+    const char* separator = path[pathlen - 1] == '/' ? "" : "/";
+    for (struct dirent* de = readdir(dir); de; de = readdir(dir)) {
+        const char* ext = get_extension(de->d_name);
+        if (!ext || strcmp(ext, "vm") != 0) {
+            continue;
+        }
+        char* lib_path = strf("%s%s%s", path, separator, de->d_name);
+        char* jack_path = make_out_path(lib_path, get_extension(lib_path), ".jack");
+        bool compiled = false;
+        for (size_t i = 0; i < num_jobs; i++) {
+            compiled |= strcmp(jobs[i].path, jack_path) == 0;
+        }
+        free(jack_path);
+        if (compiled) {
+            free(lib_path);
+            continue;
+        }
+        char* src = read_file(lib_path);
+        VmLibrary lib = { lib_path, str_intern_range(de->d_name, get_extension(de->d_name) - 1), NULL };
+        if (!vm_read(lib_path, src, &lib.code)) {
+            exit(1);
+        }
+        free(src);
+        BUF_PUSH(libs, lib);
+    }
+    closedir(dir);
+    if (libs) {
+        qsort(libs, BUF_LEN(libs), sizeof(VmLibrary), cmp_vm_libraries);
+    }
+    return libs;
+}
+
+//*`<dir>/<dir name>.asm` for a directory like the VM translator, `<stem>.asm` for a single file
+Internal char* make_asm_path(const char* path) {
+    const char* ext = get_extension(path);
+    if (check_jack_extension(ext)) {
+        return make_out_path(path, ext, ".asm");
+    }
+    //*the directory name of `.` is only known from the full path
+#if _WIN32
+    char* full = _fullpath(NULL, path, 0);
+#else
+    char* full = realpath(path, NULL);
+#endif
+    if (!full) {
+        fatal("Could not resolve path: %s", path);
+    }
+    size_t len = strlen(full);
+    while (len > 1 && (full[len - 1] == '/' || full[len - 1] == '\\')) {
+        len--;
+    }
+    size_t start = len;
+    while (start && full[start - 1] != '/' && full[start - 1] != '\\') {
+        start--;
+    }
+    char* out_path = strf("%s%s%.*s.asm", path, path[strlen(path) - 1] == '/' ? "" : "/", (int)(len - start), full + start);
+    free(full);
+    return out_path;
+}
+
+Internal void write_asm(const char* path, VmInst** programs[], const char** files, size_t num_programs, const char* entry) {
+    char* out_path = make_asm_path(path);
+    size_t num_insts;
+    size_t standard_insts;
+    char* text = asm_program((AsmOptions) { true, true }, programs, files, num_programs, entry, &num_insts);
+    char* standard = asm_program((AsmOptions) { false, false }, programs, files, num_programs, entry, &standard_insts);
+    BUF_FREE(standard);
+    if (!write_file(out_path, text, BUF_LEN(text))) {
+        fatal("Could not write file: %s", out_path);
+    }
+    printf("filename: %s\n", out_path);
+    size_t vm_insts = 0;
+    for (size_t i = 0; i < num_programs; i++) {
+        vm_insts += BUF_LEN(*programs[i]);
+    }
+    printf("asm: %zu vm instructions -> %zu hack instructions, %zu with the standard lowering (%.1f%% fewer)\n",
+        vm_insts, num_insts, standard_insts, 100.0 * (standard_insts - num_insts) / MAX(1, standard_insts));
+    BUF_FREE(text);
+    free(out_path);
+}
+
+//*Runs the program in the interpreter, its output goes to stdout followed by the counts
+Internal void run_program(VmInst** programs[], const char** files, size_t num_programs, const char* entry) {
+    Interp in = { .limit = options.run_limit };
+    char* input = options.run_input ? read_file(options.run_input) : NULL;
+    in.input = input;
+    if (!interp_load(&in, programs, files, num_programs, entry)) {
+        fatal("Could not load the program into the interpreter");
+    }
+    f64 start = time_now();
+    interp_run(&in);
+    f64 seconds = time_now() - start;
+    printf("run: output\n");
+    fwrite(in.output, 1, BUF_LEN(in.output), stdout);
+    if (BUF_LEN(in.output) && in.output[BUF_LEN(in.output) - 1] != '\n') {
+        printf("\n");
+    }
+    interp_report(&in, seconds);
+    interp_free_all(&in);
+    free(input);
+}
+
+//*Whole program mode: every class is compiled before anything is written so the subroutines nothing
+//*reaches from the entry point can be dropped, see vm_prune_program(). The OS calls Main.main from
+//*Sys.init, so Sys.init is the entry point when the program comes with one.
+Internal void compile_whole_program(const char* path, CompileJob* jobs, size_t num_jobs) {
+    read_sources(jobs, num_jobs);
+    VmInst*** programs = NULL;
+    const char** files = NULL;
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        read_job(job);
+        front_job(job);
+        BUF_PUSH(programs, &job->vm);
+        BUF_PUSH(files, job->ast->name);
+    }
+    bool emit_asm = options.emits & EMIT_BIT(EMIT_ASM);
+    VmLibrary* libs = emit_asm || options.run ? collect_vm_libraries(path, jobs, num_jobs) : NULL;
+    for (VmLibrary* lib = libs; lib != BUF_END(libs); lib++) {
+        BUF_PUSH(programs, &lib->code);
+        BUF_PUSH(files, lib->name);
+    }
+    size_t num_programs = BUF_LEN(programs);
+
+    f64 start = trace_begin();
+    //*the libraries behind the compiled classes are only inlined from, their code is kept as read
+    if (options.inline_budget) {
+        vm_inline_program(programs, num_programs, num_jobs, options.inline_budget);
+        trace_end("inline", NULL, start);
+    }
+    start = trace_begin();
+    prune_stats = (PruneStats) { 0 };
+    const char* entry = str_intern("Sys.init");
+    if (!vm_prune_program(programs, num_programs, entry)) {
+        entry = str_intern("Main.main");
+        if (!vm_prune_program(programs, num_programs, entry)) {
+            entry = NULL;
+        }
+    }
+    trace_end("prune", NULL, start);
+    if (entry) {
+        printf("whole program: removed %zu of %zu subroutines, %zu of %zu vm instructions\n",
+            prune_stats.removed_subs, prune_stats.subs, prune_stats.removed_insts, prune_stats.insts);
+    }
+    else {
+        printf("whole program: no Sys.init or Main.main, keeping every subroutine\n");
+    }
+
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        emit_job(job);
+    }
+    if (emit_asm) {
+        if (!entry) {
+            fatal("--emit=asm needs a Sys.init or Main.main to start from");
+        }
+        start = trace_begin();
+        write_asm(path, programs, files, num_programs, entry);
+        trace_end("asm", NULL, start);
+    }
+    if (options.run) {
+        if (!entry) {
+            fatal("--run needs a Sys.init or Main.main to start from");
+        }
+        run_program(programs, files, num_programs, entry);
+    }
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        free_job(job);
+    }
+    for (VmLibrary* lib = libs; lib != BUF_END(libs); lib++) {
+        free((void*)lib->path);
+        BUF_FREE(lib->code);
+    }
+    BUF_FREE(libs);
+    BUF_FREE(programs);
+    BUF_FREE(files);
+}
+
+//*Constant memory mode for inputs that do not fit in memory, see lex_file(). Token output is
+//*streamed straight from the lexer window, keeping the tokens around for the parser would defeat the
+//*point, so it is a pass of its own and the tree outputs are fed by a second pass that parses from
+//*the window.
+Internal void compile_streaming(CompileJob* jobs, size_t num_jobs, size_t window_size) {
+    for (CompileJob* job = jobs; job != jobs + num_jobs; job++) {
+        if (options.emits & EMIT_BIT(EMIT_TOKENS)) {
+            FILE* in = fopen(job->path, "rb");
+            if (!in) {
+                fatal("Could not find file: %s", job->path);
+            }
+            char* out_path = make_out_path(job->path, get_extension(job->path), emitters[EMIT_TOKENS].suffix);
+            FILE* out = fopen(out_path, "w");
+            if (!out) {
+                fatal("Could not write file: %s", out_path);
+            }
+
+            f64 start = trace_begin();
+            bool ok = lex_file(job->path, in, out, window_size);
+            trace_end("lex", job->path, start);
+            fclose(in);
+            ok &= fclose(out) == 0;
+            if (!ok) {
+                fatal("Error streaming %s to %s", job->path, out_path);
+            }
+
+            printf("filename: %s\n", out_path);
+            free(out_path);
+        }
+
+        if (emits_need_ast()) {
+            FILE* in = fopen(job->path, "rb");
+            if (!in) {
+                fatal("Could not find file: %s", job->path);
+            }
+            f64 start = trace_begin();
+            init_keywords();
+            init_stream_file(job->path, in, window_size);
+            job->ast = parse_file();
+            close_stream_file();
+            trace_end("parse", job->path, start);
+            if (ferror(in)) {
+                fatal("Error reading %s", job->path);
+            }
+            fclose(in);
+            if (options.emits & EMIT_BIT(EMIT_VM)) {
+                gen_job(job);
+            }
+            for (EmitKind kind = 0; kind < NUM_EMITS; kind++) {
+                if ((options.emits & EMIT_BIT(kind)) && emitters[kind].needs_ast) {
+                    emit_file(job, &emitters[kind]);
+                }
+            }
+        }
+        free_job(job);
+    }
+}
+
+//*Staged pipeline: a reader thread prefetches sources, the calling thread lexes or parses them and an emitter
+//*thread formats and writes the output. Stages hand jobs over through SPSC rings of `depth` slots,
+//*a NULL job marks the end of the stream. Lexing stays on one thread since it owns the lexer and
+//*intern globals, the emitter only reads interned names which are never moved or freed.
+typedef struct Pipeline {
+    CompileJob* jobs;
+    size_t num_jobs;
+    SpscQueue lex_queue;
+    SpscQueue emit_queue;
+} Pipeline;
+
+Internal void pipeline_reader(void* arg) {
+    trace_thread_name("reader");
+    Pipeline* pipeline = arg;
+    for (CompileJob* job = pipeline->jobs; job != pipeline->jobs + pipeline->num_jobs; job++) {
+        read_job(job);
+        spsc_push(&pipeline->lex_queue, job);
+    }
+    spsc_push(&pipeline->lex_queue, NULL);
+}
+
+Internal void pipeline_emitter(void* arg) {
+    trace_thread_name("emitter");
+    Pipeline* pipeline = arg;
+    for (CompileJob* job = spsc_pop(&pipeline->emit_queue); job; job = spsc_pop(&pipeline->emit_queue)) {
+        emit_job(job);
+        free_job(job);
+    }
+}
+
+Internal void compile_pipelined(CompileJob* jobs, size_t num_jobs, size_t depth) {
+    read_sources(jobs, num_jobs);
+    Pipeline pipeline = { .jobs = jobs, .num_jobs = num_jobs };
+    spsc_init(&pipeline.lex_queue, depth);
+    spsc_init(&pipeline.emit_queue, depth);
+
+    Thread reader = thread_create(pipeline_reader, &pipeline);
+    Thread emitter = thread_create(pipeline_emitter, &pipeline);
+
+    for (CompileJob* job = spsc_pop(&pipeline.lex_queue); job; job = spsc_pop(&pipeline.lex_queue)) {
+        front_job(job);
+        spsc_push(&pipeline.emit_queue, job);
+    }
+    spsc_push(&pipeline.emit_queue, NULL);
+
+    thread_join(reader);
+    thread_join(emitter);
+    spsc_free(&pipeline.lex_queue);
+    spsc_free(&pipeline.emit_queue);
+}
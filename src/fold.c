@@ -0,0 +1,352 @@
+//*Constant folding and algebraic simplification on the AST, run between parsing and code generation.
+//*Nodes are rewritten in place in ast_arena: a folded expression turns into an EXPR_INT where it
+//*stands and statement lists are rebuilt when a constant `if` or `while` drops a branch. Values follow
+//*the 16 bit arithmetic of the Hack CPU, true is -1 and false is 0.
+
+typedef struct FoldStats {
+    size_t folded;
+    size_t dropped_stmts;
+} FoldStats;
+
+FoldStats fold_stats;
+
+Internal bool fold_const(Expr* expr, i32* val) {
+    if (expr->kind == EXPR_INT) {
+        *val = expr->int_val;
+        return true;
+    }
+    if (expr->kind == EXPR_KEYWORD && (expr->keyword == true_keyword || expr->keyword == false_keyword)) {
+        *val = expr->keyword == true_keyword ? -1 : 0;
+        return true;
+    }
+    return false;
+}
+
+//*calls are the only expressions with side effects, anything else may be dropped when its value is unused
+Internal bool expr_is_pure(Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_CALL: return false;
+        case EXPR_INDEX: return expr_is_pure(expr->index.expr);
+        case EXPR_UNARY: return expr_is_pure(expr->unary.expr);
+        case EXPR_BINARY: return expr_is_pure(expr->binary.left) && expr_is_pure(expr->binary.right);
+        case EXPR_PAREN: return expr_is_pure(expr->paren.expr);
+        default: return true;
+    }
+}
+
+//*turns `expr` into the constant `val`, values that do not fit 16 bits are diagnosed and wrap around
+Internal Expr* fold_to_int(Expr* expr, i32 val) {
+    if (val > MAX_INT_CONST || val < -MAX_INT_CONST - 1) {
+        error(expr->pos, "Constant expression overflows 16 bits: %d", val);
+        val = (i16)val;
+    }
+    fold_stats.folded++;
+    expr->kind = EXPR_INT;
+    expr->int_val = val;
+    return expr;
+}
+
+Internal Expr* fold_expr(Expr* expr);
+
+Internal Expr* fold_unary(Expr* expr) {
+    Expr* operand = expr->unary.expr = fold_expr(expr->unary.expr);
+    i32 val;
+    if (fold_const(operand, &val)) {
+        return fold_to_int(expr, expr->unary.op == TOKEN_NEG ? -val : ~val);
+    }
+    //*`- -x` and `~~x`
+    if (operand->kind == EXPR_UNARY && operand->unary.op == expr->unary.op) {
+        fold_stats.folded++;
+        return operand->unary.expr;
+    }
+    return expr;
+}
+
+Internal Expr* fold_binary(Expr* expr) {
+    Expr* left = expr->binary.left = fold_expr(expr->binary.left);
+    Expr* right = expr->binary.right = fold_expr(expr->binary.right);
+    i32 a, b;
+    bool left_const = fold_const(left, &a);
+    bool right_const = fold_const(right, &b);
+    TokenKind op = expr->binary.op;
+
+    if (left_const && right_const) {
+        switch (op) {
+            case TOKEN_ADD: return fold_to_int(expr, a + b);
+            case TOKEN_SUB: return fold_to_int(expr, a - b);
+            case TOKEN_MUL: return fold_to_int(expr, a * b);
+            case TOKEN_DIV: {
+                if (b == 0) {
+                    error(expr->pos, "Division by zero in constant expression");
+                    return expr;
+                }
+                return fold_to_int(expr, a / b);
+            }
+            case TOKEN_AND: return fold_to_int(expr, a & b);
+            case TOKEN_OR: return fold_to_int(expr, a | b);
+            case TOKEN_EQ: return fold_to_int(expr, a == b ? -1 : 0);
+            case TOKEN_LT: return fold_to_int(expr, a < b ? -1 : 0);
+            case TOKEN_GT: return fold_to_int(expr, a > b ? -1 : 0);
+            default: return expr;
+        }
+    }
+
+    //*identities, `x op k` and `k op x` where the constant leaves x unchanged
+    Expr* other = left_const ? right : left;
+    i32 k = left_const ? a : b;
+    if (!left_const && !right_const) {
+        return expr;
+    }
+    bool identity =
+        (op == TOKEN_ADD && k == 0) ||
+        (op == TOKEN_SUB && right_const && k == 0) ||
+        (op == TOKEN_MUL && k == 1) ||
+        (op == TOKEN_DIV && right_const && k == 1) ||
+        (op == TOKEN_OR && k == 0) ||
+        (op == TOKEN_AND && k == -1);
+    if (identity) {
+        fold_stats.folded++;
+        return other;
+    }
+    //*`x * 0`, `x & 0` and `x | true` no longer depend on x, unless evaluating x has side effects
+    bool absorbing = (op == TOKEN_MUL && k == 0) || (op == TOKEN_AND && k == 0) || (op == TOKEN_OR && k == -1);
+    if (absorbing && expr_is_pure(other)) {
+        return fold_to_int(expr, k);
+    }
+    //*`0 - x` and `x * -1`
+    if ((op == TOKEN_SUB && left_const && k == 0) || (op == TOKEN_MUL && k == -1)) {
+        fold_stats.folded++;
+        expr->kind = EXPR_UNARY;
+        expr->unary.op = TOKEN_NEG;
+        expr->unary.expr = other;
+        return fold_unary(expr);
+    }
+    return expr;
+}
+
+Internal Expr* fold_expr(Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_INDEX: {
+            expr->index.expr = fold_expr(expr->index.expr);
+            return expr;
+        }
+        case EXPR_CALL: {
+            ExprList* args = &expr->call.expr_list;
+            for (size_t i = 0; i < args->num_exprs; i++) {
+                args->exprs[i] = fold_expr(args->exprs[i]);
+            }
+            return expr;
+        }
+        case EXPR_UNARY: {
+            return fold_unary(expr);
+        }
+        case EXPR_BINARY: {
+            return fold_binary(expr);
+        }
+        case EXPR_PAREN: {
+            Expr* inner = expr->paren.expr = fold_expr(expr->paren.expr);
+            //*parentheses only matter around operators
+            return inner->kind == EXPR_BINARY || inner->kind == EXPR_UNARY ? expr : inner;
+        }
+        default: {
+            return expr;
+        }
+    }
+}
+
+Internal void fold_stmt_list(StmtList* list);
+
+//*appends the folded `stmt` to `out`, or the statements of the branch a constant condition selects
+Internal void fold_stmt(AstList* out, Stmt* stmt) {
+    switch (stmt->kind) {
+        case STMT_LET: {
+            if (stmt->let_stmt.index_expr) {
+                stmt->let_stmt.index_expr = fold_expr(stmt->let_stmt.index_expr);
+            }
+            stmt->let_stmt.assign_expr = fold_expr(stmt->let_stmt.assign_expr);
+            break;
+        }
+        case STMT_IF: {
+            stmt->if_stmt.cond = fold_expr(stmt->if_stmt.cond);
+            fold_stmt_list(&stmt->if_stmt.then_block);
+            fold_stmt_list(&stmt->if_stmt.else_block);
+            //*the generated `not; if-goto` takes the then branch for -1 only, other constants stay
+            i32 val;
+            if (fold_const(stmt->if_stmt.cond, &val) && (val == 0 || val == -1)) {
+                StmtList* taken = val ? &stmt->if_stmt.then_block : &stmt->if_stmt.else_block;
+                fold_stats.dropped_stmts += val ? stmt->if_stmt.else_block.num_stmts : stmt->if_stmt.then_block.num_stmts;
+                for (size_t i = 0; i < taken->num_stmts; i++) {
+                    AST_LIST_PUSH(*out, Stmt*, taken->stmts[i]);
+                }
+                return;
+            }
+            break;
+        }
+        case STMT_WHILE: {
+            stmt->while_stmt.cond = fold_expr(stmt->while_stmt.cond);
+            fold_stmt_list(&stmt->while_stmt.block);
+            i32 val;
+            if (fold_const(stmt->while_stmt.cond, &val) && !val) {
+                fold_stats.dropped_stmts += 1 + stmt->while_stmt.block.num_stmts;
+                return;
+            }
+            break;
+        }
+        case STMT_DO: {
+            stmt->do_stmt.subroutine_call = fold_expr(stmt->do_stmt.subroutine_call);
+            break;
+        }
+        case STMT_RETURN: {
+            if (stmt->return_stmt.expr) {
+                stmt->return_stmt.expr = fold_expr(stmt->return_stmt.expr);
+            }
+            break;
+        }
+    }
+    AST_LIST_PUSH(*out, Stmt*, stmt);
+}
+
+Internal void fold_stmt_list(StmtList* list) {
+    AstList stmts = ast_list_begin();
+    for (size_t i = 0; i < list->num_stmts; i++) {
+        fold_stmt(&stmts, list->stmts[i]);
+    }
+    *list = stmt_list(list->pos, ast_list_commit(&stmts, sizeof(Stmt*)), stmts.len);
+}
+
+Internal void fold_class(ClassDecl* c) {
+    for (size_t i = 0; i < c->num_subs; i++) {
+        fold_stmt_list(&c->subs[i].block);
+    }
+}
+
+//*Deep copy of the subroutine bodies, so a class can be folded while other outputs still see the tree
+//*as written. Declarations and types are shared, the passes never modify them.
+Internal Expr* expr_clone(Expr* expr) {
+    Expr* e = ast_dup(expr, sizeof(Expr));
+    switch (e->kind) {
+        case EXPR_INDEX: {
+            e->index.expr = expr_clone(e->index.expr);
+            break;
+        }
+        case EXPR_CALL: {
+            ExprList* args = &e->call.expr_list;
+            args->exprs = ast_dup(args->exprs, args->num_exprs * sizeof(Expr*));
+            for (size_t i = 0; i < args->num_exprs; i++) {
+                args->exprs[i] = expr_clone(args->exprs[i]);
+            }
+            break;
+        }
+        case EXPR_UNARY: {
+            e->unary.expr = expr_clone(e->unary.expr);
+            break;
+        }
+        case EXPR_BINARY: {
+            e->binary.left = expr_clone(e->binary.left);
+            e->binary.right = expr_clone(e->binary.right);
+            break;
+        }
+        case EXPR_PAREN: {
+            e->paren.expr = expr_clone(e->paren.expr);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    return e;
+}
+
+Internal StmtList stmt_list_clone(StmtList list);
+
+Internal Stmt* stmt_clone(Stmt* stmt) {
+    Stmt* s = ast_dup(stmt, sizeof(Stmt));
+    switch (s->kind) {
+        case STMT_LET: {
+            s->let_stmt.index_expr = s->let_stmt.index_expr ? expr_clone(s->let_stmt.index_expr) : NULL;
+            s->let_stmt.assign_expr = expr_clone(s->let_stmt.assign_expr);
+            break;
+        }
+        case STMT_IF: {
+            s->if_stmt.cond = expr_clone(s->if_stmt.cond);
+            s->if_stmt.then_block = stmt_list_clone(s->if_stmt.then_block);
+            s->if_stmt.else_block = stmt_list_clone(s->if_stmt.else_block);
+            break;
+        }
+        case STMT_WHILE: {
+            s->while_stmt.cond = expr_clone(s->while_stmt.cond);
+            s->while_stmt.block = stmt_list_clone(s->while_stmt.block);
+            break;
+        }
+        case STMT_DO: {
+            s->do_stmt.subroutine_call = expr_clone(s->do_stmt.subroutine_call);
+            break;
+        }
+        case STMT_RETURN: {
+            s->return_stmt.expr = s->return_stmt.expr ? expr_clone(s->return_stmt.expr) : NULL;
+            break;
+        }
+    }
+    return s;
+}
+
+Internal StmtList stmt_list_clone(StmtList list) {
+    StmtList copy = list;
+    copy.stmts = ast_dup(list.stmts, list.num_stmts * sizeof(Stmt*));
+    for (size_t i = 0; i < list.num_stmts; i++) {
+        copy.stmts[i] = stmt_clone(list.stmts[i]);
+    }
+    return copy;
+}
+
+Internal ClassDecl* class_clone(ClassDecl* c) {
+    ClassDecl* copy = ast_dup(c, sizeof(ClassDecl));
+    copy->subs = ast_dup(c->subs, c->num_subs * sizeof(Subroutine));
+    for (size_t i = 0; i < c->num_subs; i++) {
+        copy->subs[i].block = stmt_list_clone(c->subs[i].block);
+    }
+    return copy;
+}
+
+Internal void fold_tests(void) {
+    init_keywords();
+    init_stream("fold_tests", "class F { function int f(int x) { let x = (2 + 3) * -4; let x = ~true | (1 < 2); let x = (x + 0) * 1 - 0; let x = 0 - x; let x = x * 0 + (g() * 0); let x = - -x; if (3 > 4) { let x = 1; } else { let x = 2; let x = 3; } while (false) { let x = 4; } return 30000 + 30000; } }");
+    ClassDecl* c = parse_class();
+    ClassDecl* orig = class_clone(c);
+    lex_collect_diags = true;
+    fold_class(c);
+    lex_collect_diags = false;
+
+    Stmt** stmts = c->subs[0].block.stmts;
+    assert(c->subs[0].block.num_stmts == 9);
+    assert(stmts[0]->let_stmt.assign_expr->kind == EXPR_INT && stmts[0]->let_stmt.assign_expr->int_val == -20);
+    assert(stmts[1]->let_stmt.assign_expr->kind == EXPR_INT && stmts[1]->let_stmt.assign_expr->int_val == -1);
+    assert(stmts[2]->let_stmt.assign_expr->kind == EXPR_NAME);
+    Expr* neg = stmts[3]->let_stmt.assign_expr;
+    assert(neg->kind == EXPR_UNARY && neg->unary.op == TOKEN_NEG && neg->unary.expr->kind == EXPR_NAME);
+    //*the call stays since it may have side effects
+    Expr* product = stmts[4]->let_stmt.assign_expr;
+    assert(product->kind == EXPR_PAREN && product->paren.expr->kind == EXPR_BINARY);
+    assert(product->paren.expr->binary.left->kind == EXPR_CALL);
+    assert(stmts[5]->let_stmt.assign_expr->kind == EXPR_NAME);
+    //*the else branch is spliced in, the loop is gone
+    assert(stmts[6]->let_stmt.assign_expr->int_val == 2 && stmts[7]->let_stmt.assign_expr->int_val == 3);
+    assert(stmts[8]->kind == STMT_RETURN && stmts[8]->return_stmt.expr->int_val == (i16)60000);
+    assert(BUF_LEN(lex_diags) == 1 && strstr(lex_diags[0].msg, "overflows"));
+    for (LexDiag* it = lex_diags; it != BUF_END(lex_diags); it++) {
+        free(it->msg);
+    }
+    BUF_FREE(lex_diags);
+
+    //*the clone still holds the tree as written
+    assert(orig->subs[0].block.num_stmts == 9 && orig->subs[0].block.stmts[6]->kind == STMT_IF);
+    assert(orig->subs[0].block.stmts[0]->let_stmt.assign_expr->kind == EXPR_BINARY);
+
+    //*1 is neither true nor false, the if is kept for the else branch it takes at run time
+    init_stream("fold_tests", "class F { function void f() { var int a; if (1) { let a = 2; } else { let a = 3; } if (~false) { let a = 4; } return; } }");
+    c = parse_class();
+    fold_class(c);
+    stmts = c->subs[0].block.stmts;
+    assert(c->subs[0].block.num_stmts == 3 && stmts[0]->kind == STMT_IF && stmts[0]->if_stmt.cond->int_val == 1);
+    assert(stmts[1]->kind == STMT_LET && stmts[1]->let_stmt.assign_expr->int_val == 4);
+}
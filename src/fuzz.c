@@ -0,0 +1,276 @@
+//*Fuzzing entry points for the lexer and the parser. Both take an arbitrary byte buffer, never print
+//*and never exit: diagnostics are collected and dropped, a syntax error leaves the parser through
+//*syntax_bailout. Every global they touch is set up on entry and handed back as it was, so inputs
+//*can run back to back in one process without any reset in between. Interned names are kept, the
+//*intern table only grows with names it has not seen.
+//*
+//*fuzz_lex() also checks the optimised lexers against the reference scanner next_token_ref(): the
+//*table driven next_token(), deferred interning and the parallel chunked lexer must produce the
+//*same tokens and diagnostics. A difference aborts, which the fuzzer reports as a crash.
+//*
+//*libFuzzer, running both entry points on every input:
+//*    clang -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZ_LIBFUZZER main.c -o fuzz_jack -lpthread
+//*AFL or a single file, with the sources of the tests as the starting corpus:
+//*    afl-fuzz -i corpus -o findings -- ./jack --fuzz=parse @@
+
+#define FUZZ_CHECK(cond) ((cond) ? (void)0 : fuzz_fail(#cond, __LINE__))
+
+Internal NoReturn void fuzz_fail(const char* what, int line) {
+    fprintf(stderr, "fuzz.c(%d): check failed: %s\n", line, what);
+    abort();
+}
+
+//*the lexers need NUL termination, the input stops at an embedded NUL for all of them alike
+Internal char* fuzz_copy(const u8* data, size_t size) {
+    char* src = xmalloc(size + 1);
+    if (size) {
+        memcpy(src, data, size);
+    }
+    src[size] = 0;
+    return src;
+}
+
+Internal bool fuzz_same_token(const Token* a, const Token* b) {
+    if (a->kind != b->kind || a->start != b->start || a->end != b->end || a->pos.line != b->pos.line) {
+        return false;
+    }
+    switch (a->kind) {
+        case TOKEN_INT: return a->int_val == b->int_val;
+        case TOKEN_STR: return BUF_LEN(a->str_val) == BUF_LEN(b->str_val) && memcmp(a->str_val, b->str_val, BUF_LEN(a->str_val)) == 0;
+        case TOKEN_NAME:
+        case TOKEN_KEYWORD: return a->name == b->name;
+        default: return true;
+    }
+}
+
+Internal void fuzz_check_tokens(const Token* expected, const Token* tokens) {
+    FUZZ_CHECK(BUF_LEN(tokens) == BUF_LEN(expected));
+    for (size_t i = 0; i < BUF_LEN(tokens); i++) {
+        FUZZ_CHECK(fuzz_same_token(&tokens[i], &expected[i]));
+    }
+}
+
+Internal void fuzz_check_diags(const LexDiag* expected, const LexDiag* diags) {
+    FUZZ_CHECK(BUF_LEN(diags) == BUF_LEN(expected));
+    for (size_t i = 0; i < BUF_LEN(diags); i++) {
+        FUZZ_CHECK(diags[i].at == expected[i].at && diags[i].line == expected[i].line && strcmp(diags[i].msg, expected[i].msg) == 0);
+    }
+}
+
+//*the collected diagnostics, handed over by the lexer
+Internal LexDiag* fuzz_take_diags(void) {
+    LexDiag* diags = lex_diags;
+    lex_diags = NULL;
+    return diags;
+}
+
+Internal Token* fuzz_lex_ref(const char* src, size_t len) {
+    close_replay();
+    stream = src;
+    stream_end = src + len;
+    line_start = src;
+    token.pos = (SrcPos) { "fuzz", 1 };
+    Token* tokens = NULL;
+    for (next_token_ref(); !is_token_eof(); next_token_ref()) {
+        BUF_PUSH(tokens, token);
+    }
+    return tokens;
+}
+
+Internal int fuzz_lex(const u8* data, size_t size) {
+    char* src = fuzz_copy(data, size);
+    size_t len = strlen(src);
+    bool collect = lex_collect_diags;
+    LexDiag* outer_diags = fuzz_take_diags();
+    lex_collect_diags = true;
+    init_keywords();
+
+    Token* expected = fuzz_lex_ref(src, len);
+    LexDiag* expected_diags = fuzz_take_diags();
+
+    Token* tokens = lex_tokens("fuzz", src);
+    LexDiag* diags = fuzz_take_diags();
+    fuzz_check_tokens(expected, tokens);
+    fuzz_check_diags(expected_diags, diags);
+    free_tokens(tokens);
+    free_diags(diags);
+
+    lex_defer_intern = true;
+    tokens = lex_tokens("fuzz", src);
+    lex_defer_intern = false;
+    for (Token* it = tokens; it != BUF_END(tokens); it++) {
+        if (it->kind == TOKEN_NAME) {
+            intern_token(it);
+        }
+    }
+    diags = fuzz_take_diags();
+    fuzz_check_tokens(expected, tokens);
+    fuzz_check_diags(expected_diags, diags);
+    free_tokens(tokens);
+    free_diags(diags);
+
+    //*three chunks put a boundary into all but the shortest inputs
+    tokens = lex_tokens_parallel("fuzz", src, len, 3);
+    diags = fuzz_take_diags();
+    fuzz_check_tokens(expected, tokens);
+    fuzz_check_diags(expected_diags, diags);
+    free_tokens(tokens);
+    free_diags(diags);
+
+    free_tokens(expected);
+    free_diags(expected_diags);
+    lex_collect_diags = collect;
+    lex_diags = outer_diags;
+    free(src);
+    return 0;
+}
+
+//*parse_file() on the replayed `tokens`, false when it bailed out on a syntax error
+Internal bool fuzz_parse_tokens(const Token* tokens) {
+    jmp_buf bailout;
+    jmp_buf* outer_bailout = syntax_bailout;
+    size_t scratch_len = BUF_LEN(ast_scratch);
+    init_replay("fuzz", tokens, BUF_LEN(tokens));
+    syntax_bailout = &bailout;
+    bool ok = false;
+    if (setjmp(bailout) == 0) {
+        parse_file();
+        ok = true;
+    }
+    else if (ast_scratch) {
+        //*lists the parser had open are dropped
+        _BUF_HDR(ast_scratch)->len = scratch_len;
+    }
+    syntax_bailout = outer_bailout;
+    close_replay();
+    FUZZ_CHECK(BUF_LEN(ast_scratch) == scratch_len);
+    return ok;
+}
+
+//*Parses the input as a class from its lexed tokens, true when it is one. The tree goes to an arena
+//*of its own that is freed again, the token array owns the string literals.
+Internal bool fuzz_parse_class(const char* src) {
+    bool collect = lex_collect_diags;
+    LexDiag* outer_diags = fuzz_take_diags();
+    Arena outer_arena = ast_arena;
+    ast_arena = (Arena) { 0 };
+    lex_collect_diags = true;
+    init_keywords();
+
+    Token* tokens = lex_tokens("fuzz", src);
+    bool ok = fuzz_parse_tokens(tokens);
+    free_tokens(tokens);
+    free_diags(fuzz_take_diags());
+    arena_free(&ast_arena);
+    ast_arena = outer_arena;
+    lex_collect_diags = collect;
+    lex_diags = outer_diags;
+    return ok;
+}
+
+Internal int fuzz_parse(const u8* data, size_t size) {
+    char* src = fuzz_copy(data, size);
+    fuzz_parse_class(src);
+    free(src);
+    return 0;
+}
+
+#if FUZZ_LIBFUZZER
+int LLVMFuzzerTestOneInput(const u8* data, size_t size) {
+    fuzz_lex(data, size);
+    return fuzz_parse(data, size);
+}
+#endif
+
+//*`--fuzz=lex|parse <file>`, one input per process for AFL and for replaying a crash
+Internal int fuzz_main(const char* target, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fatal("Could not find file: %s", path);
+    }
+    size_t size = (size_t)file_size(file);
+    u8* data = xmalloc(size + 1);
+    size = fread(data, 1, size, file);
+    fclose(file);
+    if (strcmp(target, "lex") == 0) {
+        fuzz_lex(data, size);
+    }
+    else if (strcmp(target, "parse") == 0) {
+        fuzz_parse(data, size);
+    }
+    else {
+        fatal("Unknown --fuzz target: %s, expected lex or parse", target);
+    }
+    free(data);
+    return 0;
+}
+
+Internal void fuzz_tests(void) {
+    LocalPersist const char* inputs[] = {
+        "",
+        "\"\\",
+        "\"abc\\",
+        "class A { function void f() { let x = \"a\\qb\"; return 99999999999999999999; } }",
+        "/* unterminated\n comment",
+        "a\fb\v\rc // tail",
+        "class A { field int x; method int g() { return -~-(x); } }\n",
+        "\x80\xff\x01 class",
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        fuzz_lex((const u8*)inputs[i], strlen(inputs[i]));
+        fuzz_parse((const u8*)inputs[i], strlen(inputs[i]));
+    }
+    LocalPersist const char with_nul[] = "class A {\0 } after the nul";
+    fuzz_lex((const u8*)with_nul, sizeof(with_nul) - 1);
+    fuzz_parse((const u8*)with_nul, sizeof(with_nul) - 1);
+    assert(fuzz_parse_class("class A { field int x; method int g() { return -~-(x); } }"));
+    assert(!fuzz_parse_class("class A { method void f() { let x = ; } }"));
+    assert(!fuzz_parse_class("class A"));
+
+    //*nesting past PARSE_MAX_DEPTH is a syntax error instead of a stack overflow
+    char* deep = NULL;
+    BUF_PRINTF(deep, "class A { function int f() { return ");
+    for (size_t i = 0; i < 100000; i++) {
+        BUF_PUSH(deep, i % 2 ? '(' : '-');
+    }
+    BUF_PUSH(deep, 0);
+    assert(!fuzz_parse_class(deep));
+    BUF_FREE(deep);
+    char* nested = NULL;
+    BUF_PRINTF(nested, "class A { function void f() { ");
+    for (size_t i = 0; i < PARSE_MAX_DEPTH / 2; i++) {
+        BUF_PRINTF(nested, "while ((x)) { ");
+    }
+    for (size_t i = 0; i < PARSE_MAX_DEPTH / 2; i++) {
+        BUF_PRINTF(nested, "} ");
+    }
+    BUF_PRINTF(nested, "return; } }");
+    BUF_PUSH(nested, 0);
+    assert(fuzz_parse_class(nested));
+    BUF_FREE(nested);
+
+    //*random mutations of a valid class, the alphabet is mostly Jack with some bytes it rejects
+    LocalPersist const char alphabet[] = "classfunvoid intletdoreturn x1 09{}()[].,;+-*/&|<>=~\"\\\n\t*/ /*//\x80";
+    const char* seed = inputs[3];
+    size_t seed_len = strlen(seed);
+    u64 state = 0x9e3779b97f4a7c15;
+    char buf[256];
+    for (size_t iter = 0; iter < 2000; iter++) {
+        memcpy(buf, seed, seed_len);
+        size_t len = seed_len;
+        for (size_t edits = 1 + iter % 8; edits; edits--) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            size_t at = (size_t)(state % len);
+            char c = alphabet[(state >> 32) % (sizeof(alphabet) - 1)];
+            if ((state >> 20) % 3 == 0 && len + 1 < sizeof(buf)) {
+                memmove(buf + at + 1, buf + at, len - at);
+                len++;
+            }
+            buf[at] = c;
+        }
+        fuzz_lex((const u8*)buf, len);
+        fuzz_parse((const u8*)buf, len);
+    }
+}
@@ -0,0 +1,824 @@
+//*VM code generation: a class is lowered to an array of VmInst which the later passes work on, only the
+//*emitter turns it into `.vm` text.
+
+typedef enum VmOp {
+    VM_PUSH,
+    VM_POP,
+    VM_ADD,
+    VM_SUB,
+    VM_NEG,
+    VM_EQ,
+    VM_GT,
+    VM_LT,
+    VM_AND,
+    VM_OR,
+    VM_NOT,
+    VM_LABEL,
+    VM_GOTO,
+    VM_IF_GOTO,
+    VM_FUNCTION,
+    VM_CALL,
+    VM_RETURN,
+} VmOp;
+
+typedef enum VmSegment {
+    SEG_CONSTANT,
+    SEG_ARGUMENT,
+    SEG_LOCAL,
+    SEG_STATIC,
+    SEG_THIS,
+    SEG_THAT,
+    SEG_POINTER,
+    SEG_TEMP,
+} VmSegment;
+
+const char* vm_op_names[] = {
+    [VM_PUSH] = "push",
+    [VM_POP] = "pop",
+    [VM_ADD] = "add",
+    [VM_SUB] = "sub",
+    [VM_NEG] = "neg",
+    [VM_EQ] = "eq",
+    [VM_GT] = "gt",
+    [VM_LT] = "lt",
+    [VM_AND] = "and",
+    [VM_OR] = "or",
+    [VM_NOT] = "not",
+    [VM_LABEL] = "label",
+    [VM_GOTO] = "goto",
+    [VM_IF_GOTO] = "if-goto",
+    [VM_FUNCTION] = "function",
+    [VM_CALL] = "call",
+    [VM_RETURN] = "return",
+};
+
+const char* vm_segment_names[] = {
+    [SEG_CONSTANT] = "constant",
+    [SEG_ARGUMENT] = "argument",
+    [SEG_LOCAL] = "local",
+    [SEG_STATIC] = "static",
+    [SEG_THIS] = "this",
+    [SEG_THAT] = "that",
+    [SEG_POINTER] = "pointer",
+    [SEG_TEMP] = "temp",
+};
+
+//*push/pop use `seg` and `arg`, labels and jumps print as `<name><arg>` with a fixed prefix and a
+//*per subroutine counter, function/call carry the interned `Class.sub` name and the local/arg count.
+//*Labels read back from `.vm` text keep their whole name and an arg of -1.
+typedef struct VmInst {
+    VmOp op;
+    VmSegment seg;
+    i32 arg;
+    const char* name;
+} VmInst;
+
+VmSegment sym_segments[] = {
+    [SYM_STATIC] = SEG_STATIC,
+    [SYM_FIELD] = SEG_THIS,
+    [SYM_ARG] = SEG_ARGUMENT,
+    [SYM_LOCAL] = SEG_LOCAL,
+};
+
+typedef struct Gen {
+    ClassDecl* c;
+    SymScope class_scope;
+    SymScope sub_scope;
+    i32 num_fields;
+    i32 num_labels;
+    VmInst* code;
+} Gen;
+
+const char* string_new_name;
+const char* string_append_name;
+const char* memory_alloc_name;
+const char* math_multiply_name;
+const char* math_divide_name;
+//*label prefixes are interned too, labels are equal when prefix pointer and number match
+const char* if_false_label;
+const char* if_end_label;
+const char* while_exp_label;
+const char* while_end_label;
+const char* while_body_label;
+
+Internal void init_gen(void) {
+    LocalPersist bool inited;
+    if (inited) {
+        return;
+    }
+    string_new_name = str_intern("String.new");
+    string_append_name = str_intern("String.appendChar");
+    memory_alloc_name = str_intern("Memory.alloc");
+    math_multiply_name = str_intern("Math.multiply");
+    math_divide_name = str_intern("Math.divide");
+    if_false_label = str_intern("IF_FALSE");
+    if_end_label = str_intern("IF_END");
+    while_exp_label = str_intern("WHILE_EXP");
+    while_end_label = str_intern("WHILE_END");
+    while_body_label = str_intern("WHILE_BODY");
+    inited = true;
+}
+
+//*names are interned so symbols are found by pointer, the subroutine scope shadows the class scope
+Internal Sym* gen_lookup(Gen* gen, const char* name) {
+    Sym* sym = sym_get(&gen->sub_scope, name);
+    return sym ? sym : sym_get(&gen->class_scope, name);
+}
+
+Internal const char* gen_qualified_name(const char* class_name, const char* sub_name) {
+    char* buf = NULL;
+    BUF_PRINTF(buf, "%s.%s", class_name, sub_name);
+    const char* name = str_intern_range(buf, BUF_END(buf));
+    BUF_FREE(buf);
+    return name;
+}
+
+Internal void gen_inst(Gen* gen, VmOp op, VmSegment seg, i32 arg, const char* name) {
+    BUF_PUSH(gen->code, (VmInst) { op, seg, arg, name });
+}
+
+//*`push constant` only takes 0..32767, other 16 bit values need a `neg` or `not` behind it
+Internal void vm_push_constant(VmInst** code, i16 val) {
+    if (val >= 0) {
+        BUF_PUSH(*code, (VmInst) { VM_PUSH, SEG_CONSTANT, val, NULL });
+    }
+    else if (val == -1 || val == -32768) {
+        BUF_PUSH(*code, (VmInst) { VM_PUSH, SEG_CONSTANT, (i16)~val, NULL });
+        BUF_PUSH(*code, (VmInst) { VM_NOT, 0, 0, NULL });
+    }
+    else {
+        BUF_PUSH(*code, (VmInst) { VM_PUSH, SEG_CONSTANT, -val, NULL });
+        BUF_PUSH(*code, (VmInst) { VM_NEG, 0, 0, NULL });
+    }
+}
+
+Internal void gen_push(Gen* gen, VmSegment seg, i32 index) {
+    gen_inst(gen, VM_PUSH, seg, index, NULL);
+}
+
+Internal void gen_pop(Gen* gen, VmSegment seg, i32 index) {
+    gen_inst(gen, VM_POP, seg, index, NULL);
+}
+
+Internal void gen_op(Gen* gen, VmOp op) {
+    gen_inst(gen, op, 0, 0, NULL);
+}
+
+Internal void gen_call(Gen* gen, const char* name, i32 num_args) {
+    gen_inst(gen, VM_CALL, 0, num_args, name);
+}
+
+Internal void gen_label(Gen* gen, VmOp op, const char* prefix, i32 label) {
+    gen_inst(gen, op, 0, label, prefix);
+}
+
+Internal Sym* gen_var(Gen* gen, SrcPos pos, const char* name) {
+    Sym* sym = gen_lookup(gen, name);
+    if (!sym) {
+        fatal_error(pos, "undefined variable %s", name);
+    }
+    return sym;
+}
+
+Internal void gen_expr(Gen* gen, Expr* expr);
+
+Internal Subroutine* find_sub(ClassDecl* c, const char* name) {
+    for (size_t i = 0; i < c->num_subs; i++) {
+        if (c->subs[i].name == name) {
+            return &c->subs[i];
+        }
+    }
+    return NULL;
+}
+
+Internal void gen_sub_call(Gen* gen, SrcPos pos, SubCall* call) {
+    i32 num_args = (i32)call->expr_list.num_exprs;
+    const char* class_name;
+    if (!call->field_name) {
+        //*`foo()` calls a method on this unless this class declares foo as a function
+        Subroutine* sub = find_sub(gen->c, call->sub_name);
+        if (!sub || sub->sub_type == SUB_METHOD) {
+            gen_push(gen, SEG_POINTER, 0);
+            num_args++;
+        }
+        class_name = gen->c->name;
+    }
+    else {
+        Sym* sym = gen_lookup(gen, call->field_name);
+        if (sym) {
+            if (sym->type->kind != TYPE_CLASSNAME) {
+                fatal_error(pos, "cannot call method %s on %s of type %s", call->sub_name, sym->name, sym->type->name);
+            }
+            gen_push(gen, sym_segments[sym->kind], sym->index);
+            class_name = sym->type->name;
+            num_args++;
+        }
+        else {
+            class_name = call->field_name;
+        }
+    }
+    for (size_t i = 0; i < call->expr_list.num_exprs; i++) {
+        gen_expr(gen, call->expr_list.exprs[i]);
+    }
+    gen_call(gen, gen_qualified_name(class_name, call->sub_name), num_args);
+}
+
+//*Strength reduction: a multiplication by a constant becomes a chain of additions, Math.multiply costs
+//*hundreds of Hack instructions where a push or add is a handful. The VM has no dup, so the operand is
+//*pushed again from its variable or from temp 1, and the running product is doubled through temp 2.
+//*Division by a constant only reduces for 1 and -1, without shifts there is nothing cheaper to emit.
+bool gen_reduce_strength = true;
+
+#define MUL_CHAIN_MAX 16
+
+typedef struct GenStats {
+    size_t mul_calls;
+    size_t div_calls;
+    size_t reduced;
+} GenStats;
+
+GenStats gen_stats;
+
+//*integer constant operands, negative ones are a unary minus of a literal
+Internal bool expr_const_value(Expr* expr, i32* val) {
+    if (expr->kind == EXPR_INT) {
+        *val = expr->int_val;
+        return true;
+    }
+    if (expr->kind == EXPR_PAREN) {
+        return expr_const_value(expr->paren.expr, val);
+    }
+    if (expr->kind == EXPR_UNARY && expr->unary.op == TOKEN_NEG && expr_const_value(expr->unary.expr, val)) {
+        *val = -*val;
+        return true;
+    }
+    return false;
+}
+
+//*built from literals only, these are left for constant folding
+Internal bool expr_is_constant(Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_INT: return true;
+        case EXPR_PAREN: return expr_is_constant(expr->paren.expr);
+        case EXPR_UNARY: return expr_is_constant(expr->unary.expr);
+        case EXPR_BINARY: return expr_is_constant(expr->binary.left) && expr_is_constant(expr->binary.right);
+        default: return false;
+    }
+}
+
+Internal i32 msb_index(u32 x) {
+    i32 i = -1;
+    while (x) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+}
+
+//*instructions the chain for a multiplication by `mag` adds on top of evaluating the operand once
+Internal i32 mul_chain_cost(u32 mag, bool via_temp) {
+    i32 cost = via_temp ? 2 : 1;
+    for (i32 bit = msb_index(mag) - 1; bit >= 0; bit--) {
+        cost += bit == msb_index(mag) - 1 ? 2 : 4;
+        cost += (mag >> bit) & 1 ? 2 : 0;
+    }
+    return cost;
+}
+
+Internal bool gen_mul_const(Gen* gen, Expr* x, i32 c) {
+    u32 mag = c < 0 ? -c : c;
+    bool simple = x->kind == EXPR_NAME;
+    if (mag > 1 && mul_chain_cost(mag, !simple) > MUL_CHAIN_MAX) {
+        return false;
+    }
+
+    gen_stats.reduced++;
+    if (mag == 0) {
+        if (!simple) {
+            gen_expr(gen, x);
+            gen_pop(gen, SEG_TEMP, 1);
+        }
+        gen_push(gen, SEG_CONSTANT, 0);
+        return true;
+    }
+    if (mag == 1) {
+        gen_expr(gen, x);
+        if (c < 0) {
+            gen_op(gen, VM_NEG);
+        }
+        return true;
+    }
+
+    VmSegment seg = SEG_TEMP;
+    i32 index = 1;
+    if (simple) {
+        Sym* sym = gen_var(gen, x->pos, x->name);
+        seg = sym_segments[sym->kind];
+        index = sym->index;
+    }
+    else {
+        gen_expr(gen, x);
+        gen_pop(gen, SEG_TEMP, 1);
+    }
+
+    //*the product is built from the top bit down, doubling then adding the operand for each set bit
+    gen_push(gen, seg, index);
+    for (i32 bit = msb_index(mag) - 1; bit >= 0; bit--) {
+        if (bit == msb_index(mag) - 1) {
+            gen_push(gen, seg, index);
+        }
+        else {
+            gen_pop(gen, SEG_TEMP, 2);
+            gen_push(gen, SEG_TEMP, 2);
+            gen_push(gen, SEG_TEMP, 2);
+        }
+        gen_op(gen, VM_ADD);
+        if ((mag >> bit) & 1) {
+            gen_push(gen, seg, index);
+            gen_op(gen, VM_ADD);
+        }
+    }
+    if (c < 0) {
+        gen_op(gen, VM_NEG);
+    }
+    return true;
+}
+
+Internal bool gen_reduced_binary(Gen* gen, Expr* expr) {
+    Expr* left = expr->binary.left;
+    Expr* right = expr->binary.right;
+    i32 c;
+    if (expr->binary.op == TOKEN_MUL) {
+        if (expr_const_value(right, &c) && !expr_is_constant(left)) {
+            return gen_mul_const(gen, left, c);
+        }
+        if (expr_const_value(left, &c) && !expr_is_constant(right)) {
+            return gen_mul_const(gen, right, c);
+        }
+    }
+    else if (expr->binary.op == TOKEN_DIV && expr_const_value(right, &c) && (c == 1 || c == -1)) {
+        gen_stats.reduced++;
+        gen_expr(gen, left);
+        if (c < 0) {
+            gen_op(gen, VM_NEG);
+        }
+        return true;
+    }
+    return false;
+}
+
+VmOp binary_vm_ops[] = {
+    [TOKEN_ADD] = VM_ADD,
+    [TOKEN_SUB] = VM_SUB,
+    [TOKEN_AND] = VM_AND,
+    [TOKEN_OR] = VM_OR,
+    [TOKEN_EQ] = VM_EQ,
+    [TOKEN_LT] = VM_LT,
+    [TOKEN_GT] = VM_GT,
+};
+
+Internal void gen_expr(Gen* gen, Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_INT: {
+            //*literals are 0..32767, negative values only come from constant folding
+            vm_push_constant(&gen->code, (i16)expr->int_val);
+            break;
+        }
+        case EXPR_STR: {
+            i32 len = (i32)strlen(expr->str_val);
+            gen_push(gen, SEG_CONSTANT, len);
+            gen_call(gen, string_new_name, 1);
+            for (i32 i = 0; i < len; i++) {
+                gen_push(gen, SEG_CONSTANT, (u8)expr->str_val[i]);
+                gen_call(gen, string_append_name, 2);
+            }
+            break;
+        }
+        case EXPR_KEYWORD: {
+            if (expr->keyword == this_keyword) {
+                gen_push(gen, SEG_POINTER, 0);
+            }
+            else {
+                gen_push(gen, SEG_CONSTANT, 0);
+                if (expr->keyword == true_keyword) {
+                    gen_op(gen, VM_NOT);
+                }
+            }
+            break;
+        }
+        case EXPR_NAME: {
+            Sym* sym = gen_var(gen, expr->pos, expr->name);
+            gen_push(gen, sym_segments[sym->kind], sym->index);
+            break;
+        }
+        case EXPR_INDEX: {
+            Sym* sym = gen_var(gen, expr->pos, expr->index.name);
+            gen_push(gen, sym_segments[sym->kind], sym->index);
+            gen_expr(gen, expr->index.expr);
+            gen_op(gen, VM_ADD);
+            gen_pop(gen, SEG_POINTER, 1);
+            gen_push(gen, SEG_THAT, 0);
+            break;
+        }
+        case EXPR_CALL: {
+            gen_sub_call(gen, expr->pos, &expr->call);
+            break;
+        }
+        case EXPR_UNARY: {
+            gen_expr(gen, expr->unary.expr);
+            gen_op(gen, expr->unary.op == TOKEN_NEG ? VM_NEG : VM_NOT);
+            break;
+        }
+        case EXPR_BINARY: {
+            if (gen_reduce_strength && gen_reduced_binary(gen, expr)) {
+                break;
+            }
+            gen_expr(gen, expr->binary.left);
+            gen_expr(gen, expr->binary.right);
+            if (expr->binary.op == TOKEN_MUL) {
+                gen_stats.mul_calls++;
+                gen_call(gen, math_multiply_name, 2);
+            }
+            else if (expr->binary.op == TOKEN_DIV) {
+                gen_stats.div_calls++;
+                gen_call(gen, math_divide_name, 2);
+            }
+            else {
+                gen_op(gen, binary_vm_ops[expr->binary.op]);
+            }
+            break;
+        }
+        case EXPR_PAREN: {
+            gen_expr(gen, expr->paren.expr);
+            break;
+        }
+        default: {
+            assert(0);
+            break;
+        }
+    }
+}
+
+Internal void gen_stmt_list(Gen* gen, StmtList* list);
+
+Internal void gen_stmt(Gen* gen, Stmt* stmt) {
+    switch (stmt->kind) {
+        case STMT_LET: {
+            Sym* sym = gen_var(gen, stmt->pos, stmt->let_stmt.name);
+            if (stmt->let_stmt.index_expr) {
+                gen_push(gen, sym_segments[sym->kind], sym->index);
+                gen_expr(gen, stmt->let_stmt.index_expr);
+                gen_op(gen, VM_ADD);
+                gen_expr(gen, stmt->let_stmt.assign_expr);
+                gen_pop(gen, SEG_TEMP, 0);
+                gen_pop(gen, SEG_POINTER, 1);
+                gen_push(gen, SEG_TEMP, 0);
+                gen_pop(gen, SEG_THAT, 0);
+            }
+            else {
+                gen_expr(gen, stmt->let_stmt.assign_expr);
+                gen_pop(gen, sym_segments[sym->kind], sym->index);
+            }
+            break;
+        }
+        case STMT_IF: {
+            i32 label = gen->num_labels++;
+            gen_expr(gen, stmt->if_stmt.cond);
+            gen_op(gen, VM_NOT);
+            gen_label(gen, VM_IF_GOTO, if_false_label, label);
+            gen_stmt_list(gen, &stmt->if_stmt.then_block);
+            if (stmt->if_stmt.has_else) {
+                gen_label(gen, VM_GOTO, if_end_label, label);
+                gen_label(gen, VM_LABEL, if_false_label, label);
+                gen_stmt_list(gen, &stmt->if_stmt.else_block);
+                gen_label(gen, VM_LABEL, if_end_label, label);
+            }
+            else {
+                gen_label(gen, VM_LABEL, if_false_label, label);
+            }
+            break;
+        }
+        case STMT_WHILE: {
+            i32 label = gen->num_labels++;
+            gen_label(gen, VM_LABEL, while_exp_label, label);
+            gen_expr(gen, stmt->while_stmt.cond);
+            gen_op(gen, VM_NOT);
+            gen_label(gen, VM_IF_GOTO, while_end_label, label);
+            gen_stmt_list(gen, &stmt->while_stmt.block);
+            gen_label(gen, VM_GOTO, while_exp_label, label);
+            gen_label(gen, VM_LABEL, while_end_label, label);
+            break;
+        }
+        case STMT_DO: {
+            gen_expr(gen, stmt->do_stmt.subroutine_call);
+            gen_pop(gen, SEG_TEMP, 0);
+            break;
+        }
+        case STMT_RETURN: {
+            if (stmt->return_stmt.expr) {
+                gen_expr(gen, stmt->return_stmt.expr);
+            }
+            else {
+                gen_push(gen, SEG_CONSTANT, 0);
+            }
+            gen_op(gen, VM_RETURN);
+            break;
+        }
+    }
+}
+
+Internal void gen_stmt_list(Gen* gen, StmtList* list) {
+    for (size_t i = 0; i < list->num_stmts; i++) {
+        gen_stmt(gen, list->stmts[i]);
+    }
+}
+
+Internal void gen_subroutine(Gen* gen, Subroutine* sub) {
+    sym_reset(&gen->sub_scope);
+    gen->num_labels = 0;
+
+    //*argument 0 of a method is this
+    i32 first_arg = sub->sub_type == SUB_METHOD ? 1 : 0;
+    for (size_t i = 0; i < sub->num_params; i++) {
+        sym_put(&gen->sub_scope, (Sym) { sub->params[i].name, sub->params[i].type, SYM_ARG, first_arg + (i32)i });
+    }
+    for (size_t i = 0; i < sub->num_vars; i++) {
+        sym_put(&gen->sub_scope, (Sym) { sub->vars[i].name, sub->vars[i].type, SYM_LOCAL, (i32)i });
+    }
+
+    gen_inst(gen, VM_FUNCTION, 0, (i32)sub->num_vars, gen_qualified_name(gen->c->name, sub->name));
+    if (sub->sub_type == SUB_CONSTRUCTOR) {
+        gen_push(gen, SEG_CONSTANT, gen->num_fields);
+        gen_call(gen, memory_alloc_name, 1);
+        gen_pop(gen, SEG_POINTER, 0);
+    }
+    else if (sub->sub_type == SUB_METHOD) {
+        gen_push(gen, SEG_ARGUMENT, 0);
+        gen_pop(gen, SEG_POINTER, 0);
+    }
+    gen_stmt_list(gen, &sub->block);
+}
+
+//*Lowers one class, the returned BUF is owned by the caller. Must run on the thread owning the
+//*intern table since call targets are interned as `Class.sub`.
+Internal VmInst* gen_class(ClassDecl* c) {
+    init_gen();
+    Gen gen = { .c = c };
+    i32 num_statics = 0;
+    for (size_t i = 0; i < c->num_vars; i++) {
+        ClassVarDecl* var = &c->vars[i];
+        i32 index = var->var_type == VAR_STATIC ? num_statics++ : gen.num_fields++;
+        sym_put(&gen.class_scope, (Sym) { var->name, var->type, var->var_type == VAR_STATIC ? SYM_STATIC : SYM_FIELD, index });
+    }
+    for (size_t i = 0; i < c->num_subs; i++) {
+        gen_subroutine(&gen, &c->subs[i]);
+    }
+    sym_free(&gen.class_scope);
+    sym_free(&gen.sub_scope);
+    return gen.code;
+}
+
+Internal void vm_write_inst(Writer* w, const VmInst* inst) {
+    writer_puts(w, vm_op_names[inst->op]);
+    switch (inst->op) {
+        case VM_PUSH:
+        case VM_POP: {
+            writer_write(w, " ", 1);
+            writer_puts(w, vm_segment_names[inst->seg]);
+            writer_write(w, " ", 1);
+            writer_u32(w, (u32)inst->arg);
+            break;
+        }
+        case VM_LABEL:
+        case VM_GOTO:
+        case VM_IF_GOTO: {
+            writer_write(w, " ", 1);
+            writer_puts(w, inst->name);
+            if (inst->arg >= 0) {
+                writer_u32(w, (u32)inst->arg);
+            }
+            break;
+        }
+        case VM_FUNCTION:
+        case VM_CALL: {
+            writer_write(w, " ", 1);
+            writer_puts(w, inst->name);
+            writer_write(w, " ", 1);
+            writer_u32(w, (u32)inst->arg);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    writer_write(w, "\n", 1);
+}
+
+Internal void vm_write(Writer* w, const VmInst* code, size_t num_insts) {
+    for (size_t i = 0; i < num_insts; i++) {
+        vm_write_inst(w, &code[i]);
+    }
+}
+
+//*Next whitespace separated word of the line at `*at`, NULL at the end of the line or a comment
+Internal const char* vm_read_word(const char** at, const char** end) {
+    const char* ptr = *at;
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r') {
+        ptr++;
+    }
+    if (!*ptr || *ptr == '\n' || (ptr[0] == '/' && ptr[1] == '/')) {
+        *at = ptr;
+        return NULL;
+    }
+    const char* start = ptr;
+    while (*ptr && *ptr != ' ' && *ptr != '\t' && *ptr != '\r' && *ptr != '\n') {
+        ptr++;
+    }
+    *at = ptr;
+    *end = ptr;
+    return start;
+}
+
+//*Parses `.vm` text, used to link library code such as the OS into whole program output. Returns
+//*false and reports the line when it is not valid VM code.
+Internal bool vm_read(const char* path, const char* src, VmInst** code) {
+    i64 line = 1;
+    for (const char* at = src; *at; line++) {
+        const char* end;
+        const char* word = vm_read_word(&at, &end);
+        if (word) {
+            VmInst inst = { 0 };
+            size_t op = 0;
+            while (op <= VM_RETURN && !(strlen(vm_op_names[op]) == (size_t)(end - word) && strncmp(vm_op_names[op], word, end - word) == 0)) {
+                op++;
+            }
+            inst.op = (VmOp)op;
+            const char* arg = NULL;
+            const char* arg_end = NULL;
+            bool ok = op <= VM_RETURN;
+            if (ok && (inst.op == VM_PUSH || inst.op == VM_POP)) {
+                word = vm_read_word(&at, &end);
+                size_t seg = 0;
+                while (word && seg <= SEG_TEMP && !(strlen(vm_segment_names[seg]) == (size_t)(end - word) && strncmp(vm_segment_names[seg], word, end - word) == 0)) {
+                    seg++;
+                }
+                ok = word && seg <= SEG_TEMP;
+                inst.seg = (VmSegment)seg;
+                arg = vm_read_word(&at, &arg_end);
+                ok &= arg != NULL;
+            }
+            else if (ok && inst.op >= VM_LABEL && inst.op <= VM_CALL) {
+                word = vm_read_word(&at, &end);
+                ok = word != NULL;
+                inst.name = ok ? str_intern_range(word, end) : NULL;
+                inst.arg = -1;
+                if (inst.op == VM_FUNCTION || inst.op == VM_CALL) {
+                    arg = vm_read_word(&at, &arg_end);
+                    ok &= arg != NULL;
+                }
+            }
+            if (ok && arg) {
+                char* num_end;
+                long val = strtol(arg, &num_end, 10);
+                ok = num_end == arg_end && val >= 0 && val <= MAX_INT_CONST;
+                inst.arg = (i32)val;
+            }
+            if (!ok || vm_read_word(&at, &end)) {
+                error((SrcPos) { path, line }, "Invalid vm instruction");
+                return false;
+            }
+            BUF_PUSH(*code, inst);
+        }
+        while (*at && *at != '\n') {
+            at++;
+        }
+        if (*at) {
+            at++;
+        }
+    }
+    return true;
+}
+
+Internal void strength_tests(void);
+
+Internal void gen_tests(void) {
+    init_keywords();
+    init_stream("gen_tests", "class P { field int x; static P last; constructor P new(int a) { let x = a; return this; } method int get() { return x * 2; } function void f(Array a) { var P p; let p = P.new(-1); let a[p.get()] = \"hi\"; while (~true) { do f(a); } return; } }");
+    ClassDecl* c = parse_class();
+    VmInst* code = gen_class(c);
+    Writer w = writer_new(NULL);
+    vm_write(&w, code, BUF_LEN(code));
+    writer_close(&w);
+    BUF_PUSH(w.mem, 0);
+    const char* expected =
+        "function P.new 0\npush constant 1\ncall Memory.alloc 1\npop pointer 0\npush argument 0\npop this 0\npush pointer 0\nreturn\n"
+        "function P.get 0\npush argument 0\npop pointer 0\npush this 0\npush this 0\nadd\nreturn\n"
+        "function P.f 1\npush constant 1\nneg\ncall P.new 1\npop local 0\n"
+        "push argument 0\npush local 0\ncall P.get 1\nadd\npush constant 2\ncall String.new 1\npush constant 104\ncall String.appendChar 2\npush constant 105\ncall String.appendChar 2\n"
+        "pop temp 0\npop pointer 1\npush temp 0\npop that 0\n"
+        "label WHILE_EXP0\npush constant 0\nnot\nnot\nnot\nif-goto WHILE_END0\npush argument 0\ncall P.f 1\npop temp 0\ngoto WHILE_EXP0\nlabel WHILE_END0\n"
+        "push constant 0\nreturn\n";
+    assert(strcmp(w.mem, expected) == 0);
+
+    //*reading the text back gives the same code, only labels lose the split into prefix and number
+    VmInst* read = NULL;
+    assert(vm_read("gen_tests", w.mem, &read));
+    assert(BUF_LEN(read) == BUF_LEN(code));
+    for (size_t i = 0; i < BUF_LEN(code); i++) {
+        assert(read[i].op == code[i].op);
+        if (code[i].op >= VM_LABEL && code[i].op <= VM_IF_GOTO) {
+            assert(read[i].arg == -1 && strncmp(read[i].name, code[i].name, strlen(code[i].name)) == 0);
+        }
+        else {
+            assert(read[i].seg == code[i].seg && read[i].arg == code[i].arg && read[i].name == code[i].name);
+        }
+    }
+    BUF_FREE(read);
+    lex_collect_diags = true;
+    assert(vm_read("gen_tests", "// comment\n  push local 1 // trailing\n\nadd\r\n", &read) && BUF_LEN(read) == 2);
+    assert(!vm_read("gen_tests", "push local\n", &read));
+    assert(!vm_read("gen_tests", "push constant 1 2\n", &read));
+    assert(!vm_read("gen_tests", "\njump 3\n", &read) && lex_diags[2].line == 2);
+    lex_collect_diags = false;
+    for (LexDiag* it = lex_diags; it != BUF_END(lex_diags); it++) {
+        free(it->msg);
+    }
+    BUF_FREE(lex_diags);
+    BUF_FREE(read);
+
+    BUF_FREE(w.mem);
+    BUF_FREE(code);
+    strength_tests();
+}
+
+//*runs the straight line code of a reduced multiplication, enough of the VM for push/pop/add/neg
+Internal i16 eval_mul_chain(VmInst* code, i16 x) {
+    i16 stack[16];
+    i16 temps[8] = { 0 };
+    size_t sp = 0;
+    for (VmInst* it = code; it != BUF_END(code); it++) {
+        switch (it->op) {
+            case VM_PUSH: {
+                assert(sp < 16);
+                stack[sp++] = it->seg == SEG_CONSTANT ? (i16)it->arg : it->seg == SEG_LOCAL ? x : temps[it->arg];
+                break;
+            }
+            case VM_POP: {
+                assert(it->seg == SEG_TEMP);
+                temps[it->arg] = stack[--sp];
+                break;
+            }
+            case VM_ADD: {
+                sp--;
+                stack[sp - 1] = (i16)(stack[sp - 1] + stack[sp]);
+                break;
+            }
+            case VM_NEG: {
+                stack[sp - 1] = (i16)-stack[sp - 1];
+                break;
+            }
+            default: {
+                assert(0);
+            }
+        }
+    }
+    assert(sp == 1);
+    return stack[0];
+}
+
+Internal void strength_tests(void) {
+    init_gen();
+    SrcPos pos = { "strength_tests", 1 };
+    const char* x_name = str_intern("x");
+    Type int_type = { TYPE_INT, int_keyword };
+    Gen gen = { 0 };
+    sym_put(&gen.sub_scope, (Sym) { x_name, &int_type, SYM_LOCAL, 0 });
+
+    Expr* x = expr_name(pos, x_name);
+    Expr* operands[] = { x, expr_paren(pos, x) };
+    for (size_t op = 0; op < 2; op++) {
+        for (i32 c = -300; c <= 300; c++) {
+            Expr* konst = c < 0 ? expr_unary(pos, TOKEN_NEG, expr_int(pos, -c)) : expr_int(pos, c);
+            Expr* mul = expr_binary(pos, TOKEN_MUL, op ? konst : operands[0], op ? operands[1] : konst);
+            BUF_CLEAR(gen.code);
+            gen_expr(&gen, mul);
+            bool reduced = true;
+            for (VmInst* it = gen.code; it != BUF_END(gen.code); it++) {
+                reduced &= it->op != VM_CALL;
+            }
+            if (!reduced) {
+                assert(mul_chain_cost(c < 0 ? -c : c, op) > MUL_CHAIN_MAX);
+                continue;
+            }
+            for (i32 val = -40; val <= 40; val += 7) {
+                assert(eval_mul_chain(gen.code, (i16)val) == (i16)(val * c));
+            }
+        }
+    }
+    //*powers of two up to 16 always reduce
+    BUF_CLEAR(gen.code);
+    gen_expr(&gen, expr_binary(pos, TOKEN_MUL, x, expr_int(pos, 16)));
+    assert(BUF_LEN(gen.code) <= MUL_CHAIN_MAX && eval_mul_chain(gen.code, 3) == 48);
+    BUF_FREE(gen.code);
+    sym_free(&gen.sub_scope);
+}
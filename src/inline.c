@@ -0,0 +1,244 @@
+//*Inlining of small leaf subroutines on the VM code. A callee qualifies when its body is straight line
+//*code ending in its only `return`, calls nothing and is at most `budget` instructions long, which
+//*covers getters, setters and small arithmetic helpers. The call site pops the arguments into temp
+//*3..7, the callee's locals start at 0 behind them, and the body runs with its segments remapped:
+//*    argument i -> temp 3+i, local i -> temp 3+num_args+i
+//*    this -> that, pointer 0 -> pointer 1 so the caller's THIS survives
+//*The return value is simply left on the stack. Code generation only keeps values in temp 0..2 and in
+//*pointer 1 within a single statement, never across a call, so the inlined body is free to use them.
+//*Statics belong to the file they are declared in, a callee using them is only inlined into its class.
+//*A callee that uses temp 3..7 itself, which only hand written .vm code does, is not inlined.
+
+#define INLINE_DEFAULT_BUDGET 8
+#define INLINE_FIRST_TEMP 3
+#define INLINE_NUM_TEMPS 5
+
+typedef struct InlineStats {
+    size_t sites;
+    size_t insts_before;
+    size_t insts_after;
+} InlineStats;
+
+InlineStats inline_stats;
+
+typedef struct InlineCallee {
+    size_t program;
+    //*without the `function` and the final `return`
+    const VmInst* body;
+    size_t len;
+    i32 num_locals;
+    bool uses_static;
+} InlineCallee;
+
+//*`code[start]` is a `function`, `end` is where the next one starts
+Internal bool inline_candidate(const VmInst* code, size_t start, size_t end, size_t budget) {
+    if (end - start < 2 || end - start - 2 > budget || code[end - 1].op != VM_RETURN) {
+        return false;
+    }
+    bool uses_this = false;
+    bool uses_that = false;
+    for (const VmInst* inst = code + start + 1; inst != code + end - 1; inst++) {
+        switch (inst->op) {
+            case VM_PUSH:
+            case VM_POP: {
+                //*hand written code may keep values in the temps the arguments and locals move to
+                if (inst->seg == SEG_TEMP && inst->arg >= INLINE_FIRST_TEMP) {
+                    return false;
+                }
+                uses_this |= inst->seg == SEG_THIS || (inst->seg == SEG_POINTER && inst->arg == 0);
+                uses_that |= inst->seg == SEG_THAT || (inst->seg == SEG_POINTER && inst->arg == 1);
+                break;
+            }
+            case VM_LABEL:
+            case VM_GOTO:
+            case VM_IF_GOTO:
+            case VM_FUNCTION:
+            case VM_CALL:
+            case VM_RETURN: {
+                return false;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+    return !(uses_this && uses_that);
+}
+
+Internal bool inline_uses_arg(const InlineCallee* callee, size_t from, i32 arg) {
+    for (size_t i = from; i < callee->len; i++) {
+        const VmInst* inst = &callee->body[i];
+        if ((inst->op == VM_PUSH || inst->op == VM_POP) && inst->seg == SEG_ARGUMENT && inst->arg == arg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Internal void inline_call(VmInst** out, const InlineCallee* callee, i32 num_args) {
+    //*a body starting with `push argument n-1` finds that argument on top of the stack already
+    size_t skip = 0;
+    if (num_args && callee->len) {
+        const VmInst* first = &callee->body[0];
+        if (first->op == VM_PUSH && first->seg == SEG_ARGUMENT && first->arg == num_args - 1 && !inline_uses_arg(callee, 1, first->arg)) {
+            skip = 1;
+        }
+    }
+    for (i32 i = num_args - 1 - (i32)skip; i >= 0; i--) {
+        BUF_PUSH(*out, (VmInst) { VM_POP, SEG_TEMP, INLINE_FIRST_TEMP + i, NULL });
+    }
+    for (i32 i = 0; i < callee->num_locals; i++) {
+        BUF_PUSH(*out, (VmInst) { VM_PUSH, SEG_CONSTANT, 0, NULL });
+        BUF_PUSH(*out, (VmInst) { VM_POP, SEG_TEMP, INLINE_FIRST_TEMP + num_args + i, NULL });
+    }
+    for (size_t i = skip; i < callee->len; i++) {
+        VmInst inst = callee->body[i];
+        if (inst.op == VM_PUSH || inst.op == VM_POP) {
+            switch (inst.seg) {
+                case SEG_ARGUMENT: inst.seg = SEG_TEMP; inst.arg += INLINE_FIRST_TEMP; break;
+                case SEG_LOCAL: inst.seg = SEG_TEMP; inst.arg += INLINE_FIRST_TEMP + num_args; break;
+                case SEG_THIS: inst.seg = SEG_THAT; break;
+                case SEG_POINTER: inst.arg = 1; break;
+                default: break;
+            }
+        }
+        BUF_PUSH(*out, inst);
+    }
+}
+
+//*Inlines calls between the given classes, one VM code buffer each. Only the first `num_targets` are
+//*rewritten, the ones behind them are library code that is inlined from but left as it was read.
+//*Callees stay in place, whole program mode drops the ones no longer called afterwards.
+Internal void vm_inline_program(VmInst** programs[], size_t num_programs, size_t num_targets, size_t budget) {
+    InlineCallee* callees = NULL;
+    NameIndex callee_index = { 0 };
+    for (size_t p = 0; p < num_programs; p++) {
+        VmInst* code = *programs[p];
+        inline_stats.insts_before += BUF_LEN(code);
+        for (size_t start = 0; start < BUF_LEN(code);) {
+            size_t end = start + 1;
+            while (end < BUF_LEN(code) && code[end].op != VM_FUNCTION) {
+                end++;
+            }
+            if (code[start].op == VM_FUNCTION && inline_candidate(code, start, end, budget)) {
+                InlineCallee callee = { p, code + start + 1, end - start - 2, code[start].arg, false };
+                for (size_t i = 0; i < callee.len; i++) {
+                    callee.uses_static |= (callee.body[i].op == VM_PUSH || callee.body[i].op == VM_POP) && callee.body[i].seg == SEG_STATIC;
+                }
+                name_index_put(&callee_index, code[start].name, (u32)BUF_LEN(callees));
+                BUF_PUSH(callees, callee);
+            }
+            start = end;
+        }
+    }
+
+    //*callees point into the old code, which is only freed once every class is rewritten
+    VmInst** old_code = NULL;
+    for (size_t p = 0; p < num_targets; p++) {
+        VmInst* code = *programs[p];
+        VmInst* out = NULL;
+        size_t sites = inline_stats.sites;
+        for (size_t i = 0; i < BUF_LEN(code); i++) {
+            u32* index = code[i].op == VM_CALL ? name_index_get(&callee_index, code[i].name) : NULL;
+            InlineCallee* callee = index ? &callees[*index] : NULL;
+            if (callee && (!callee->uses_static || callee->program == p) && code[i].arg + callee->num_locals <= INLINE_NUM_TEMPS) {
+                inline_call(&out, callee, code[i].arg);
+                inline_stats.sites++;
+            }
+            else {
+                BUF_PUSH(out, code[i]);
+            }
+        }
+        BUF_PUSH(old_code, code);
+        if (inline_stats.sites != sites) {
+            vm_optimize(&out);
+        }
+        inline_stats.insts_after += BUF_LEN(out);
+        *programs[p] = out;
+    }
+
+    for (size_t i = 0; i < BUF_LEN(old_code); i++) {
+        BUF_FREE(old_code[i]);
+    }
+    BUF_FREE(old_code);
+    BUF_FREE(callees);
+    name_index_free(&callee_index);
+}
+
+Internal void inline_tests(void) {
+    init_keywords();
+    init_stream("inline_tests", "class I { field int size; static int n; method int getSize() { return size; } method void setSize(int s) { let size = s; return; } function int twice(int x) { var int y; let y = x + x; return y; } function int count() { let n = n + 1; return n; } method void run() { do setSize(getSize() + I.twice(3)); return; } }");
+    VmInst* code = gen_class(parse_class());
+    VmInst** programs[] = { &code };
+    inline_stats = (InlineStats) { 0 };
+    vm_inline_program(programs, 1, 1, INLINE_DEFAULT_BUDGET);
+    assert(inline_stats.sites == 3);
+
+    char* text = vm_text(code);
+    const char* run = strstr(text, "function I.run 0\n");
+    assert(run);
+    const char* expected =
+        "function I.run 0\npush argument 0\npop pointer 0\n"
+        //*setSize(...) keeps the receiver on the stack below its argument
+        "push pointer 0\n"
+        //*getSize() takes its receiver straight off the stack
+        "push pointer 0\npop pointer 1\npush that 0\n"
+        //*twice(3) with its argument in temp 3 and its local in temp 4
+        "push constant 3\npop temp 3\npush constant 0\npop temp 4\npush temp 3\npush temp 3\nadd\npop temp 4\npush temp 4\n"
+        "add\npop temp 4\npop temp 3\npush temp 3\npop pointer 1\npush temp 4\npop that 0\npush constant 0\npop temp 0\n"
+        "push constant 0\nreturn\n";
+    assert(strcmp(run, expected) == 0);
+    BUF_FREE(text);
+    BUF_FREE(code);
+
+    //*across classes, a budget of one instruction rules out both callees
+    init_stream("inline_tests", "class J { method int get() { return 1; } function int f() { return 2 + 3; } }");
+    code = gen_class(parse_class());
+    VmInst* calls = NULL;
+    init_stream("inline_tests", "class K { function void g(J j) { do j.get(); do J.f(); return; } }");
+    calls = gen_class(parse_class());
+    VmInst** both[] = { &code, &calls };
+    inline_stats = (InlineStats) { 0 };
+    vm_inline_program(both, 2, 2, 1);
+    assert(inline_stats.sites == 0);
+    vm_inline_program(both, 2, 2, INLINE_DEFAULT_BUDGET);
+    assert(inline_stats.sites == 2);
+    text = vm_text(calls);
+    assert(strcmp(text, "function K.g 0\npush argument 0\npop pointer 1\npush constant 1\npop temp 0\npush constant 5\npop temp 0\npush constant 0\nreturn\n") == 0);
+    BUF_FREE(text);
+    BUF_FREE(code);
+    BUF_FREE(calls);
+
+    //*a library read from a .vm file is inlined from but not rewritten, even where it calls itself
+    const char* lib = "function L.one 0\npush constant 1\nreturn\nfunction L.run 0\nlabel A\ncall L.one 0\nnot\nif-goto B\ngoto A\nlabel B\n"
+        "label C\npush constant 0\nnot\nif-goto D\ngoto C\nlabel D\npush constant 0\nreturn\n";
+    VmInst* lib_code = NULL;
+    assert(vm_read("inline_tests", lib, &lib_code));
+    VmInst* read = lib_code;
+    init_stream("inline_tests", "class M { function int f() { return L.one() + 2; } }");
+    calls = gen_class(parse_class());
+    VmInst** with_lib[] = { &calls, &lib_code };
+    inline_stats = (InlineStats) { 0 };
+    vm_inline_program(with_lib, 2, 1, INLINE_DEFAULT_BUDGET);
+    assert(inline_stats.sites == 1 && lib_code == read);
+    text = vm_text(lib_code);
+    assert(strcmp(text, lib) == 0);
+    BUF_FREE(text);
+    text = vm_text(calls);
+    assert(strcmp(text, "function M.f 0\npush constant 3\nreturn\n") == 0);
+    BUF_FREE(text);
+    BUF_FREE(calls);
+    BUF_FREE(lib_code);
+
+    //*a callee keeping a value in temp 3 would overwrite its own second argument
+    lib = "function L.sub 0\npush argument 1\npop temp 3\npush argument 0\npush temp 3\nsub\nreturn\n";
+    lib_code = NULL;
+    assert(vm_read("inline_tests", lib, &lib_code));
+    init_stream("inline_tests", "class M { function int f() { return L.sub(7, 3); } }");
+    calls = gen_class(parse_class());
+    inline_stats = (InlineStats) { 0 };
+    vm_inline_program(with_lib, 2, 1, INLINE_DEFAULT_BUDGET);
+    assert(inline_stats.sites == 0);
+    BUF_FREE(calls);
+    BUF_FREE(lib_code);
+}
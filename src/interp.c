@@ -0,0 +1,875 @@
+//*VM interpreter for measuring generated code: `main --run` compiles the program and executes it
+//*headless, then reports the instructions executed and the calls and instructions per function.
+//*
+//*The VM code is decoded once into InterpInst, with segments resolved to their own opcodes, statics to
+//*RAM addresses, labels to instruction indices and calls to function indices. The loop dispatches
+//*through a table of label addresses where the compiler has computed goto and through a switch
+//*otherwise. Memory is the 32K words of the Hack RAM laid out as usual, stack from 256, heap from
+//*2048, statics from 16, so programs that poke memory or treat objects as arrays behave as on the
+//*real platform. Frames live outside RAM and SP, LCL and ARG are kept in locals.
+//*
+//*The OS classes are C stubs, used for every OS function the program does not define itself. Output
+//*is collected as text, Screen draws nothing and Keyboard reads from an optional input script. Sys.error
+//*and the OS error conditions stop the run with the OS error code.
+
+#define INTERP_STACK_START 256
+#define INTERP_HEAP_START 2048
+#define INTERP_HEAP_END 16384
+#define INTERP_STATIC_START 16
+#define INTERP_RAM_SIZE 32768
+//*programs waiting on the keyboard never end on their own
+#define INTERP_DEFAULT_LIMIT 100000000
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERP_THREADED 1
+#else
+#define INTERP_THREADED 0
+#endif
+
+typedef enum InterpOp {
+    I_PUSH_CONSTANT,
+    I_PUSH_LOCAL,
+    I_PUSH_ARGUMENT,
+    I_PUSH_THIS,
+    I_PUSH_THAT,
+    //*static, temp and pointer, resolved to an absolute address
+    I_PUSH_RAM,
+    I_POP_LOCAL,
+    I_POP_ARGUMENT,
+    I_POP_THIS,
+    I_POP_THAT,
+    I_POP_RAM,
+    I_ADD,
+    I_SUB,
+    I_NEG,
+    I_EQ,
+    I_GT,
+    I_LT,
+    I_AND,
+    I_OR,
+    I_NOT,
+    I_GOTO,
+    I_IF_GOTO,
+    I_FUNCTION,
+    I_CALL,
+    I_RETURN,
+    I_HALT,
+    NUM_INTERP_OPS,
+} InterpOp;
+
+typedef struct InterpInst {
+    InterpOp op;
+    i32 arg;
+    //*jump target, or the index of the called function
+    u32 target;
+} InterpInst;
+
+typedef struct Interp Interp;
+typedef i16 (*InterpNative)(Interp* in, i16* args);
+
+typedef struct InterpFunc {
+    const char* name;
+    u32 entry;
+    InterpNative native;
+    u64 calls;
+    u64 insts;
+} InterpFunc;
+
+typedef struct InterpFrame {
+    u32 ret;
+    u32 func;
+    i32 lcl;
+    i32 arg;
+    //*the caller's THIS and THAT, RAM[3] and RAM[4]
+    i16 this_ptr;
+    i16 that_ptr;
+} InterpFrame;
+
+typedef struct Interp {
+    InterpInst* code;
+    InterpFunc* funcs;
+    i16* ram;
+    char* output;
+    const char* input;
+    i32 free_list;
+    u64 executed;
+    u64 limit;
+    //*set by natives to stop the run, error holds the OS error code
+    bool halted;
+    i32 error;
+} Interp;
+
+Internal void interp_halt(Interp* in) {
+    in->halted = true;
+}
+
+//*what Sys.error does on the real platform, print the code and stop
+Internal void interp_error(Interp* in, i32 error) {
+    BUF_PRINTF(in->output, "ERR%d", error);
+    in->halted = true;
+    in->error = error;
+}
+
+Internal i16* interp_at(Interp* in, i32 addr) {
+    return &in->ram[addr & (INTERP_RAM_SIZE - 1)];
+}
+
+//*First fit over a list of free segments, [size including header, next]. A block keeps its size in
+//*the word before it so Memory.deAlloc can give it back.
+Internal i16 interp_alloc(Interp* in, i32 size) {
+    if (size <= 0) {
+        interp_error(in, 5);
+        return 0;
+    }
+    i32 total = size + 1;
+    for (i32 seg = in->free_list; seg; seg = *interp_at(in, seg + 1)) {
+        i32 seg_size = *interp_at(in, seg);
+        if (seg_size >= total + 2) {
+            *interp_at(in, seg) = (i16)(seg_size - total);
+            i32 block = seg + seg_size - total + 1;
+            *interp_at(in, block - 1) = (i16)total;
+            return (i16)block;
+        }
+    }
+    interp_error(in, 6);
+    return 0;
+}
+
+Internal void interp_free(Interp* in, i32 block) {
+    i32 seg = block - 1;
+    if (*interp_at(in, seg) >= 2) {
+        *interp_at(in, seg + 1) = (i16)in->free_list;
+        in->free_list = seg;
+    }
+}
+
+Internal i16 native_math_init(Interp* in, i16* args) { (void)in; (void)args; return 0; }
+Internal i16 native_math_abs(Interp* in, i16* args) { (void)in; return (i16)(args[0] < 0 ? -args[0] : args[0]); }
+Internal i16 native_math_multiply(Interp* in, i16* args) { (void)in; return (i16)(args[0] * args[1]); }
+Internal i16 native_math_min(Interp* in, i16* args) { (void)in; return args[0] < args[1] ? args[0] : args[1]; }
+Internal i16 native_math_max(Interp* in, i16* args) { (void)in; return MAX(args[0], args[1]); }
+
+Internal i16 native_math_divide(Interp* in, i16* args) {
+    if (!args[1]) {
+        interp_error(in, 3);
+        return 0;
+    }
+    return (i16)(args[0] / args[1]);
+}
+
+Internal i16 native_math_sqrt(Interp* in, i16* args) {
+    if (args[0] < 0) {
+        interp_error(in, 4);
+        return 0;
+    }
+    i32 root = 0;
+    for (i32 bit = 7; bit >= 0; bit--) {
+        i32 next = root | (1 << bit);
+        if (next * next <= args[0]) {
+            root = next;
+        }
+    }
+    return (i16)root;
+}
+
+Internal i16 native_memory_peek(Interp* in, i16* args) { return *interp_at(in, args[0]); }
+Internal i16 native_memory_poke(Interp* in, i16* args) { *interp_at(in, args[0]) = args[1]; return 0; }
+Internal i16 native_memory_alloc(Interp* in, i16* args) { return interp_alloc(in, args[0]); }
+Internal i16 native_memory_dealloc(Interp* in, i16* args) { interp_free(in, args[0]); return 0; }
+
+Internal i16 native_array_new(Interp* in, i16* args) {
+    if (args[0] <= 0) {
+        interp_error(in, 2);
+        return 0;
+    }
+    return interp_alloc(in, args[0]);
+}
+
+//*Strings are [max length, length, chars...]
+Internal i16 interp_string_new(Interp* in, i32 max_len) {
+    i16 str = interp_alloc(in, 2 + max_len);
+    *interp_at(in, str) = (i16)max_len;
+    *interp_at(in, str + 1) = 0;
+    return str;
+}
+
+Internal i16 native_string_new(Interp* in, i16* args) {
+    if (args[0] < 0) {
+        interp_error(in, 14);
+        return 0;
+    }
+    return interp_string_new(in, args[0]);
+}
+
+Internal i16 native_string_length(Interp* in, i16* args) { return *interp_at(in, args[0] + 1); }
+Internal i16 native_string_new_line(Interp* in, i16* args) { (void)in; (void)args; return 128; }
+Internal i16 native_string_back_space(Interp* in, i16* args) { (void)in; (void)args; return 129; }
+Internal i16 native_string_double_quote(Interp* in, i16* args) { (void)in; (void)args; return 34; }
+
+Internal i16 native_string_char_at(Interp* in, i16* args) {
+    if (args[1] < 0 || args[1] >= *interp_at(in, args[0] + 1)) {
+        interp_error(in, 15);
+        return 0;
+    }
+    return *interp_at(in, args[0] + 2 + args[1]);
+}
+
+Internal i16 native_string_set_char_at(Interp* in, i16* args) {
+    if (args[1] < 0 || args[1] >= *interp_at(in, args[0] + 1)) {
+        interp_error(in, 16);
+        return 0;
+    }
+    *interp_at(in, args[0] + 2 + args[1]) = args[2];
+    return 0;
+}
+
+Internal i16 native_string_append_char(Interp* in, i16* args) {
+    i16 len = *interp_at(in, args[0] + 1);
+    if (len >= *interp_at(in, args[0])) {
+        interp_error(in, 17);
+        return args[0];
+    }
+    *interp_at(in, args[0] + 2 + len) = args[1];
+    *interp_at(in, args[0] + 1) = (i16)(len + 1);
+    return args[0];
+}
+
+Internal i16 native_string_erase_last_char(Interp* in, i16* args) {
+    i16 len = *interp_at(in, args[0] + 1);
+    if (!len) {
+        interp_error(in, 18);
+        return 0;
+    }
+    *interp_at(in, args[0] + 1) = (i16)(len - 1);
+    return 0;
+}
+
+Internal i16 native_string_int_value(Interp* in, i16* args) {
+    i16 len = *interp_at(in, args[0] + 1);
+    i32 val = 0;
+    bool neg = len && *interp_at(in, args[0] + 2) == '-';
+    for (i32 i = neg; i < len; i++) {
+        i16 c = *interp_at(in, args[0] + 2 + i);
+        if (c < '0' || c > '9') {
+            break;
+        }
+        val = val * 10 + c - '0';
+    }
+    return (i16)(neg ? -val : val);
+}
+
+Internal i16 native_string_set_int(Interp* in, i16* args) {
+    char digits[8];
+    int len = snprintf(digits, sizeof(digits), "%d", args[1]);
+    if (len > *interp_at(in, args[0])) {
+        interp_error(in, 19);
+        return 0;
+    }
+    for (int i = 0; i < len; i++) {
+        *interp_at(in, args[0] + 2 + i) = digits[i];
+    }
+    *interp_at(in, args[0] + 1) = (i16)len;
+    return 0;
+}
+
+Internal i16 native_string_dispose(Interp* in, i16* args) { interp_free(in, args[0]); return 0; }
+
+Internal void interp_print_char(Interp* in, i16 c) {
+    if (c == 128) {
+        BUF_PUSH(in->output, '\n');
+    }
+    else if (c == 129) {
+        if (BUF_LEN(in->output) && in->output[BUF_LEN(in->output) - 1] != '\n') {
+            _BUF_HDR(in->output)->len--;
+        }
+    }
+    else {
+        BUF_PUSH(in->output, (char)c);
+    }
+}
+
+Internal void interp_print_string(Interp* in, i16 str) {
+    i16 len = *interp_at(in, str + 1);
+    for (i32 i = 0; i < len; i++) {
+        interp_print_char(in, *interp_at(in, str + 2 + i));
+    }
+}
+
+Internal i16 native_output_init(Interp* in, i16* args) { (void)in; (void)args; return 0; }
+Internal i16 native_output_move_cursor(Interp* in, i16* args) { (void)in; (void)args; return 0; }
+Internal i16 native_output_print_char(Interp* in, i16* args) { interp_print_char(in, args[0]); return 0; }
+Internal i16 native_output_print_string(Interp* in, i16* args) { interp_print_string(in, args[0]); return 0; }
+Internal i16 native_output_println(Interp* in, i16* args) { (void)args; interp_print_char(in, 128); return 0; }
+Internal i16 native_output_back_space(Interp* in, i16* args) { (void)args; interp_print_char(in, 129); return 0; }
+
+Internal i16 native_output_print_int(Interp* in, i16* args) {
+    BUF_PRINTF(in->output, "%d", args[0]);
+    return 0;
+}
+
+Internal i16 native_screen_nop(Interp* in, i16* args) { (void)in; (void)args; return 0; }
+
+//*the next character of the input script, 0 once it runs out
+Internal i16 interp_read_char(Interp* in) {
+    if (!in->input || !*in->input) {
+        return 0;
+    }
+    return (i16)(u8)*in->input++;
+}
+
+Internal i16 native_keyboard_key_pressed(Interp* in, i16* args) {
+    (void)args;
+    i16 c = interp_read_char(in);
+    return c == '\n' ? 128 : c;
+}
+
+Internal i16 native_keyboard_read_char(Interp* in, i16* args) {
+    (void)args;
+    i16 c = interp_read_char(in);
+    c = c == '\n' ? 128 : c;
+    interp_print_char(in, c);
+    return c;
+}
+
+//*prints the prompt and returns the rest of the input line as a new String
+Internal i16 native_keyboard_read_line(Interp* in, i16* args) {
+    interp_print_string(in, args[0]);
+    const char* start = in->input ? in->input : "";
+    const char* end = start;
+    while (*end && *end != '\n') {
+        end++;
+    }
+    i16 str = interp_string_new(in, (i32)(end - start));
+    for (const char* c = start; c != end; c++) {
+        i16 char_args[] = { str, (i16)(u8)*c };
+        native_string_append_char(in, char_args);
+        interp_print_char(in, char_args[1]);
+    }
+    interp_print_char(in, 128);
+    in->input = *end ? end + 1 : end;
+    return str;
+}
+
+Internal i16 native_keyboard_read_int(Interp* in, i16* args) {
+    i16 str = native_keyboard_read_line(in, args);
+    i16 val = native_string_int_value(in, &str);
+    interp_free(in, str);
+    return val;
+}
+
+Internal i16 native_sys_halt(Interp* in, i16* args) { (void)args; interp_halt(in); return 0; }
+Internal i16 native_sys_wait(Interp* in, i16* args) { (void)in; (void)args; return 0; }
+
+Internal i16 native_sys_error(Interp* in, i16* args) {
+    interp_error(in, args[0]);
+    return 0;
+}
+
+typedef struct InterpNativeDef {
+    const char* name;
+    InterpNative fn;
+} InterpNativeDef;
+
+InterpNativeDef interp_natives[] = {
+    { "Math.init", native_math_init },
+    { "Math.abs", native_math_abs },
+    { "Math.multiply", native_math_multiply },
+    { "Math.divide", native_math_divide },
+    { "Math.min", native_math_min },
+    { "Math.max", native_math_max },
+    { "Math.sqrt", native_math_sqrt },
+    { "Memory.init", native_math_init },
+    { "Memory.peek", native_memory_peek },
+    { "Memory.poke", native_memory_poke },
+    { "Memory.alloc", native_memory_alloc },
+    { "Memory.deAlloc", native_memory_dealloc },
+    { "Array.new", native_array_new },
+    { "Array.dispose", native_memory_dealloc },
+    { "String.new", native_string_new },
+    { "String.dispose", native_string_dispose },
+    { "String.length", native_string_length },
+    { "String.charAt", native_string_char_at },
+    { "String.setCharAt", native_string_set_char_at },
+    { "String.appendChar", native_string_append_char },
+    { "String.eraseLastChar", native_string_erase_last_char },
+    { "String.intValue", native_string_int_value },
+    { "String.setInt", native_string_set_int },
+    { "String.backSpace", native_string_back_space },
+    { "String.doubleQuote", native_string_double_quote },
+    { "String.newLine", native_string_new_line },
+    { "Output.init", native_output_init },
+    { "Output.moveCursor", native_output_move_cursor },
+    { "Output.printChar", native_output_print_char },
+    { "Output.printString", native_output_print_string },
+    { "Output.printInt", native_output_print_int },
+    { "Output.println", native_output_println },
+    { "Output.backSpace", native_output_back_space },
+    { "Screen.init", native_screen_nop },
+    { "Screen.clearScreen", native_screen_nop },
+    { "Screen.setColor", native_screen_nop },
+    { "Screen.drawPixel", native_screen_nop },
+    { "Screen.drawLine", native_screen_nop },
+    { "Screen.drawRectangle", native_screen_nop },
+    { "Screen.drawCircle", native_screen_nop },
+    { "Keyboard.init", native_screen_nop },
+    { "Keyboard.keyPressed", native_keyboard_key_pressed },
+    { "Keyboard.readChar", native_keyboard_read_char },
+    { "Keyboard.readLine", native_keyboard_read_line },
+    { "Keyboard.readInt", native_keyboard_read_int },
+    { "Sys.init", native_screen_nop },
+    { "Sys.halt", native_sys_halt },
+    { "Sys.error", native_sys_error },
+    { "Sys.wait", native_sys_wait },
+};
+
+//*index of the function `name`, falling back to the OS stubs, -1 when neither has it
+Internal i32 interp_func(Interp* in, NameIndex* index, const char* name) {
+    u32* found = name_index_get(index, name);
+    if (found) {
+        return (i32)*found;
+    }
+    for (size_t i = 0; i < sizeof(interp_natives) / sizeof(interp_natives[0]); i++) {
+        if (strcmp(interp_natives[i].name, name) == 0) {
+            name_index_put(index, name, (u32)BUF_LEN(in->funcs));
+            BUF_PUSH(in->funcs, (InterpFunc) { name, 0, interp_natives[i].fn, 0, 0 });
+            return (i32)BUF_LEN(in->funcs) - 1;
+        }
+    }
+    return -1;
+}
+
+typedef struct InterpFixup {
+    u32 pc;
+    const VmInst* label;
+} InterpFixup;
+
+//*Decodes the programs, `files` name the owners of their statics. Returns false after reporting the
+//*first problem, a call to a function that exists nowhere or too many statics for RAM 16..255.
+Internal bool interp_load(Interp* in, VmInst** programs[], const char** files, size_t num_programs, const char* entry) {
+    NameIndex index = { 0 };
+    for (size_t p = 0; p < num_programs; p++) {
+        VmInst* code = *programs[p];
+        for (size_t i = 0; i < BUF_LEN(code); i++) {
+            if (code[i].op == VM_FUNCTION) {
+                name_index_put(&index, code[i].name, (u32)BUF_LEN(in->funcs));
+                BUF_PUSH(in->funcs, (InterpFunc) { code[i].name, 0, NULL, 0, 0 });
+            }
+        }
+    }
+
+    bool ok = true;
+    i32 entry_func = interp_func(in, &index, entry);
+    BUF_PUSH(in->code, (InterpInst) { I_CALL, 0, (u32)entry_func });
+    BUF_PUSH(in->code, (InterpInst) { I_HALT, 0, 0 });
+    ok &= entry_func >= 0 && !in->funcs[entry_func].native;
+
+    i32 static_base = INTERP_STATIC_START;
+    InterpFixup* fixups = NULL;
+    const VmInst** labels = NULL;
+    u32* label_pcs = NULL;
+    for (size_t p = 0; p < num_programs && ok; p++) {
+        VmInst* code = *programs[p];
+        i32 num_statics = 0;
+        for (size_t i = 0; i < BUF_LEN(code) && ok; i++) {
+            const VmInst* vm = &code[i];
+            InterpInst inst = { I_HALT, vm->arg, 0 };
+            //*labels take no instruction of their own
+            bool emit = true;
+            switch (vm->op) {
+                case VM_PUSH:
+                case VM_POP: {
+                    LocalPersist const InterpOp push_ops[] = {
+                        [SEG_CONSTANT] = I_PUSH_CONSTANT, [SEG_LOCAL] = I_PUSH_LOCAL, [SEG_ARGUMENT] = I_PUSH_ARGUMENT,
+                        [SEG_THIS] = I_PUSH_THIS, [SEG_THAT] = I_PUSH_THAT, [SEG_STATIC] = I_PUSH_RAM, [SEG_TEMP] = I_PUSH_RAM,
+                        [SEG_POINTER] = I_PUSH_RAM,
+                    };
+                    LocalPersist const InterpOp pop_ops[] = {
+                        [SEG_CONSTANT] = I_HALT, [SEG_LOCAL] = I_POP_LOCAL, [SEG_ARGUMENT] = I_POP_ARGUMENT, [SEG_THIS] = I_POP_THIS,
+                        [SEG_THAT] = I_POP_THAT, [SEG_STATIC] = I_POP_RAM, [SEG_TEMP] = I_POP_RAM, [SEG_POINTER] = I_POP_RAM,
+                    };
+                    inst.op = vm->op == VM_PUSH ? push_ops[vm->seg] : pop_ops[vm->seg];
+                    if (vm->seg == SEG_STATIC) {
+                        inst.arg = static_base + vm->arg;
+                        num_statics = MAX(num_statics, vm->arg + 1);
+                    }
+                    else if (vm->seg == SEG_TEMP) {
+                        inst.arg = 5 + vm->arg;
+                    }
+                    else if (vm->seg == SEG_POINTER) {
+                        inst.arg = 3 + vm->arg;
+                    }
+                    break;
+                }
+                case VM_ADD: inst.op = I_ADD; break;
+                case VM_SUB: inst.op = I_SUB; break;
+                case VM_NEG: inst.op = I_NEG; break;
+                case VM_EQ: inst.op = I_EQ; break;
+                case VM_GT: inst.op = I_GT; break;
+                case VM_LT: inst.op = I_LT; break;
+                case VM_AND: inst.op = I_AND; break;
+                case VM_OR: inst.op = I_OR; break;
+                case VM_NOT: inst.op = I_NOT; break;
+                case VM_LABEL: {
+                    BUF_PUSH(labels, vm);
+                    BUF_PUSH(label_pcs, (u32)BUF_LEN(in->code));
+                    emit = false;
+                    break;
+                }
+                case VM_GOTO:
+                case VM_IF_GOTO: {
+                    inst.op = vm->op == VM_GOTO ? I_GOTO : I_IF_GOTO;
+                    BUF_PUSH(fixups, (InterpFixup) { (u32)BUF_LEN(in->code), vm });
+                    break;
+                }
+                case VM_FUNCTION: {
+                    inst.op = I_FUNCTION;
+                    in->funcs[*name_index_get(&index, vm->name)].entry = (u32)BUF_LEN(in->code);
+                    BUF_CLEAR(labels);
+                    BUF_CLEAR(label_pcs);
+                    break;
+                }
+                case VM_CALL: {
+                    i32 func = interp_func(in, &index, vm->name);
+                    if (func < 0) {
+                        printf("run: call to undefined function %s\n", vm->name);
+                        ok = false;
+                    }
+                    inst.op = I_CALL;
+                    inst.target = (u32)func;
+                    break;
+                }
+                case VM_RETURN: inst.op = I_RETURN; break;
+            }
+            if (emit) {
+                BUF_PUSH(in->code, inst);
+            }
+
+            //*labels are local to their function, its jumps are resolved once it ends
+            bool func_end = i + 1 == BUF_LEN(code) || code[i + 1].op == VM_FUNCTION;
+            for (InterpFixup* fix = fixups; func_end && fix != BUF_END(fixups); fix++) {
+                size_t l = 0;
+                while (l < BUF_LEN(labels) && !same_vm_label(labels[l], fix->label)) {
+                    l++;
+                }
+                if (l == BUF_LEN(labels)) {
+                    printf("run: undefined label %s in %s\n", fix->label->name, files[p]);
+                    ok = false;
+                    break;
+                }
+                in->code[fix->pc].target = label_pcs[l];
+            }
+            if (func_end) {
+                BUF_CLEAR(fixups);
+            }
+        }
+        static_base += num_statics;
+    }
+    //*a last function without a return, or a jump to a label at its very end, stops here
+    BUF_PUSH(in->code, (InterpInst) { I_HALT, 0, 0 });
+    if (static_base > INTERP_STACK_START) {
+        printf("run: %d statics do not fit in RAM 16..255\n", static_base - INTERP_STATIC_START);
+        ok = false;
+    }
+    BUF_FREE(fixups);
+    BUF_FREE(labels);
+    BUF_FREE(label_pcs);
+    name_index_free(&index);
+    return ok;
+}
+
+Internal void interp_free_all(Interp* in) {
+    BUF_FREE(in->code);
+    BUF_FREE(in->funcs);
+    BUF_FREE(in->output);
+    free(in->ram);
+    memset(in, 0, sizeof(*in));
+}
+
+//*Runs from the entry call at code[0] until it returns, the program stops or `limit` instructions
+//*are done. Returns false when the run stopped on an error.
+Internal bool interp_run(Interp* in) {
+    i16* ram = in->ram = xcalloc(INTERP_RAM_SIZE, sizeof(i16));
+    in->free_list = INTERP_HEAP_START;
+    ram[INTERP_HEAP_START] = INTERP_HEAP_END - INTERP_HEAP_START;
+    ram[INTERP_HEAP_START + 1] = 0;
+
+    InterpInst* code = in->code;
+    InterpFunc* funcs = in->funcs;
+    InterpFrame* frames = NULL;
+    i32 sp = INTERP_STACK_START;
+    i32 lcl = sp;
+    i32 arg = sp;
+    u32 pc = 0;
+    //*the entry call at code[0] is the one instruction not counted against a function
+    u32 func = code[0].target;
+    u64 executed = 0;
+    u64 mark = 1;
+    u64 limit = in->limit ? in->limit : UINT64_MAX;
+    const InterpInst* inst;
+
+#define THIS_AT(i) ram[(u16)(ram[3] + (i)) & (INTERP_RAM_SIZE - 1)]
+#define THAT_AT(i) ram[(u16)(ram[4] + (i)) & (INTERP_RAM_SIZE - 1)]
+#define BINARY(expr) sp--; ram[sp - 1] = (i16)(expr); NEXT()
+#define COMPARE(cmp) sp--; ram[sp - 1] = (i16)(ram[sp - 1] cmp ram[sp] ? -1 : 0); NEXT()
+
+#if INTERP_THREADED
+    LocalPersist void* dispatch[NUM_INTERP_OPS] = {
+        &&L_I_PUSH_CONSTANT, &&L_I_PUSH_LOCAL, &&L_I_PUSH_ARGUMENT, &&L_I_PUSH_THIS, &&L_I_PUSH_THAT, &&L_I_PUSH_RAM,
+        &&L_I_POP_LOCAL, &&L_I_POP_ARGUMENT, &&L_I_POP_THIS, &&L_I_POP_THAT, &&L_I_POP_RAM,
+        &&L_I_ADD, &&L_I_SUB, &&L_I_NEG, &&L_I_EQ, &&L_I_GT, &&L_I_LT, &&L_I_AND, &&L_I_OR, &&L_I_NOT,
+        &&L_I_GOTO, &&L_I_IF_GOTO, &&L_I_FUNCTION, &&L_I_CALL, &&L_I_RETURN, &&L_I_HALT,
+    };
+#define OP(op) L_##op
+#define NEXT() do { inst = &code[pc++]; executed++; goto *dispatch[inst->op]; } while (0)
+    NEXT();
+#else
+#define OP(op) case op
+#define NEXT() break
+    for (;;) {
+        inst = &code[pc++];
+        executed++;
+        switch (inst->op) {
+#endif
+        OP(I_PUSH_CONSTANT): ram[sp++] = (i16)inst->arg; NEXT();
+        OP(I_PUSH_LOCAL): ram[sp++] = ram[lcl + inst->arg]; NEXT();
+        OP(I_PUSH_ARGUMENT): ram[sp++] = ram[arg + inst->arg]; NEXT();
+        OP(I_PUSH_THIS): ram[sp++] = THIS_AT(inst->arg); NEXT();
+        OP(I_PUSH_THAT): ram[sp++] = THAT_AT(inst->arg); NEXT();
+        OP(I_PUSH_RAM): ram[sp++] = ram[inst->arg]; NEXT();
+        OP(I_POP_LOCAL): ram[lcl + inst->arg] = ram[--sp]; NEXT();
+        OP(I_POP_ARGUMENT): ram[arg + inst->arg] = ram[--sp]; NEXT();
+        OP(I_POP_THIS): THIS_AT(inst->arg) = ram[--sp]; NEXT();
+        OP(I_POP_THAT): THAT_AT(inst->arg) = ram[--sp]; NEXT();
+        OP(I_POP_RAM): ram[inst->arg] = ram[--sp]; NEXT();
+        OP(I_ADD): BINARY(ram[sp - 1] + ram[sp]);
+        OP(I_SUB): BINARY(ram[sp - 1] - ram[sp]);
+        OP(I_AND): BINARY(ram[sp - 1] & ram[sp]);
+        OP(I_OR): BINARY(ram[sp - 1] | ram[sp]);
+        OP(I_EQ): COMPARE(==);
+        OP(I_GT): COMPARE(>);
+        OP(I_LT): COMPARE(<);
+        OP(I_NEG): ram[sp - 1] = (i16)-ram[sp - 1]; NEXT();
+        OP(I_NOT): ram[sp - 1] = (i16)~ram[sp - 1]; NEXT();
+        OP(I_GOTO): {
+            pc = inst->target;
+            if (executed >= limit) {
+                goto halt;
+            }
+            NEXT();
+        }
+        OP(I_IF_GOTO): {
+            if (ram[--sp]) {
+                pc = inst->target;
+                if (executed >= limit) {
+                    goto halt;
+                }
+            }
+            NEXT();
+        }
+        OP(I_FUNCTION): {
+            if (sp + inst->arg >= INTERP_HEAP_START) {
+                BUF_PRINTF(in->output, "<stack overflow>");
+                interp_halt(in);
+                in->error = -1;
+                goto halt;
+            }
+            for (i32 i = 0; i < inst->arg; i++) {
+                ram[sp++] = 0;
+            }
+            NEXT();
+        }
+        OP(I_CALL): {
+            InterpFunc* callee = &funcs[inst->target];
+            callee->calls++;
+            if (callee->native) {
+                i16 result = callee->native(in, &ram[sp - inst->arg]);
+                sp -= inst->arg;
+                ram[sp++] = result;
+                if (in->halted) {
+                    goto halt;
+                }
+                NEXT();
+            }
+            funcs[func].insts += executed - mark;
+            mark = executed;
+            BUF_PUSH(frames, (InterpFrame) { pc, func, lcl, arg, ram[3], ram[4] });
+            arg = sp - inst->arg;
+            lcl = sp;
+            func = inst->target;
+            pc = callee->entry;
+            if (executed >= limit) {
+                goto halt;
+            }
+            NEXT();
+        }
+        OP(I_RETURN): {
+            InterpFrame frame = frames[--_BUF_HDR(frames)->len];
+            ram[arg] = ram[sp - 1];
+            sp = arg + 1;
+            funcs[func].insts += executed - mark;
+            mark = executed;
+            pc = frame.ret;
+            func = frame.func;
+            lcl = frame.lcl;
+            arg = frame.arg;
+            ram[3] = frame.this_ptr;
+            ram[4] = frame.that_ptr;
+            NEXT();
+        }
+        OP(I_HALT): {
+            goto halt;
+        }
+#if !INTERP_THREADED
+        }
+    }
+#endif
+halt:
+#undef OP
+#undef NEXT
+#undef BINARY
+#undef COMPARE
+#undef THIS_AT
+#undef THAT_AT
+    funcs[func].insts += executed - mark;
+    in->executed = executed;
+    if (executed >= limit && !in->halted) {
+        interp_halt(in);
+    }
+    BUF_FREE(frames);
+    return !in->error;
+}
+
+Internal int interp_cmp_insts(const void* a, const void* b) {
+    const InterpFunc* fa = a;
+    const InterpFunc* fb = b;
+    return fa->insts != fb->insts ? (fa->insts < fb->insts ? 1 : -1) : (fa->calls < fb->calls) - (fa->calls > fb->calls);
+}
+
+Internal void interp_report(Interp* in, f64 seconds) {
+    u64 calls = 0;
+    for (InterpFunc* f = in->funcs; f != BUF_END(in->funcs); f++) {
+        calls += f->calls;
+    }
+    printf("run: %llu instructions, %llu calls in %.3f s (%.1fM instructions/s)%s\n", (unsigned long long)in->executed, (unsigned long long)calls,
+        seconds, in->executed / MAX(seconds, 1e-9) * 1e-6, in->limit && in->executed >= in->limit ? ", stopped at the limit" : "");
+    if (in->error) {
+        printf("run: stopped with error %d\n", in->error);
+    }
+    qsort(in->funcs, BUF_LEN(in->funcs), sizeof(InterpFunc), interp_cmp_insts);
+    printf("  %-32s %12s %14s\n", "function", "calls", "instructions");
+    for (size_t i = 0; i < BUF_LEN(in->funcs) && i < 20; i++) {
+        InterpFunc* f = &in->funcs[i];
+        if (f->calls || f->insts) {
+            printf("  %-32s %12llu %14llu%s\n", f->name, (unsigned long long)f->calls, (unsigned long long)f->insts, f->native ? " (os)" : "");
+        }
+    }
+}
+
+Internal void interp_tests(void) {
+    //*the program of the assembly tests, with its own Memory.alloc
+    VmInst* code[3];
+    VmInst** programs[3];
+    const char* files[3];
+    for (size_t i = 0; i < 3; i++) {
+        init_keywords();
+        init_stream("interp_tests", asm_test_classes[i]);
+        ClassDecl* c = parse_class();
+        code[i] = gen_class(c);
+        programs[i] = &code[i];
+        files[i] = c->name;
+    }
+    Interp in = { 0 };
+    assert(interp_load(&in, programs, files, 3, str_intern("Main.main")));
+    assert(interp_run(&in));
+    assert(in.ram[8000] == 4950 && in.ram[8001] == 144 && in.ram[8002] == -1);
+    u64 executed = in.executed;
+    for (InterpFunc* f = in.funcs; f != BUF_END(in.funcs); f++) {
+        if (f->name == str_intern("Acc.add")) {
+            assert(f->calls == 100);
+        }
+        executed -= f->insts;
+    }
+    //*every instruction is counted against exactly one function, the entry call aside
+    assert(executed == 1);
+    interp_free_all(&in);
+    for (size_t i = 0; i < 3; i++) {
+        BUF_FREE(code[i]);
+    }
+
+    //*the OS stubs
+    init_keywords();
+    init_stream("interp_tests", "class Main { function void main() { var Array a; var String s; var int n; let n = Keyboard.readInt(\"n? \"); let a = Array.new(n); let a[n - 1] = Math.sqrt(n * 20); "
+        "let s = \"ab\"; do s.setCharAt(1, 67); do s.eraseLastChar(); do Output.printString(s); do Output.printInt(a[n - 1] / -2); do Output.println(); do s.dispose(); do a.dispose(); "
+        "let a = Memory.alloc(5); do Output.printInt(Math.max(a, 0) > 0); do Output.printInt(10 / (n - n)); do Output.printInt(1); return; } }");
+    code[0] = gen_class(parse_class());
+    files[0] = "Main";
+    in = (Interp) { 0 };
+    in.input = "5\n";
+    assert(interp_load(&in, programs, files, 1, str_intern("Main.main")));
+    assert(!interp_run(&in));
+    BUF_PUSH(in.output, 0);
+    assert(strcmp(in.output, "n? 5\na-5\n-1ERR3") == 0 && in.error == 3);
+    interp_free_all(&in);
+    BUF_FREE(code[0]);
+
+    //*a call to a function that exists nowhere is refused, an endless loop stops at the limit
+    init_stream("interp_tests", "class Main { function void main() { do Nowhere.g(); return; } }");
+    code[0] = gen_class(parse_class());
+    in = (Interp) { 0 };
+    assert(!interp_load(&in, programs, files, 1, str_intern("Main.main")));
+    interp_free_all(&in);
+    BUF_FREE(code[0]);
+    init_stream("interp_tests", "class Main { function void main() { while (true) { } return; } }");
+    code[0] = gen_class(parse_class());
+    in = (Interp) { .limit = 1000 };
+    assert(interp_load(&in, programs, files, 1, str_intern("Main.main")));
+    assert(interp_run(&in) && in.executed >= 1000 && in.executed < 1010);
+    interp_free_all(&in);
+    BUF_FREE(code[0]);
+
+    //*conditions other than 0 and -1 run the same with and without the optimiser: 1 is false
+    for (size_t optimize = 0; optimize < 2; optimize++) {
+        init_stream("interp_tests", "class Main { function void main() { var int a, b, c, n; let b = 1; if (b) { let a = 1; } else { let c = 3; } "
+            "while (b) { let n = n + 1; let b = 0; } while ((b < 3) & ~(b = 2)) { let n = n + 2; let b = b + 1; } "
+            "do Output.printInt(a); do Output.printInt(b); do Output.printInt(c); do Output.printInt(n); return; } }");
+        code[0] = gen_class(parse_class());
+        if (optimize) {
+            vm_optimize(&code[0]);
+        }
+        in = (Interp) { .limit = 1000 };
+        assert(interp_load(&in, programs, files, 1, str_intern("Main.main")));
+        assert(interp_run(&in) && in.executed < 1000);
+        BUF_PUSH(in.output, 0);
+        assert(strcmp(in.output, "0232") == 0);
+        interp_free_all(&in);
+        BUF_FREE(code[0]);
+    }
+
+    //*a method call on another object hands THIS and THAT back as they were
+    init_stream("interp_tests", "class Main { field int x, y; constructor Main new(int a, int b) { let x = a; let y = b; return this; } "
+        "method int getX() { return x; } method int sum(Main o) { return o.getX() + y; } "
+        "function void main() { var Main p, q; let p = Main.new(1, 2); let q = Main.new(10, 20); do Output.printInt(p.sum(q)); return; } }");
+    code[0] = gen_class(parse_class());
+    in = (Interp) { 0 };
+    assert(interp_load(&in, programs, files, 1, str_intern("Main.main")));
+    assert(interp_run(&in));
+    BUF_PUSH(in.output, 0);
+    assert(strcmp(in.output, "12") == 0);
+    interp_free_all(&in);
+    BUF_FREE(code[0]);
+
+    //*an if/else that returns from both branches ends its function in a label, as the last function
+    //*of the program the jump to it lands on the halt behind the code
+    init_stream("interp_tests", "class Main { function void main() { do Output.printInt(Main.f(-1)); do Output.printInt(Main.f(0)); return; } "
+        "function int f(int x) { if (x) { return 1; } else { return 2; } } }");
+    code[0] = gen_class(parse_class());
+    assert(BUF_END(code[0])[-1].op == VM_LABEL);
+    in = (Interp) { 0 };
+    assert(interp_load(&in, programs, files, 1, str_intern("Main.main")));
+    assert(BUF_END(in.code)[-1].op == I_HALT);
+    assert(interp_run(&in));
+    BUF_PUSH(in.output, 0);
+    assert(strcmp(in.output, "12") == 0);
+    interp_free_all(&in);
+    BUF_FREE(code[0]);
+}
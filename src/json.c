@@ -0,0 +1,375 @@
+//*Just enough JSON for the language server's JSON-RPC messages: a parser building a tree on an arena
+//*and escaping for the strings written back. Every value keeps its source text in `raw`, which is how
+//*a request id of any type is echoed in the response.
+
+#define JSON_MAX_DEPTH 64
+
+typedef enum JsonKind {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} JsonKind;
+
+typedef struct Json Json;
+
+typedef struct JsonMember {
+    const char* key;
+    Json* val;
+} JsonMember;
+
+struct Json {
+    JsonKind kind;
+    const char* raw;
+    size_t raw_len;
+    union {
+        bool bool_val;
+        f64 num;
+        struct {
+            //*NUL terminated, `len` counts an escaped \u0000 too
+            const char* str;
+            size_t len;
+        };
+        struct {
+            Json** items;
+            size_t num_items;
+        };
+        struct {
+            JsonMember* members;
+            size_t num_members;
+        };
+    };
+};
+
+typedef struct JsonParser {
+    const char* at;
+    Arena* arena;
+    size_t depth;
+} JsonParser;
+
+Internal void json_skip_space(JsonParser* p) {
+    while (*p->at == ' ' || *p->at == '\t' || *p->at == '\n' || *p->at == '\r') {
+        p->at++;
+    }
+}
+
+Internal i32 json_hex4(const char* at) {
+    i32 val = 0;
+    for (size_t i = 0; i < 4; i++) {
+        char c = at[i];
+        i32 digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return -1;
+        }
+        val = val * 16 + digit;
+    }
+    return val;
+}
+
+Internal void json_push_utf8(char** buf, u32 cp) {
+    if (cp < 0x80) {
+        BUF_PUSH(*buf, (char)cp);
+    }
+    else if (cp < 0x800) {
+        BUF_PUSH(*buf, (char)(0xc0 | (cp >> 6)));
+        BUF_PUSH(*buf, (char)(0x80 | (cp & 0x3f)));
+    }
+    else if (cp < 0x10000) {
+        BUF_PUSH(*buf, (char)(0xe0 | (cp >> 12)));
+        BUF_PUSH(*buf, (char)(0x80 | ((cp >> 6) & 0x3f)));
+        BUF_PUSH(*buf, (char)(0x80 | (cp & 0x3f)));
+    }
+    else {
+        BUF_PUSH(*buf, (char)(0xf0 | (cp >> 18)));
+        BUF_PUSH(*buf, (char)(0x80 | ((cp >> 12) & 0x3f)));
+        BUF_PUSH(*buf, (char)(0x80 | ((cp >> 6) & 0x3f)));
+        BUF_PUSH(*buf, (char)(0x80 | (cp & 0x3f)));
+    }
+}
+
+//*`p->at` is on the opening quote, the string is copied to the arena with its escapes resolved
+Internal bool json_parse_string(JsonParser* p, const char** str, size_t* len) {
+    p->at++;
+    char* buf = NULL;
+    for (;;) {
+        char c = *p->at;
+        if (c == '"') {
+            p->at++;
+            break;
+        }
+        if (!c || (u8)c < 0x20) {
+            BUF_FREE(buf);
+            return false;
+        }
+        if (c != '\\') {
+            BUF_PUSH(buf, c);
+            p->at++;
+            continue;
+        }
+        p->at++;
+        switch (*p->at) {
+            case '"': BUF_PUSH(buf, '"'); break;
+            case '\\': BUF_PUSH(buf, '\\'); break;
+            case '/': BUF_PUSH(buf, '/'); break;
+            case 'b': BUF_PUSH(buf, '\b'); break;
+            case 'f': BUF_PUSH(buf, '\f'); break;
+            case 'n': BUF_PUSH(buf, '\n'); break;
+            case 'r': BUF_PUSH(buf, '\r'); break;
+            case 't': BUF_PUSH(buf, '\t'); break;
+            case 'u': {
+                i32 cp = json_hex4(p->at + 1);
+                if (cp < 0) {
+                    BUF_FREE(buf);
+                    return false;
+                }
+                p->at += 4;
+                //*a surrogate pair spells one code point, a lone surrogate is kept as it is
+                if (cp >= 0xd800 && cp < 0xdc00 && p->at[1] == '\\' && p->at[2] == 'u') {
+                    i32 low = json_hex4(p->at + 3);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        p->at += 6;
+                    }
+                }
+                json_push_utf8(&buf, (u32)cp);
+                break;
+            }
+            default: {
+                BUF_FREE(buf);
+                return false;
+            }
+        }
+        p->at++;
+    }
+    *len = BUF_LEN(buf);
+    char* copy = arena_alloc(p->arena, *len + 1);
+    if (*len) {
+        memcpy(copy, buf, *len);
+    }
+    copy[*len] = 0;
+    *str = copy;
+    BUF_FREE(buf);
+    return true;
+}
+
+Internal Json* json_parse_value(JsonParser* p);
+
+Internal bool json_parse_items(JsonParser* p, Json* json) {
+    Json** items = NULL;
+    p->at++;
+    json_skip_space(p);
+    if (*p->at == ']') {
+        p->at++;
+        return true;
+    }
+    for (;;) {
+        Json* item = json_parse_value(p);
+        if (!item) {
+            BUF_FREE(items);
+            return false;
+        }
+        BUF_PUSH(items, item);
+        json_skip_space(p);
+        if (*p->at == ',') {
+            p->at++;
+            continue;
+        }
+        if (*p->at != ']') {
+            BUF_FREE(items);
+            return false;
+        }
+        p->at++;
+        break;
+    }
+    json->num_items = BUF_LEN(items);
+    json->items = arena_alloc(p->arena, BUF_SIZEOF(items));
+    memcpy(json->items, items, BUF_SIZEOF(items));
+    BUF_FREE(items);
+    return true;
+}
+
+Internal bool json_parse_members(JsonParser* p, Json* json) {
+    JsonMember* members = NULL;
+    p->at++;
+    json_skip_space(p);
+    if (*p->at == '}') {
+        p->at++;
+        return true;
+    }
+    for (;;) {
+        JsonMember member = { 0 };
+        size_t key_len;
+        json_skip_space(p);
+        if (*p->at != '"' || !json_parse_string(p, &member.key, &key_len)) {
+            BUF_FREE(members);
+            return false;
+        }
+        json_skip_space(p);
+        if (*p->at != ':') {
+            BUF_FREE(members);
+            return false;
+        }
+        p->at++;
+        member.val = json_parse_value(p);
+        if (!member.val) {
+            BUF_FREE(members);
+            return false;
+        }
+        BUF_PUSH(members, member);
+        json_skip_space(p);
+        if (*p->at == ',') {
+            p->at++;
+            continue;
+        }
+        if (*p->at != '}') {
+            BUF_FREE(members);
+            return false;
+        }
+        p->at++;
+        break;
+    }
+    json->num_members = BUF_LEN(members);
+    json->members = arena_alloc(p->arena, BUF_SIZEOF(members));
+    memcpy(json->members, members, BUF_SIZEOF(members));
+    BUF_FREE(members);
+    return true;
+}
+
+Internal Json* json_parse_value(JsonParser* p) {
+    json_skip_space(p);
+    if (p->depth == JSON_MAX_DEPTH) {
+        return NULL;
+    }
+    Json* json = arena_alloc(p->arena, sizeof(Json));
+    memset(json, 0, sizeof(Json));
+    json->raw = p->at;
+    bool ok = true;
+    p->depth++;
+    switch (*p->at) {
+        case '{': {
+            json->kind = JSON_OBJECT;
+            ok = json_parse_members(p, json);
+            break;
+        }
+        case '[': {
+            json->kind = JSON_ARRAY;
+            ok = json_parse_items(p, json);
+            break;
+        }
+        case '"': {
+            json->kind = JSON_STRING;
+            ok = json_parse_string(p, &json->str, &json->len);
+            break;
+        }
+        case 't':
+        case 'f':
+        case 'n': {
+            const char* word = *p->at == 't' ? "true" : *p->at == 'f' ? "false" : "null";
+            size_t len = strlen(word);
+            ok = strncmp(p->at, word, len) == 0;
+            json->kind = *p->at == 'n' ? JSON_NULL : JSON_BOOL;
+            json->bool_val = *p->at == 't';
+            p->at += ok ? len : 0;
+            break;
+        }
+        default: {
+            char* end;
+            json->kind = JSON_NUMBER;
+            json->num = strtod(p->at, &end);
+            ok = end != p->at && (*p->at == '-' || (*p->at >= '0' && *p->at <= '9'));
+            p->at = end;
+            break;
+        }
+    }
+    p->depth--;
+    json->raw_len = p->at - json->raw;
+    return ok ? json : NULL;
+}
+
+//*Parses the NUL terminated `text`, NULL when it is not a single valid JSON value
+Internal Json* json_parse(Arena* arena, const char* text) {
+    JsonParser p = { text, arena, 0 };
+    Json* json = json_parse_value(&p);
+    json_skip_space(&p);
+    return json && !*p.at ? json : NULL;
+}
+
+//*member `key` of an object, NULL when `json` is no object or has no such member
+Internal Json* json_get(Json* json, const char* key) {
+    if (!json || json->kind != JSON_OBJECT) {
+        return NULL;
+    }
+    for (size_t i = 0; i < json->num_members; i++) {
+        if (strcmp(json->members[i].key, key) == 0) {
+            return json->members[i].val;
+        }
+    }
+    return NULL;
+}
+
+Internal const char* json_str(Json* json) {
+    return json && json->kind == JSON_STRING ? json->str : NULL;
+}
+
+Internal i64 json_int(Json* json, i64 fallback) {
+    return json && json->kind == JSON_NUMBER ? (i64)json->num : fallback;
+}
+
+//*appends `str` quoted, with the characters JSON does not allow in strings escaped
+Internal void json_write_str(char** buf, const char* str, size_t len) {
+    BUF_PUSH(*buf, '"');
+    for (size_t i = 0; i < len; i++) {
+        u8 c = (u8)str[i];
+        switch (c) {
+            case '"': BUF_PRINTF(*buf, "\\\""); break;
+            case '\\': BUF_PRINTF(*buf, "\\\\"); break;
+            case '\n': BUF_PRINTF(*buf, "\\n"); break;
+            case '\r': BUF_PRINTF(*buf, "\\r"); break;
+            case '\t': BUF_PRINTF(*buf, "\\t"); break;
+            default: {
+                if (c < 0x20) {
+                    BUF_PRINTF(*buf, "\\u%04x", c);
+                }
+                else {
+                    BUF_PUSH(*buf, (char)c);
+                }
+                break;
+            }
+        }
+    }
+    BUF_PUSH(*buf, '"');
+}
+
+Internal void json_tests(void) {
+    Arena arena = { 0 };
+    Json* json = json_parse(&arena, " {\"id\": 7, \"s\": \"a\\\"b\\u00e9\\ud83d\\ude00\\n\", \"list\": [1, -2.5e1, true, null, {}], \"empty\": []} ");
+    assert(json && json->kind == JSON_OBJECT && json->num_members == 4);
+    assert(json_int(json_get(json, "id"), 0) == 7);
+    Json* id = json_get(json, "id");
+    assert(id->raw_len == 1 && id->raw[0] == '7');
+    assert(strcmp(json_str(json_get(json, "s")), "a\"b\xc3\xa9\xf0\x9f\x98\x80\n") == 0);
+    Json* list = json_get(json, "list");
+    assert(list->kind == JSON_ARRAY && list->num_items == 5);
+    assert(list->items[1]->num == -25.0 && list->items[2]->bool_val && list->items[3]->kind == JSON_NULL);
+    assert(list->items[4]->kind == JSON_OBJECT && list->items[4]->num_members == 0);
+    assert(json_get(json, "empty")->num_items == 0);
+    assert(!json_get(json, "missing") && !json_get(list, "id"));
+
+    assert(!json_parse(&arena, "{\"a\": }"));
+    assert(!json_parse(&arena, "[1, 2"));
+    assert(!json_parse(&arena, "\"tab\there\""));
+    assert(!json_parse(&arena, "{} {}"));
+    assert(!json_parse(&arena, "tru"));
+    char deep[JSON_MAX_DEPTH + 2] = { 0 };
+    memset(deep, '[', JSON_MAX_DEPTH + 1);
+    assert(!json_parse(&arena, deep));
+
+    char* out = NULL;
+    json_write_str(&out, "q\"\\\n\x01", 5);
+    BUF_PUSH(out, 0);
+    assert(strcmp(out, "\"q\\\"\\\\\\n\\u0001\"") == 0);
+    BUF_FREE(out);
+    arena_free(&arena);
+}
@@ -0,0 +1,266 @@
+//*Speculative parallel lexing of a single buffer.
+//*The buffer is cut into chunks at line starts. A token can only cross a line break inside a block
+//*comment, strings and line comments end at the newline, so the only unknown about the lexer state at
+//*a chunk start is whether it is inside a block comment. Every chunk is lexed by its own thread from
+//*both start states, then a sequential prefix pass walks the chunks, picks the run matching the state
+//*the previous chunk ended in and stitches tokens, line numbers and diagnostics together.
+//*The "inside a comment" run stops as soon as it starts a token at the same position as the normal
+//*run, from there on both runs are identical, so speculation usually costs one comment's worth of work.
+//*Workers only hash identifiers, interning happens in the stitch pass on the calling thread.
+
+typedef enum LexStartState {
+    LEX_START_NORMAL,
+    LEX_START_COMMENT,
+    NUM_LEX_START_STATES,
+} LexStartState;
+
+typedef struct LexRun {
+    Token* tokens;
+    LexDiag* diags;
+    bool ends_in_comment;
+    //*only for the comment run: index of the normal run's token where both runs become identical
+    size_t rejoin;
+} LexRun;
+
+typedef struct LexChunk {
+    const char* src;
+    size_t len;
+    char* copy;
+    bool speculate;
+    i64 num_lines;
+    LexRun runs[NUM_LEX_START_STATES];
+} LexChunk;
+
+Internal void lex_run_start(LexChunk* chunk) {
+    stream = chunk->copy;
+    stream_end = chunk->copy + chunk->len;
+    line_start = stream;
+    token.start = stream;
+    token.pos.name = NULL;
+    token.pos.line = 1;
+    lex_unterminated_comment = false;
+    lex_diags = NULL;
+}
+
+Internal void free_token_range(Token* begin, Token* end) {
+    for (Token* it = begin; it != end; it++) {
+        if (it->kind == TOKEN_STR) {
+            BUF_FREE(it->str_val);
+        }
+    }
+}
+
+Internal void free_diags(LexDiag* diags) {
+    for (LexDiag* it = diags; it != BUF_END(diags); it++) {
+        free(it->msg);
+    }
+    BUF_FREE(diags);
+}
+
+Internal void lex_chunk_scan(LexChunk* chunk) {
+    //*the copy gives the chunk the NUL terminator the scanners stop at
+    chunk->copy = xmalloc(chunk->len + 1);
+    memcpy(chunk->copy, chunk->src, chunk->len);
+    chunk->copy[chunk->len] = 0;
+
+    lex_defer_intern = true;
+    lex_collect_diags = true;
+
+    LexRun* normal = &chunk->runs[LEX_START_NORMAL];
+    lex_run_start(chunk);
+    for (next_token(); !is_token_eof(); next_token()) {
+        BUF_PUSH(normal->tokens, token);
+    }
+    normal->diags = lex_diags;
+    normal->ends_in_comment = lex_unterminated_comment;
+    chunk->num_lines = token.pos.line - 1;
+
+    if (!chunk->speculate) {
+        return;
+    }
+
+    LexRun* comment = &chunk->runs[LEX_START_COMMENT];
+    comment->rejoin = SIZE_MAX;
+    lex_run_start(chunk);
+    if (!skip_block_comment()) {
+        comment->ends_in_comment = true;
+        comment->diags = lex_diags;
+        return;
+    }
+
+    Token* normal_tokens = normal->tokens;
+    size_t num_normal = BUF_LEN(normal_tokens);
+    size_t j = 0;
+    for (next_token(); !is_token_eof(); next_token()) {
+        while (j < num_normal && normal_tokens[j].start < token.start) {
+            j++;
+        }
+        if (j < num_normal && normal_tokens[j].start == token.start) {
+            comment->rejoin = j;
+            free_token_range(&token, &token + 1);
+            break;
+        }
+        BUF_PUSH(comment->tokens, token);
+    }
+
+    if (comment->rejoin == SIZE_MAX) {
+        comment->ends_in_comment = lex_unterminated_comment;
+        comment->diags = lex_diags;
+        return;
+    }
+
+    //*diagnostics from the rejoin point on are reported by the normal run
+    const char* rejoin_at = normal_tokens[comment->rejoin].start;
+    for (LexDiag* it = lex_diags; it != BUF_END(lex_diags); it++) {
+        if (it->at < rejoin_at) {
+            BUF_PUSH(comment->diags, *it);
+        }
+        else {
+            free(it->msg);
+        }
+    }
+    BUF_FREE(lex_diags);
+    comment->ends_in_comment = normal->ends_in_comment;
+}
+
+Internal void lex_chunk_worker(void* arg) {
+    trace_thread_name("lex worker");
+    f64 start = trace_begin();
+    lex_chunk_scan(arg);
+    trace_end("lex chunk", NULL, start);
+}
+
+Internal void stitch_token(Token** tokens, const LexChunk* chunk, Token tok, const char* name, i64 first_line) {
+    tok.start = chunk->src + (tok.start - chunk->copy);
+    tok.end = chunk->src + (tok.end - chunk->copy);
+    tok.pos.name = name;
+    tok.pos.line += first_line - 1;
+    if (tok.kind == TOKEN_NAME) {
+        intern_token(&tok);
+    }
+    BUF_PUSH(*tokens, tok);
+}
+
+//*printed, or collected like error() does when the calling thread collects diagnostics
+Internal void stitch_diags(const LexChunk* chunk, const LexDiag* begin, const LexDiag* end, const char* name, i64 first_line) {
+    for (const LexDiag* it = begin; it != end; it++) {
+        if (lex_collect_diags) {
+            BUF_PUSH(lex_diags, (LexDiag) { chunk->src + (it->at - chunk->copy), it->line + first_line - 1, strf("%s", it->msg) });
+        }
+        else {
+            printf("%s(%lld): %s\n", name, (long long)(it->line + first_line - 1), it->msg);
+        }
+    }
+}
+
+//*Produces exactly the tokens of lex_tokens() using up to `num_chunks` threads
+Internal Token* lex_tokens_parallel(const char* name, const char* buf, size_t len, size_t num_chunks) {
+    init_keywords();
+    name = name ? name : "<string>";
+    if (num_chunks < 2 || len < 2 * num_chunks) {
+        return lex_tokens(name, buf);
+    }
+
+    LexChunk* chunks = NULL;
+    const char* end = buf + len;
+    for (const char* start = buf; start < end;) {
+        const char* split = start + len / num_chunks;
+        if (split >= end || BUF_LEN(chunks) == num_chunks - 1) {
+            split = end;
+        }
+        else {
+            const char* newline = memchr(split, '\n', end - split);
+            split = newline ? newline + 1 : end;
+        }
+        BUF_PUSH(chunks, (LexChunk) { .src = start, .len = split - start, .speculate = start != buf });
+        start = split;
+    }
+
+    Thread* threads = xcalloc(BUF_LEN(chunks), sizeof(Thread));
+    for (size_t i = 0; i < BUF_LEN(chunks); i++) {
+        threads[i] = thread_create(lex_chunk_worker, &chunks[i]);
+    }
+    for (size_t i = 0; i < BUF_LEN(chunks); i++) {
+        thread_join(threads[i]);
+    }
+    free(threads);
+
+    Token* tokens = NULL;
+    i64 first_line = 1;
+    bool in_comment = false;
+    for (LexChunk* chunk = chunks; chunk != BUF_END(chunks); chunk++) {
+        LexRun* normal = &chunk->runs[LEX_START_NORMAL];
+        LexRun* comment = &chunk->runs[LEX_START_COMMENT];
+        //*a chunk entered inside a comment takes the normal run only from where the comment run rejoins it
+        size_t normal_from = 0;
+        bool use_normal = true;
+        if (in_comment) {
+            for (Token* it = comment->tokens; it != BUF_END(comment->tokens); it++) {
+                stitch_token(&tokens, chunk, *it, name, first_line);
+            }
+            stitch_diags(chunk, comment->diags, BUF_END(comment->diags), name, first_line);
+            use_normal = comment->rejoin != SIZE_MAX;
+            normal_from = use_normal ? comment->rejoin : BUF_LEN(normal->tokens);
+            free_token_range(normal->tokens, normal->tokens + normal_from);
+            in_comment = comment->ends_in_comment;
+        }
+        else {
+            free_token_range(comment->tokens, BUF_END(comment->tokens));
+            in_comment = normal->ends_in_comment;
+        }
+
+        if (use_normal) {
+            const char* from = normal_from ? normal->tokens[normal_from].start : NULL;
+            for (Token* it = normal->tokens + normal_from; it != BUF_END(normal->tokens); it++) {
+                stitch_token(&tokens, chunk, *it, name, first_line);
+            }
+            const LexDiag* diag = normal->diags;
+            while (diag != BUF_END(normal->diags) && from && diag->at < from) {
+                diag++;
+            }
+            stitch_diags(chunk, diag, BUF_END(normal->diags), name, first_line);
+        }
+
+        first_line += chunk->num_lines;
+        BUF_FREE(normal->tokens);
+        BUF_FREE(comment->tokens);
+        free_diags(normal->diags);
+        free_diags(comment->diags);
+        free(chunk->copy);
+    }
+    BUF_FREE(chunks);
+
+    return tokens;
+}
+
+Internal void lex_parallel_tests(void) {
+    //*comments, strings and errors placed so that chunk boundaries fall inside and around them
+    char* src = NULL;
+    for (int i = 0; i < 64; i++) {
+        BUF_PRINTF(src, "class C%d { /* comment %d\n spanning\n lines */ field int x%d;\n", i, i, i);
+        BUF_PRINTF(src, "  // let y = */ 1;\n  method void m() { let s = \"/* not a comment\"; let x = 1 */ 2; }\n");
+        BUF_PRINTF(src, "  /*\n\n*/ function int f() { return %d; } /** doc ** with stars **/ }\n", i * 300);
+    }
+    Token* expected = lex_tokens("parallel", src);
+    for (size_t num_chunks = 2; num_chunks <= 17; num_chunks += 5) {
+        Token* tokens = lex_tokens_parallel("parallel", src, BUF_LEN(src), num_chunks);
+        assert(BUF_LEN(tokens) == BUF_LEN(expected));
+        for (size_t i = 0; i < BUF_LEN(tokens); i++) {
+            assert(tokens[i].kind == expected[i].kind);
+            assert(tokens[i].start == expected[i].start && tokens[i].end == expected[i].end);
+            assert(tokens[i].pos.line == expected[i].pos.line);
+            if (tokens[i].kind == TOKEN_NAME || tokens[i].kind == TOKEN_KEYWORD) {
+                assert(tokens[i].name == expected[i].name);
+            }
+            else if (tokens[i].kind == TOKEN_STR) {
+                assert(strcmp(tokens[i].str_val, expected[i].str_val) == 0);
+            }
+            else if (tokens[i].kind == TOKEN_INT) {
+                assert(tokens[i].int_val == expected[i].int_val);
+            }
+        }
+        free_tokens(tokens);
+    }
+    free_tokens(expected);
+    BUF_FREE(src);
+}
@@ -0,0 +1,822 @@
+//*Language server, run with `main --lsp`. It speaks JSON-RPC over stdin/stdout and publishes the
+//*lexer and parser errors of every open document as diagnostics while it is edited.
+//*
+//*A document keeps its text, its token array and its AST. An edit does not start over:
+//*  - the tokens ending before the edit stay, relexing starts at the end of the last of them, where
+//*    the scanner is between tokens, and stops at the first token that starts in the unchanged text
+//*    at the same place as an old token did, from there on the old tokens only move
+//*  - the tokens are split into segments, the class header and one per subroutine, each beginning
+//*    at its `constructor`, `function` or `method` keyword. A segment whose tokens were not relexed
+//*    keeps its AST and diagnostics, only the others are parsed again, each on its own so a syntax
+//*    error ends the subroutine it is in instead of the whole class
+//*The server asks for the utf-8 position encoding when the client offers it and then counts columns
+//*in bytes. Otherwise they are in utf-16 code units, the protocol's default.
+
+typedef struct LspDiag {
+    size_t offset;
+    size_t len;
+    i64 line;
+    char* msg;
+    //*for lexer errors the start of the token whose scan reported it, which decides whether the
+    //*error goes with a kept token or is reported again by relexing
+    size_t owner;
+} LspDiag;
+
+typedef struct LspSegment {
+    size_t first;
+    size_t count;
+    //*the last segment also holds the `}` closing the class
+    bool last;
+    bool header;
+    bool ok;
+    //*the header segment, always the first one
+    const char* class_name;
+    ClassVarDecl* vars;
+    size_t num_vars;
+    //*any other segment
+    Subroutine sub;
+    LspDiag* diags;
+} LspSegment;
+
+typedef struct LspDoc {
+    char* uri;
+    i64 version;
+    char* text;
+    size_t len;
+    Token* tokens;
+    LspDiag* lex_diags;
+    bool unterminated_comment;
+    LspSegment* segments;
+    //*the AST of all segments, parsed again from scratch once reparsing has doubled it
+    Arena arena;
+    size_t full_parse_blocks;
+    Subroutine* subs;
+    ClassDecl decl;
+} LspDoc;
+
+typedef struct LspStats {
+    size_t relexed_tokens;
+    size_t reparsed_segments;
+    size_t reused_segments;
+} LspStats;
+
+LspStats lsp_stats;
+
+typedef struct LspServer {
+    LspDoc** docs;
+    //*messages to the client, lsp_serve() writes them out after every request
+    char* out;
+    //*columns are bytes, agreed on in `initialize`, otherwise utf-16 code units
+    bool utf8;
+    bool shutdown;
+    bool exit;
+} LspServer;
+
+Internal void lsp_free_diags(LspDiag* diags) {
+    for (LspDiag* it = diags; it != BUF_END(diags); it++) {
+        free(it->msg);
+    }
+    BUF_FREE(diags);
+}
+
+//*takes the diagnostics collected by error() since lex_diags was last emptied
+Internal void lsp_take_lex_diags(LspDiag** diags, const char* text, size_t owner) {
+    for (LexDiag* it = lex_diags; it != BUF_END(lex_diags); it++) {
+        BUF_PUSH(*diags, (LspDiag) { (size_t)(it->at - text), 1, it->line, it->msg, owner });
+    }
+    BUF_CLEAR(lex_diags);
+}
+
+Internal size_t lsp_count_lines(const char* str, size_t len) {
+    size_t lines = 0;
+    for (const char* end = str + len; (str = memchr(str, '\n', end - str)) != NULL; str++) {
+        lines++;
+    }
+    return lines;
+}
+
+//*bytes of the utf-8 sequence starting with `c`, a stray continuation byte is one character
+Internal size_t lsp_utf8_len(u8 c) {
+    return c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+}
+
+//*utf-16 code units of the text from `at` to `end`, a 4 byte sequence takes a surrogate pair
+Internal size_t lsp_utf16_len(const char* at, const char* end) {
+    size_t units = 0;
+    while (at < end) {
+        size_t n = lsp_utf8_len((u8)*at);
+        units += n == 4 ? 2 : 1;
+        at += n;
+    }
+    return units;
+}
+
+//*byte offset of the zero based `line` and `character` of an LSP position, clamped to the line.
+//*`character` counts bytes for `utf8`, utf-16 code units otherwise.
+Internal size_t lsp_offset(LspDoc* doc, i64 line, i64 character, bool utf8) {
+    //*the last token on an earlier line is where counting newlines starts
+    size_t lo = 0;
+    size_t hi = BUF_LEN(doc->tokens);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (doc->tokens[mid].pos.line < line + 1) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    const char* at = lo ? doc->tokens[lo - 1].end : doc->text;
+    i64 at_line = lo ? doc->tokens[lo - 1].pos.line : 1;
+    const char* end = doc->text + doc->len;
+    while (at_line < line + 1 && at != end) {
+        const char* newline = memchr(at, '\n', end - at);
+        at = newline ? newline + 1 : end;
+        at_line += newline != NULL;
+    }
+    for (i64 i = 0; i < character && at != end && *at != '\n';) {
+        size_t n = utf8 ? 1 : lsp_utf8_len((u8)*at);
+        i += n == 4 ? 2 : 1;
+        for (; n && at != end && *at != '\n'; n--) {
+            at++;
+        }
+    }
+    return at - doc->text;
+}
+
+Internal void lsp_shift_expr(Expr* expr, i64 delta);
+
+Internal void lsp_shift_exprs(ExprList list, i64 delta) {
+    for (size_t i = 0; i < list.num_exprs; i++) {
+        lsp_shift_expr(list.exprs[i], delta);
+    }
+}
+
+Internal void lsp_shift_expr(Expr* expr, i64 delta) {
+    if (!expr) {
+        return;
+    }
+    expr->pos.line += delta;
+    switch (expr->kind) {
+        case EXPR_INDEX: lsp_shift_expr(expr->index.expr, delta); break;
+        case EXPR_CALL: lsp_shift_exprs(expr->call.expr_list, delta); break;
+        case EXPR_UNARY: lsp_shift_expr(expr->unary.expr, delta); break;
+        case EXPR_BINARY: lsp_shift_expr(expr->binary.left, delta); lsp_shift_expr(expr->binary.right, delta); break;
+        case EXPR_PAREN: lsp_shift_expr(expr->paren.expr, delta); break;
+        default: break;
+    }
+}
+
+Internal void lsp_shift_stmts(StmtList* list, i64 delta) {
+    list->pos.line += delta;
+    for (size_t i = 0; i < list->num_stmts; i++) {
+        Stmt* stmt = list->stmts[i];
+        stmt->pos.line += delta;
+        switch (stmt->kind) {
+            case STMT_LET: {
+                lsp_shift_expr(stmt->let_stmt.index_expr, delta);
+                lsp_shift_expr(stmt->let_stmt.assign_expr, delta);
+                break;
+            }
+            case STMT_IF: {
+                lsp_shift_expr(stmt->if_stmt.cond, delta);
+                lsp_shift_stmts(&stmt->if_stmt.then_block, delta);
+                lsp_shift_stmts(&stmt->if_stmt.else_block, delta);
+                break;
+            }
+            case STMT_WHILE: {
+                lsp_shift_expr(stmt->while_stmt.cond, delta);
+                lsp_shift_stmts(&stmt->while_stmt.block, delta);
+                break;
+            }
+            case STMT_DO: lsp_shift_expr(stmt->do_stmt.subroutine_call, delta); break;
+            case STMT_RETURN: lsp_shift_expr(stmt->return_stmt.expr, delta); break;
+        }
+    }
+}
+
+//*a segment after the edit keeps its AST and diagnostics, moved by `delta` bytes and `line_delta` lines
+Internal void lsp_shift_segment(LspSegment* seg, i64 delta, i64 line_delta) {
+    for (LspDiag* it = seg->diags; it != BUF_END(seg->diags); it++) {
+        it->offset = (size_t)((i64)it->offset + delta);
+        it->line += line_delta;
+    }
+    if (seg->ok && !seg->header && line_delta) {
+        lsp_shift_stmts(&seg->sub.block, line_delta);
+    }
+}
+
+Internal void lsp_parse_segment_tokens(LspSegment* seg) {
+    if (seg->header) {
+        expect_keyword(class_keyword);
+        seg->class_name = token.name;
+        expect_token(TOKEN_NAME);
+        expect_token(TOKEN_LBRACE);
+        seg->vars = parse_class_vars(&seg->num_vars);
+    }
+    else {
+        seg->sub = parse_subroutine();
+    }
+    if (seg->last) {
+        expect_token(TOKEN_RBRACE);
+    }
+    if (!is_token_eof()) {
+        fatal_syntax_error("unexpected %s in class body", token_info());
+    }
+}
+
+Internal void lsp_parse_segment(LspDoc* doc, LspSegment* seg) {
+    jmp_buf bailout;
+    size_t scratch_len = BUF_LEN(ast_scratch);
+    init_replay(doc->uri, doc->tokens + seg->first, seg->count);
+    syntax_bailout = &bailout;
+    if (setjmp(bailout) == 0) {
+        lsp_parse_segment_tokens(seg);
+        seg->ok = true;
+    }
+    else {
+        //*lists the parser had open are dropped, the error is placed on the token it failed at
+        if (ast_scratch) {
+            _BUF_HDR(ast_scratch)->len = scratch_len;
+        }
+        LexDiag* diag = &lex_diags[BUF_LEN(lex_diags) - 1];
+        const char* at = token.start ? token.start : seg->count ? doc->tokens[seg->first].start : doc->text;
+        seg->ok = false;
+        BUF_PUSH(seg->diags, (LspDiag) { (size_t)(at - doc->text), token.end > at ? (size_t)(token.end - at) : 1, token.pos.line, diag->msg, 0 });
+        _BUF_HDR(lex_diags)->len--;
+    }
+    syntax_bailout = NULL;
+    close_replay();
+    lsp_take_lex_diags(&seg->diags, doc->text, 0);
+    lsp_stats.reparsed_segments++;
+}
+
+//*segment starts after a change, the header and then one at every subroutine keyword
+Internal LspSegment* lsp_split_segments(const Token* tokens) {
+    LspSegment* segs = NULL;
+    BUF_PUSH(segs, (LspSegment) { .header = true });
+    for (size_t i = 0; i < BUF_LEN(tokens); i++) {
+        if (tokens[i].kind == TOKEN_KEYWORD && is_subroutine_keyword(tokens[i].name)) {
+            BUF_PUSH(segs, (LspSegment) { .first = i });
+        }
+    }
+    for (size_t i = 0; i < BUF_LEN(segs); i++) {
+        size_t end = i + 1 < BUF_LEN(segs) ? segs[i + 1].first : BUF_LEN(tokens);
+        segs[i].count = end - segs[i].first;
+    }
+    segs[BUF_LEN(segs) - 1].last = true;
+    return segs;
+}
+
+//*Replaces the bytes [start, end) of the document with `ins`. `keep` is the number of leading old
+//*tokens unaffected by the change, see the top of the file.
+Internal void lsp_change(LspDoc* doc, size_t start, size_t end, const char* ins, size_t ins_len) {
+    char* old = doc->text;
+    Token* old_tokens = doc->tokens;
+    size_t num_old = BUF_LEN(old_tokens);
+    start = start < doc->len ? start : doc->len;
+    end = end < start ? start : end < doc->len ? end : doc->len;
+
+    size_t len = doc->len - (end - start) + ins_len;
+    char* text = xmalloc(len + 1);
+    memcpy(text, old, start);
+    memcpy(text + start, ins, ins_len);
+    memcpy(text + start + ins_len, old + end, doc->len - end);
+    text[len] = 0;
+    i64 delta = (i64)ins_len - (i64)(end - start);
+    i64 line_delta = (i64)lsp_count_lines(ins, ins_len) - (i64)lsp_count_lines(old + start, end - start);
+
+    //*a token ending right at the edit may continue into it, only those ending before stay
+    size_t keep = 0;
+    size_t hi = num_old;
+    while (keep < hi) {
+        size_t mid = keep + (hi - keep) / 2;
+        if ((size_t)(old_tokens[mid].end - old) < start) {
+            keep = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    size_t restart = keep ? (size_t)(old_tokens[keep - 1].end - old) : 0;
+    i64 restart_line = keep ? old_tokens[keep - 1].pos.line : 1;
+
+    Token* tokens = NULL;
+    BUF_RESERVE(tokens, num_old + 16);
+    for (size_t i = 0; i < keep; i++) {
+        Token t = old_tokens[i];
+        t.start = text + (t.start - old);
+        t.end = text + (t.end - old);
+        BUF_PUSH(tokens, t);
+    }
+
+    //*relex until a token starts in the unchanged text where an old one started
+    LspDiag* lex_kept = NULL;
+    for (LspDiag* it = doc->lex_diags; it != BUF_END(doc->lex_diags); it++) {
+        if (it->owner < restart) {
+            BUF_PUSH(lex_kept, *it);
+            it->msg = NULL;
+        }
+    }
+    BUF_CLEAR(lex_diags);
+    resume_stream(doc->uri, text, text + restart, restart_line);
+    size_t suffix = start + ins_len;
+    size_t resync = num_old;
+    size_t old_next = keep;
+    for (;;) {
+        size_t offset = token.start - text;
+        if (offset >= suffix && !is_token_eof()) {
+            while (old_next < num_old && (i64)(old_tokens[old_next].start - old) + delta < (i64)offset) {
+                old_next++;
+            }
+            if (old_next < num_old && (i64)(old_tokens[old_next].start - old) + delta == (i64)offset) {
+                //*the errors of this scan replace those the old token had, the gap before it may
+                //*have changed
+                resync = old_next;
+                lsp_take_lex_diags(&lex_kept, text, offset);
+                if (token.kind == TOKEN_STR) {
+                    BUF_FREE(token.str_val);
+                }
+                break;
+            }
+        }
+        lsp_take_lex_diags(&lex_kept, text, offset);
+        if (is_token_eof()) {
+            break;
+        }
+        BUF_PUSH(tokens, token);
+        next_token();
+    }
+    size_t relexed_end = BUF_LEN(tokens);
+    lsp_stats.relexed_tokens += relexed_end - keep;
+    if (resync == num_old) {
+        doc->unterminated_comment = lex_unterminated_comment;
+    }
+
+    for (size_t i = keep; i < resync; i++) {
+        if (old_tokens[i].kind == TOKEN_STR) {
+            BUF_FREE(old_tokens[i].str_val);
+        }
+    }
+    size_t resync_offset = resync < num_old ? (size_t)(old_tokens[resync].start - old) : doc->len + 1;
+    for (size_t i = resync; i < num_old; i++) {
+        Token t = old_tokens[i];
+        t.start = text + (t.start - old) + delta;
+        t.end = text + (t.end - old) + delta;
+        t.pos.line += line_delta;
+        BUF_PUSH(tokens, t);
+    }
+    for (LspDiag* it = doc->lex_diags; it != BUF_END(doc->lex_diags); it++) {
+        if (it->msg && it->owner > resync_offset) {
+            BUF_PUSH(lex_kept, (LspDiag) { (size_t)((i64)it->offset + delta), it->len, it->line + line_delta, it->msg, (size_t)((i64)it->owner + delta) });
+            it->msg = NULL;
+        }
+    }
+    lsp_free_diags(doc->lex_diags);
+    doc->lex_diags = lex_kept;
+    BUF_FREE(old_tokens);
+    free(old);
+    doc->text = text;
+    doc->len = len;
+    doc->tokens = tokens;
+
+    //*old segments are matched by their place in the new token array, the ones in the relexed
+    //*range or across its edges have none
+    bool full = BUF_LEN(doc->arena.blocks) > 2 * doc->full_parse_blocks + 1;
+    Arena saved_arena = ast_arena;
+    if (full) {
+        arena_free(&doc->arena);
+    }
+    ast_arena = doc->arena;
+    LspSegment* old_segs = doc->segments;
+    LspSegment* segs = lsp_split_segments(tokens);
+    size_t old_index = 0;
+    for (LspSegment* seg = segs; seg != BUF_END(segs); seg++) {
+        LspSegment* match = NULL;
+        while (!full && old_index < BUF_LEN(old_segs)) {
+            LspSegment* o = &old_segs[old_index];
+            bool before = o->first + o->count <= keep;
+            bool after = o->first >= resync;
+            size_t first = before ? o->first : o->first - resync + relexed_end;
+            if ((!before && !after) || first < seg->first) {
+                old_index++;
+                continue;
+            }
+            if (first == seg->first && o->count == seg->count && o->last == seg->last && o->header == seg->header) {
+                match = o;
+                old_index++;
+                if (after) {
+                    lsp_shift_segment(o, delta, line_delta);
+                }
+            }
+            break;
+        }
+        if (match) {
+            size_t first = seg->first;
+            *seg = *match;
+            seg->first = first;
+            match->diags = NULL;
+            lsp_stats.reused_segments++;
+        }
+        else {
+            lsp_parse_segment(doc, seg);
+        }
+    }
+    for (LspSegment* it = old_segs; it != BUF_END(old_segs); it++) {
+        lsp_free_diags(it->diags);
+    }
+    BUF_FREE(old_segs);
+    doc->segments = segs;
+    doc->arena = ast_arena;
+    ast_arena = saved_arena;
+    if (full || !doc->full_parse_blocks) {
+        doc->full_parse_blocks = BUF_LEN(doc->arena.blocks);
+    }
+
+    BUF_CLEAR(doc->subs);
+    for (LspSegment* seg = segs + 1; seg != BUF_END(segs); seg++) {
+        if (seg->ok) {
+            BUF_PUSH(doc->subs, seg->sub);
+        }
+    }
+    doc->decl = (ClassDecl) { segs[0].class_name, segs[0].vars, segs[0].num_vars, doc->subs, BUF_LEN(doc->subs) };
+}
+
+Internal LspDoc* lsp_open(const char* uri, const char* text, i64 version) {
+    LspDoc* doc = xcalloc(1, sizeof(LspDoc));
+    doc->uri = strf("%s", uri);
+    doc->version = version;
+    doc->text = strf("%s", "");
+    lsp_change(doc, 0, 0, text, strlen(text));
+    return doc;
+}
+
+Internal void lsp_close(LspDoc* doc) {
+    free_tokens(doc->tokens);
+    lsp_free_diags(doc->lex_diags);
+    for (LspSegment* it = doc->segments; it != BUF_END(doc->segments); it++) {
+        lsp_free_diags(it->diags);
+    }
+    BUF_FREE(doc->segments);
+    BUF_FREE(doc->subs);
+    arena_free(&doc->arena);
+    free(doc->text);
+    free(doc->uri);
+    free(doc);
+}
+
+Internal void lsp_write_diag(char** out, LspDoc* doc, const LspDiag* diag, bool utf8, bool* first) {
+    size_t line_start = diag->offset;
+    while (line_start && doc->text[line_start - 1] != '\n') {
+        line_start--;
+    }
+    i64 line = diag->line - 1;
+    const char* from = doc->text + diag->offset;
+    size_t character = utf8 ? diag->offset - line_start : lsp_utf16_len(doc->text + line_start, from);
+    size_t len = utf8 ? diag->len : lsp_utf16_len(from, diag->offset + diag->len < doc->len ? from + diag->len : doc->text + doc->len);
+    BUF_PRINTF(*out, "%s{\"range\":{\"start\":{\"line\":%lld,\"character\":%zu},\"end\":{\"line\":%lld,\"character\":%zu}},\"severity\":1,\"source\":\"jack\",\"message\":",
+        *first ? "" : ",", (long long)line, character, (long long)line, character + len);
+    json_write_str(out, diag->msg, strlen(diag->msg));
+    BUF_PUSH(*out, '}');
+    *first = false;
+}
+
+Internal void lsp_send(LspServer* server, char* body) {
+    BUF_PRINTF(server->out, "Content-Length: %zu\r\n\r\n%.*s", BUF_LEN(body), (int)BUF_LEN(body), body);
+    BUF_FREE(body);
+}
+
+Internal void lsp_publish(LspServer* server, LspDoc* doc, bool empty) {
+    char* body = NULL;
+    BUF_PRINTF(body, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    json_write_str(&body, doc->uri, strlen(doc->uri));
+    BUF_PRINTF(body, ",\"version\":%lld,\"diagnostics\":[", (long long)doc->version);
+    bool first = true;
+    if (!empty) {
+        for (LspDiag* it = doc->lex_diags; it != BUF_END(doc->lex_diags); it++) {
+            lsp_write_diag(&body, doc, it, server->utf8, &first);
+        }
+        for (LspSegment* seg = doc->segments; seg != BUF_END(doc->segments); seg++) {
+            for (LspDiag* it = seg->diags; it != BUF_END(seg->diags); it++) {
+                lsp_write_diag(&body, doc, it, server->utf8, &first);
+            }
+        }
+        if (doc->unterminated_comment) {
+            size_t line = 1 + lsp_count_lines(doc->text, doc->len);
+            LspDiag diag = { doc->len, 0, (i64)line, "Unterminated comment", 0 };
+            lsp_write_diag(&body, doc, &diag, server->utf8, &first);
+        }
+    }
+    BUF_PRINTF(body, "]}}");
+    lsp_send(server, body);
+}
+
+Internal void lsp_reply(LspServer* server, Json* id, const char* result) {
+    char* body = NULL;
+    BUF_PRINTF(body, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"result\":%s}", (int)id->raw_len, id->raw, result);
+    lsp_send(server, body);
+}
+
+Internal void lsp_reply_error(LspServer* server, Json* id, i32 code, const char* msg) {
+    char* body = NULL;
+    BUF_PRINTF(body, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"error\":{\"code\":%d,\"message\":\"%s\"}}", id ? (int)id->raw_len : 4, id ? id->raw : "null", code, msg);
+    lsp_send(server, body);
+}
+
+Internal LspDoc** lsp_find(LspServer* server, Json* params) {
+    const char* uri = json_str(json_get(json_get(params, "textDocument"), "uri"));
+    for (LspDoc** it = server->docs; uri && it != BUF_END(server->docs); it++) {
+        if (strcmp((*it)->uri, uri) == 0) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+Internal void lsp_did_change(LspServer* server, Json* params) {
+    LspDoc** doc = lsp_find(server, params);
+    Json* changes = json_get(params, "contentChanges");
+    if (!doc || !changes || changes->kind != JSON_ARRAY) {
+        return;
+    }
+    for (size_t i = 0; i < changes->num_items; i++) {
+        Json* change = changes->items[i];
+        Json* text = json_get(change, "text");
+        Json* range = json_get(change, "range");
+        if (!text || text->kind != JSON_STRING) {
+            continue;
+        }
+        size_t start = 0;
+        size_t end = (*doc)->len;
+        if (range) {
+            Json* from = json_get(range, "start");
+            Json* to = json_get(range, "end");
+            start = lsp_offset(*doc, json_int(json_get(from, "line"), 0), json_int(json_get(from, "character"), 0), server->utf8);
+            end = lsp_offset(*doc, json_int(json_get(to, "line"), 0), json_int(json_get(to, "character"), 0), server->utf8);
+        }
+        lsp_change(*doc, start, end, text->str, text->len);
+    }
+    (*doc)->version = json_int(json_get(json_get(params, "textDocument"), "version"), (*doc)->version);
+    lsp_publish(server, *doc, false);
+}
+
+Internal bool lsp_offers_utf8(Json* params) {
+    Json* encodings = json_get(json_get(json_get(params, "capabilities"), "general"), "positionEncodings");
+    for (size_t i = 0; encodings && encodings->kind == JSON_ARRAY && i < encodings->num_items; i++) {
+        const char* encoding = json_str(encodings->items[i]);
+        if (encoding && strcmp(encoding, "utf-8") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//*Handles one message, anything for the client is appended to server->out
+Internal void lsp_handle(LspServer* server, const char* msg) {
+    Arena arena = { 0 };
+    Json* json = json_parse(&arena, msg);
+    if (!json) {
+        lsp_reply_error(server, NULL, -32700, "Parse error");
+        arena_free(&arena);
+        return;
+    }
+    const char* method = json_str(json_get(json, "method"));
+    Json* id = json_get(json, "id");
+    Json* params = json_get(json, "params");
+    if (!method) {
+        //*a response to a request of ours, the server sends none
+    }
+    else if (strcmp(method, "initialize") == 0 && id) {
+        char result[256];
+        server->utf8 = lsp_offers_utf8(params);
+        snprintf(result, sizeof(result), "{\"capabilities\":{%s\"textDocumentSync\":{\"openClose\":true,\"change\":2}},\"serverInfo\":{\"name\":\"jack\"}}",
+            server->utf8 ? "\"positionEncoding\":\"utf-8\"," : "");
+        lsp_reply(server, id, result);
+    }
+    else if (strcmp(method, "shutdown") == 0 && id) {
+        server->shutdown = true;
+        lsp_reply(server, id, "null");
+    }
+    else if (strcmp(method, "exit") == 0) {
+        server->exit = true;
+    }
+    else if (strcmp(method, "textDocument/didOpen") == 0) {
+        Json* doc = json_get(params, "textDocument");
+        const char* uri = json_str(json_get(doc, "uri"));
+        Json* text = json_get(doc, "text");
+        if (uri && text && text->kind == JSON_STRING && !lsp_find(server, params)) {
+            BUF_PUSH(server->docs, lsp_open(uri, text->str, json_int(json_get(doc, "version"), 0)));
+            lsp_publish(server, server->docs[BUF_LEN(server->docs) - 1], false);
+        }
+    }
+    else if (strcmp(method, "textDocument/didChange") == 0) {
+        lsp_did_change(server, params);
+    }
+    else if (strcmp(method, "textDocument/didClose") == 0) {
+        LspDoc** doc = lsp_find(server, params);
+        if (doc) {
+            lsp_publish(server, *doc, true);
+            lsp_close(*doc);
+            *doc = server->docs[BUF_LEN(server->docs) - 1];
+            _BUF_HDR(server->docs)->len--;
+        }
+    }
+    else if (id) {
+        lsp_reply_error(server, id, -32601, "Method not found");
+    }
+    arena_free(&arena);
+}
+
+//*one message body, NULL at the end of the input
+Internal char* lsp_read_message(FILE* in) {
+    char header[256];
+    size_t len = 0;
+    bool has_len = false;
+    while (fgets(header, sizeof(header), in)) {
+        if (strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0) {
+            if (!has_len) {
+                continue;
+            }
+            char* body = xmalloc(len + 1);
+            if (fread(body, 1, len, in) != len) {
+                free(body);
+                return NULL;
+            }
+            body[len] = 0;
+            return body;
+        }
+        if (strncmp(header, "Content-Length:", strlen("Content-Length:")) == 0) {
+            len = strtoul(header + strlen("Content-Length:"), NULL, 10);
+            has_len = true;
+        }
+    }
+    return NULL;
+}
+
+//*Serves until `exit`, returns the process exit code the protocol asks for
+Internal int lsp_serve(void) {
+#if _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    init_keywords();
+    lex_collect_diags = true;
+    LspServer server = { 0 };
+    while (!server.exit) {
+        char* msg = lsp_read_message(stdin);
+        if (!msg) {
+            break;
+        }
+        lsp_handle(&server, msg);
+        free(msg);
+        fwrite(server.out, 1, BUF_LEN(server.out), stdout);
+        fflush(stdout);
+        BUF_CLEAR(server.out);
+    }
+    for (LspDoc** it = server.docs; it != BUF_END(server.docs); it++) {
+        lsp_close(*it);
+    }
+    BUF_FREE(server.docs);
+    BUF_FREE(server.out);
+    return server.shutdown ? 0 : 1;
+}
+
+//*the document tokens and diagnostics have to be what opening the text afresh gives
+Internal void lsp_check_doc(LspDoc* doc) {
+    LspDoc* fresh = lsp_open("fresh", doc->text, 0);
+    assert(BUF_LEN(fresh->tokens) == BUF_LEN(doc->tokens));
+    for (size_t i = 0; i < BUF_LEN(doc->tokens); i++) {
+        Token* a = &doc->tokens[i];
+        Token* b = &fresh->tokens[i];
+        assert(a->kind == b->kind && a->pos.line == b->pos.line);
+        assert(a->start - doc->text == b->start - fresh->text && a->end - doc->text == b->end - fresh->text);
+    }
+    assert(BUF_LEN(fresh->lex_diags) == BUF_LEN(doc->lex_diags));
+    for (size_t i = 0; i < BUF_LEN(doc->lex_diags); i++) {
+        assert(doc->lex_diags[i].offset == fresh->lex_diags[i].offset && doc->lex_diags[i].line == fresh->lex_diags[i].line && doc->lex_diags[i].owner == fresh->lex_diags[i].owner);
+    }
+    assert(BUF_LEN(fresh->segments) == BUF_LEN(doc->segments));
+    for (size_t i = 0; i < BUF_LEN(doc->segments); i++) {
+        LspSegment* a = &doc->segments[i];
+        LspSegment* b = &fresh->segments[i];
+        assert(a->first == b->first && a->count == b->count && a->ok == b->ok && BUF_LEN(a->diags) == BUF_LEN(b->diags));
+        for (size_t j = 0; j < BUF_LEN(a->diags); j++) {
+            assert(a->diags[j].offset == b->diags[j].offset && a->diags[j].line == b->diags[j].line);
+            assert(strcmp(a->diags[j].msg, b->diags[j].msg) == 0);
+        }
+        if (a->ok && !a->header) {
+            assert(a->sub.name == b->sub.name && a->sub.block.num_stmts == b->sub.block.num_stmts);
+            for (size_t j = 0; j < a->sub.block.num_stmts; j++) {
+                assert(a->sub.block.stmts[j]->pos.line == b->sub.block.stmts[j]->pos.line);
+            }
+        }
+    }
+    assert(doc->unterminated_comment == fresh->unterminated_comment);
+    lsp_close(fresh);
+}
+
+Internal void lsp_tests(void) {
+    init_keywords();
+    bool collect = lex_collect_diags;
+    lex_collect_diags = true;
+    const char* src =
+        "class Counter {\n"
+        "    field int count;\n"
+        "    method void inc() {\n"
+        "        let count = count + 1;\n"
+        "        return;\n"
+        "    }\n"
+        "    method int get() {\n"
+        "        return count;\n"
+        "    }\n"
+        "    function void reset(Counter c) {\n"
+        "        do c.set(0);\n"
+        "        return;\n"
+        "    }\n"
+        "}\n";
+    LspDoc* doc = lsp_open("counter.jack", src, 1);
+    assert(BUF_LEN(doc->segments) == 4 && doc->decl.num_subs == 3 && doc->decl.name == str_intern("Counter"));
+
+    //*a syntax error in get() leaves the other subroutines alone
+    lsp_stats = (LspStats) { 0 };
+    size_t at = lsp_offset(doc, 7, 15, true);
+    assert(strncmp(doc->text + at, "count;", 6) == 0);
+    lsp_change(doc, at, at, "+ ", 2);
+    assert(lsp_stats.reparsed_segments == 1 && lsp_stats.reused_segments == 3 && lsp_stats.relexed_tokens == 1);
+    assert(doc->decl.num_subs == 2 && BUF_LEN(doc->segments[2].diags) == 1 && doc->segments[2].diags[0].line == 8);
+    lsp_check_doc(doc);
+    lsp_change(doc, at, at + 2, "", 0);
+    assert(doc->decl.num_subs == 3 && !BUF_LEN(doc->segments[2].diags));
+    lsp_check_doc(doc);
+
+    //*lines added at the top move everything below without reparsing it
+    lsp_stats = (LspStats) { 0 };
+    lsp_change(doc, 0, 0, "// note\n\n", 9);
+    assert(lsp_stats.reparsed_segments == 0 && lsp_stats.relexed_tokens == 0);
+    assert(doc->decl.subs[2].block.stmts[0]->pos.line == 13);
+    lsp_check_doc(doc);
+
+    //*an unterminated comment swallows the rest including the closing brace, removing it brings
+    //*everything back
+    at = lsp_offset(doc, 6, 0, true);
+    lsp_change(doc, at, at, "/*", 2);
+    assert(doc->unterminated_comment && doc->decl.num_subs == 0 && BUF_LEN(doc->segments) == 2);
+    lsp_check_doc(doc);
+    lsp_change(doc, at, at + 2, "", 0);
+    assert(!doc->unterminated_comment && doc->decl.num_subs == 3);
+    lsp_check_doc(doc);
+
+    //*random edits, each checked against lexing and parsing the text afresh
+    LocalPersist const char* snippets[] = { "", " ", "\n", "x", "1", "\"s", "\"", "/*", "*/", "//", "}", "{", "method void m() {", "return;", "#", "let a = 2;" };
+    u64 state = 0x2545f4914f6cdd1d;
+    for (size_t i = 0; i < 300; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t start = (size_t)(state % (doc->len + 1));
+        size_t end = start + (size_t)((state >> 20) % 4);
+        const char* ins = snippets[(state >> 40) % (sizeof(snippets) / sizeof(snippets[0]))];
+        lsp_change(doc, start, end, ins, strlen(ins));
+        lsp_check_doc(doc);
+    }
+    lsp_close(doc);
+
+    //*the protocol
+    LspServer server = { 0 };
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",\"params\":{\"capabilities\":{\"general\":{\"positionEncodings\":[\"utf-16\",\"utf-8\"]}}}}");
+    assert(strstr(server.out, "\"id\":1,\"result\":{\"capabilities\":{\"positionEncoding\":\"utf-8\","));
+    BUF_CLEAR(server.out);
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":{\"uri\":\"file:///A.jack\",\"version\":1,\"text\":\"class A {\\n  function void f() {\\n    return\\n  }\\n}\\n\"}}}");
+    BUF_PUSH(server.out, 0);
+    assert(strstr(server.out, "\"diagnostics\":[{\"range\":{\"start\":{\"line\":3,\"character\":2},\"end\":{\"line\":3,\"character\":3}},\"severity\":1"));
+    BUF_CLEAR(server.out);
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":{\"uri\":\"file:///A.jack\",\"version\":2},\"contentChanges\":[{\"range\":{\"start\":{\"line\":2,\"character\":10},\"end\":{\"line\":2,\"character\":10}},\"text\":\";\"}]}}");
+    BUF_PUSH(server.out, 0);
+    assert(strstr(server.out, "\"version\":2,\"diagnostics\":[]"));
+    BUF_CLEAR(server.out);
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"id\":\"x\",\"method\":\"textDocument/hover\",\"params\":{}}");
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"shutdown\"}");
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}");
+    BUF_PUSH(server.out, 0);
+    assert(strstr(server.out, "\"id\":\"x\",\"error\":{\"code\":-32601") && strstr(server.out, "\"id\":2,\"result\":null"));
+    assert(server.shutdown && server.exit);
+    lsp_close(server.docs[0]);
+    BUF_FREE(server.docs);
+    BUF_FREE(server.out);
+
+    //*without utf-8 columns are utf-16 code units, U+00E9 takes one for its two bytes and U+1F600 two
+    //*for its four
+    server = (LspServer) { 0 };
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",\"params\":{\"capabilities\":{}}}");
+    assert(!server.utf8);
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":{\"uri\":\"file:///B.jack\",\"version\":1,\"text\":\"class B {\\n  function void f() {\\n    /* \xc3\xa9\xf0\x9f\x98\x80 */ return\\n  }\\n}\\n\"}}}");
+    BUF_CLEAR(server.out);
+    lsp_handle(&server, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":{\"uri\":\"file:///B.jack\",\"version\":2},\"contentChanges\":[{\"range\":{\"start\":{\"line\":2,\"character\":20},\"end\":{\"line\":2,\"character\":20}},\"text\":\" #\"}]}}");
+    BUF_PUSH(server.out, 0);
+    assert(strstr(server.docs[0]->text, "*/ return #\n"));
+    assert(strstr(server.out, "\"range\":{\"start\":{\"line\":2,\"character\":21},\"end\":{\"line\":2,\"character\":22}}"));
+    lsp_close(server.docs[0]);
+    BUF_FREE(server.docs);
+    BUF_FREE(server.out);
+    lex_collect_diags = collect;
+}
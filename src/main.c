@@ -1,7 +1,31 @@
+#if !_WIN32
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
+#endif
+#if __linux__
+//*syscall() for io_uring and perf_event_open
+#define _DEFAULT_SOURCE
+#endif
 #if _WIN32
 #include "vendor/dirent.h"
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
 #else
 #include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #endif
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,136 +34,223 @@
 #include <assert.h>
 #include <stddef.h>
 #include <errno.h>
+#include <time.h>
+#include <setjmp.h>
+#if _MSC_VER
+#include <intrin.h>
+#endif
 #include "types.h"
 #include "common.c"
+#include "thread.c"
+#include "json.c"
+#include "trace.c"
+#include "perf.c"
 #include "lex.c"
+#include "lex_parallel.c"
+#include "tokbin.h"
+#include "tokbin.c"
 #include "ast.h"
 #include "ast.c"
 #include "print.c"
 #include "parse.c"
+#include "xml.c"
+#include "fold.c"
+#include "sym.c"
+#include "gen.c"
+#include "opt.c"
+#include "inline.c"
+#include "prune.c"
+#include "asm.c"
+#include "interp.c"
+#include "uring.c"
+#include "walk.c"
+#include "lsp.c"
+#include "driver.c"
+#include "fuzz.c"
+#include "bench.c"
 
 
 Internal void tests(void) {
     init_keywords();
     //common_tests();
     //lex_tests();
+    //thread_tests();
+    //lex_parallel_tests();
+    //sym_tests();
+    //gen_tests();
+    //tokbin_tests();
+    //opt_tests();
+    //fold_tests();
+    //inline_tests();
+    //prune_tests();
+    //asm_tests();
+    //interp_tests();
+    //uring_tests();
+    //walk_tests();
+    //json_tests();
+    //trace_tests();
+    //perf_tests();
+    //lsp_tests();
+    //fuzz_tests();
     parse_tests();
     printf("tests complete\n");
 }
 
-Internal int is_dir_error(void) {
-    switch (errno) {
-        case EACCES:
-        case EBADF:
-        case EMFILE:
-        case ENFILE:
-        case ENOENT:
-        case ENOMEM:
-        case ENOTDIR: {
-            return errno;
-        }
-        default: {
-            return 0;
-        }
+//*a libFuzzer build brings its own main, see fuzz.c
+#if !FUZZ_LIBFUZZER
+int main(int argc, char* argv[]) {
+    //*stdout carries the protocol then, nothing else may be printed
+    if (argc == 2 && strcmp(argv[1], "--lsp") == 0) {
+        return lsp_serve();
+    }
+    if (argc == 3 && strncmp(argv[1], "--fuzz=", strlen("--fuzz=")) == 0) {
+        return fuzz_main(argv[1] + strlen("--fuzz="), argv[2]);
     }
-}
 
-int main(int argc, char* argv[]) {
     printf("Starting compiler\n");
 
     tests();
 
     const char* path = NULL;
-    if (argc == 2) {
-        path = argv[1];
-    }
-    else if (argc > 2) {
-        fatal("Too many arguments supplied");
-    }
-    else {
-        fatal("One argument expected");
-    }
-
-    DIR* dir = opendir(path);
-
-    if (dir) {
-        struct dirent* de = readdir(dir);
-        size_t pathlen = strlen(path);
-        bool found_valid_jackfile = false;
-        for (; de; de = readdir(dir)) {
-            const char* ext = get_extension(de->d_name);
-            bool is_valid_jackfile = check_jack_extension(ext);
-
-            if (!is_valid_jackfile) {
-                continue;
+    bool run_bench = false;
+    options.optimize = true;
+    options.run_limit = INTERP_DEFAULT_LIMIT;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--bench") == 0) {
+            run_bench = true;
+        }
+        else if (strncmp(arg, "--pipeline=", strlen("--pipeline=")) == 0) {
+            options.pipeline_depth = strtoul(arg + strlen("--pipeline="), NULL, 10);
+            if (!options.pipeline_depth) {
+                fatal("Pipeline depth must be at least 1");
             }
-
-            found_valid_jackfile = true;
-
-            size_t filelen = strlen(de->d_name);
-            size_t filepath_len = pathlen + 1 + filelen;
-
-            char* filepath = NULL;
-            BUF_PRINTF(filepath, path);
-            if (path[pathlen - 1] != '/') {
-                BUF_PRINTF(filepath, "/");
+        }
+        else if (strcmp(arg, "--stream") == 0) {
+            options.stream_window = LEX_WINDOW_SIZE;
+        }
+        else if (strncmp(arg, "--stream=", strlen("--stream=")) == 0) {
+            options.stream_window = strtoul(arg + strlen("--stream="), NULL, 10) * 1024;
+            if (!options.stream_window) {
+                fatal("Stream window must be at least 1 KiB");
             }
-
-            char* out_filepath = xcalloc(pathlen + 1 + (ext - de->d_name) + 1 + strlen("xml") + 1, sizeof(char));
-            strcpy(out_filepath, filepath);
-
-            BUF_PRINTF(filepath, de->d_name);
-            // printf("filepath: %s\n", filepath);
-
-            const char* filestream = read_file(filepath);
-            printf("%s\n", filestream);
-
-            lex(filestream);
-
-            //TODO: change output filename to `filenameT.xml`
-            strncat(out_filepath, de->d_name, ext - de->d_name - 1);
-            strcat(out_filepath, "TT.");
-            strcat(out_filepath, "xml");
-            printf("filename: %s\n", out_filepath);
-
-            write_file(out_filepath, file_buf, BUF_LEN(file_buf));
-
-            free(out_filepath);
-            BUF_FREE(filepath);
-            BUF_FREE(file_buf);
         }
-
-        if (!found_valid_jackfile) {
-            printf("No .jack file found in directory\n");
+        else if (strcmp(arg, "--whole-program") == 0) {
+            options.whole_program = true;
+        }
+        else if (strcmp(arg, "--inline") == 0) {
+            options.inline_budget = INLINE_DEFAULT_BUDGET;
+        }
+        else if (strncmp(arg, "--inline=", strlen("--inline=")) == 0) {
+            options.inline_budget = strtoul(arg + strlen("--inline="), NULL, 10);
+        }
+        else if (strcmp(arg, "--run") == 0) {
+            options.run = true;
         }
+        else if (strncmp(arg, "--run-limit=", strlen("--run-limit=")) == 0) {
+            options.run = true;
+            options.run_limit = strtoull(arg + strlen("--run-limit="), NULL, 10);
+        }
+        else if (strncmp(arg, "--run-input=", strlen("--run-input=")) == 0) {
+            options.run = true;
+            options.run_input = arg + strlen("--run-input=");
+        }
+        else if (strcmp(arg, "--io-uring") == 0) {
+            options.io_uring = true;
+        }
+        else if (strncmp(arg, "--trace=", strlen("--trace=")) == 0) {
+            options.trace_path = arg + strlen("--trace=");
+        }
+        else if (strcmp(arg, "--perf-counters") == 0) {
+            options.perf_counters = true;
+        }
+        else if (strcmp(arg, "--no-opt") == 0) {
+            options.optimize = false;
+        }
+        else if (strncmp(arg, "--emit=", strlen("--emit=")) == 0) {
+            options.emits = parse_emit_list(arg + strlen("--emit="));
+        }
+        else if (strncmp(arg, "--lex-threads=", strlen("--lex-threads=")) == 0) {
+            options.lex_threads = strtoul(arg + strlen("--lex-threads="), NULL, 10);
+        }
+        else if (strcmp(arg, "--lex-threads") == 0) {
+            options.lex_threads = num_cpus();
+        }
+        else if (arg[0] == '-' && arg[1] == '-') {
+            fatal("Unknown flag: %s", arg);
+        }
+        else if (path) {
+            fatal("Too many arguments supplied");
+        }
+        else {
+            path = arg;
+        }
+    }
 
-        closedir(dir);
+    if (!path) {
+        fatal("One argument expected");
     }
-    else {
-        if (is_dir_error() != ENOTDIR) {
-            perror("Error");
-            exit(1);
-        }
 
-        const char* ext = get_extension(path);
-        bool is_valid_jackfile = check_jack_extension(ext);
+    if (run_bench) {
+        bench(path);
+        return 0;
+    }
 
-        if (!is_valid_jackfile) {
-            fatal("File is not a .jack file");
-        }
+    if (!options.emits && !options.run) {
+        options.emits = EMIT_BIT(EMIT_TOKENS);
+    }
+    if (options.stream_window && (options.emits & EMIT_BIT(EMIT_TOKENS_BIN))) {
+        fatal("--emit=tokens-bin writes its string table up front and cannot be used with --stream");
+    }
 
-        const char* filestream = read_file(path);
-        printf("%s", filestream);
-        lex(filestream);
+    //*the assembly of all classes goes into one file
+    if ((options.emits & EMIT_BIT(EMIT_ASM)) || options.run) {
+        options.whole_program = true;
+    }
+    if (options.whole_program && !needs_vm()) {
+        fatal("--whole-program only changes vm and asm output, use it with --emit=vm or --emit=asm");
+    }
+    if (options.whole_program && (options.stream_window || options.pipeline_depth)) {
+        fatal("--whole-program and --emit=asm hold every class until the end and cannot be used with --stream or --pipeline");
+    }
 
-        char* out_filepath = xcalloc(ext - path + 1 + strlen("xml") + 1, sizeof(char));
-        strncpy(out_filepath, path, ext - path - 1);
-        strcat(out_filepath, "TT.");
-        strcat(out_filepath, "xml");
-        printf("filename: %s\n", out_filepath);
-        write_file(out_filepath, file_buf, BUF_LEN(file_buf));
+    //*the counters only see the thread that opens them
+    if (options.perf_counters && (options.stream_window || options.pipeline_depth || options.lex_threads > 1)) {
+        fatal("--perf-counters counts the main thread only and cannot be used with --stream, --pipeline or --lex-threads");
+    }
 
-        free(out_filepath);
-        BUF_FREE(file_buf);
+    if (options.perf_counters) {
+        perf_init();
+    }
+    if (options.trace_path) {
+        trace_init();
+        trace_thread_name("main");
+    }
+    CompileJob* jobs = collect_jobs(path);
+    init_io();
+    if (options.whole_program) {
+        compile_whole_program(path, jobs, BUF_LEN(jobs));
+    }
+    else if (options.stream_window) {
+        compile_streaming(jobs, BUF_LEN(jobs), options.stream_window);
     }
-}
\ No newline at end of file
+    else if (options.pipeline_depth) {
+        compile_pipelined(jobs, BUF_LEN(jobs), options.pipeline_depth);
+    }
+    else {
+        compile_sequential(jobs, BUF_LEN(jobs));
+    }
+    finish_io();
+    if (options.trace_path) {
+        trace_write(options.trace_path);
+    }
+    if (options.perf_counters) {
+        perf_report();
+        perf_close();
+    }
+    if (options.inline_budget && (options.emits & EMIT_BIT(EMIT_VM))) {
+        printf("inline: %zu call sites, %zu -> %zu vm instructions\n", inline_stats.sites, inline_stats.insts_before, inline_stats.insts_after);
+    }
+    BUF_FREE(jobs);
+}
+#endif
@@ -0,0 +1,447 @@
+//*Peephole optimisation of generated VM code. Every instruction costs Hack cycles on the emulator, so
+//*the passes only ever shrink the code or the instructions executed per loop iteration. They run per
+//*function since labels are scoped to their function, and repeat until nothing changes:
+//*    peep_function(): local rewrites at the tail of the output (constant folding, push/pop pairs,
+//*                     double negation, constant branches)
+//*    flip_branches(): `not; if-goto` of if/else and while shapes into branches on the condition,
+//*                     where the condition is known to be 0 or -1
+//*    thread_jumps():  jumps to jumps, jumps to the next instruction, dead code and unused labels
+
+typedef struct VmOptStats {
+    size_t insts_before;
+    size_t insts_after;
+} VmOptStats;
+
+VmOptStats vm_opt_stats;
+
+Internal bool is_vm_jump(VmOp op) {
+    return op == VM_GOTO || op == VM_IF_GOTO;
+}
+
+Internal bool same_vm_label(const VmInst* a, const VmInst* b) {
+    return a->name == b->name && a->arg == b->arg;
+}
+
+Internal bool is_push_constant(const VmInst* inst) {
+    return inst->op == VM_PUSH && inst->seg == SEG_CONSTANT;
+}
+
+//*Recognises a constant at the end of `code`: `push constant c`, optionally followed by `neg` or `not`,
+//*which is how constants outside 0..32767 have to be written. Returns the number of instructions.
+Internal size_t vm_tail_constant(VmInst* code, size_t end, i16* val) {
+    if (end >= 1 && is_push_constant(&code[end - 1])) {
+        *val = (i16)code[end - 1].arg;
+        return 1;
+    }
+    if (end >= 2 && is_push_constant(&code[end - 2])) {
+        if (code[end - 1].op == VM_NEG) {
+            *val = (i16)-code[end - 2].arg;
+            return 2;
+        }
+        if (code[end - 1].op == VM_NOT) {
+            *val = (i16)~code[end - 2].arg;
+            return 2;
+        }
+    }
+    return 0;
+}
+
+//*16 bit semantics of the Hack ALU, Math.multiply and Math.divide, returns false if it cannot be folded
+Internal bool vm_fold_binary(const VmInst* inst, i16 a, i16 b, i16* result) {
+    switch (inst->op) {
+        case VM_ADD: *result = (i16)(a + b); return true;
+        case VM_SUB: *result = (i16)(a - b); return true;
+        case VM_AND: *result = a & b; return true;
+        case VM_OR: *result = a | b; return true;
+        case VM_EQ: *result = a == b ? -1 : 0; return true;
+        case VM_LT: *result = a < b ? -1 : 0; return true;
+        case VM_GT: *result = a > b ? -1 : 0; return true;
+        case VM_CALL: {
+            if (inst->arg != 2) {
+                return false;
+            }
+            if (inst->name == math_multiply_name) {
+                *result = (i16)(a * b);
+                return true;
+            }
+            if (inst->name == math_divide_name && b != 0 && a != -32768) {
+                *result = (i16)(a / b);
+                return true;
+            }
+            return false;
+        }
+        default: return false;
+    }
+}
+
+//*appends `inst` to `out`, rewriting it together with what is already at the end of `out`
+Internal void peep_push(VmInst** out, VmInst inst) {
+    size_t len = BUF_LEN(*out);
+    i16 b;
+    size_t b_len = vm_tail_constant(*out, len, &b);
+    switch (inst.op) {
+        case VM_ADD:
+        case VM_SUB:
+        case VM_AND:
+        case VM_OR:
+        case VM_EQ:
+        case VM_LT:
+        case VM_GT:
+        case VM_CALL: {
+            i16 a;
+            size_t a_len = b_len ? vm_tail_constant(*out, len - b_len, &a) : 0;
+            i16 result;
+            if (a_len && vm_fold_binary(&inst, a, b, &result)) {
+                _BUF_HDR(*out)->len -= a_len + b_len;
+                vm_push_constant(out, result);
+                return;
+            }
+            break;
+        }
+        case VM_NEG:
+        case VM_NOT: {
+            if (b_len) {
+                _BUF_HDR(*out)->len -= b_len;
+                vm_push_constant(out, inst.op == VM_NEG ? (i16)-b : (i16)~b);
+                return;
+            }
+            if (len && (*out)[len - 1].op == inst.op) {
+                _BUF_HDR(*out)->len--;
+                return;
+            }
+            break;
+        }
+        case VM_POP: {
+            VmInst* last = len ? &(*out)[len - 1] : NULL;
+            if (last && last->op == VM_PUSH && last->seg == inst.seg && last->arg == inst.arg) {
+                _BUF_HDR(*out)->len--;
+                return;
+            }
+            break;
+        }
+        case VM_IF_GOTO: {
+            if (b_len) {
+                _BUF_HDR(*out)->len -= b_len;
+                if (b) {
+                    inst.op = VM_GOTO;
+                    BUF_PUSH(*out, inst);
+                }
+                return;
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    BUF_PUSH(*out, inst);
+}
+
+Internal void peep_function(VmInst** code) {
+    VmInst* out = NULL;
+    BUF_FIT(out, BUF_LEN(*code));
+    for (size_t i = 0; i < BUF_LEN(*code); i++) {
+        peep_push(&out, (*code)[i]);
+    }
+    BUF_FREE(*code);
+    *code = out;
+}
+
+Internal size_t find_vm_label(VmInst* code, const VmInst* jump) {
+    for (size_t i = 0; i < BUF_LEN(code); i++) {
+        if (code[i].op == VM_LABEL && same_vm_label(&code[i], jump)) {
+            return i;
+        }
+    }
+    return BUF_LEN(code);
+}
+
+Internal size_t count_vm_jumps(VmInst* code, const VmInst* label) {
+    size_t n = 0;
+    for (size_t i = 0; i < BUF_LEN(code); i++) {
+        n += is_vm_jump(code[i].op) && same_vm_label(&code[i], label);
+    }
+    return n;
+}
+
+Internal void append_vm_range(VmInst** out, VmInst* start, VmInst* end) {
+    for (VmInst* it = start; it != end; it++) {
+        BUF_PUSH(*out, *it);
+    }
+}
+
+//*Start of the straight line code that leaves the value on top of the stack at `end`, `end` when it is
+//*not one. Code that pops to memory on the way, as array reads do, is not followed.
+Internal size_t vm_expr_start(VmInst* code, size_t end) {
+    i32 need = 1;
+    for (size_t i = end; i > 0; i--) {
+        VmInst* inst = &code[i - 1];
+        switch (inst->op) {
+            case VM_PUSH: need--; break;
+            case VM_NEG:
+            case VM_NOT: break;
+            case VM_ADD:
+            case VM_SUB:
+            case VM_AND:
+            case VM_OR:
+            case VM_EQ:
+            case VM_LT:
+            case VM_GT: need++; break;
+            case VM_CALL: need += inst->arg - 1; break;
+            default: return end;
+        }
+        if (need == 0) {
+            return i - 1;
+        }
+    }
+    return end;
+}
+
+//*True when the value on top of the stack at `end` is known to be 0 or -1. Only for those is
+//*`not; if-goto` the inverse of `if-goto`, which jumps on any value other than 0.
+Internal bool vm_is_boolean(VmInst* code, size_t end) {
+    i16 val;
+    if (vm_tail_constant(code, end, &val)) {
+        return val == 0 || val == -1;
+    }
+    if (end == 0) {
+        return false;
+    }
+    switch (code[end - 1].op) {
+        case VM_EQ:
+        case VM_LT:
+        case VM_GT: return true;
+        case VM_NOT: return vm_is_boolean(code, end - 1);
+        case VM_AND:
+        case VM_OR: {
+            size_t right = vm_expr_start(code, end - 1);
+            return right != end - 1 && vm_is_boolean(code, end - 1) && vm_is_boolean(code, right);
+        }
+        default: return false;
+    }
+}
+
+//*`not; if-goto F; then; goto E; label F; else; label E` becomes `if-goto F; else; goto E; label F;
+//*then; label E`, the blocks swap places and the `not` goes away
+Internal bool flip_if_else(VmInst** code, size_t i) {
+    VmInst* c = *code;
+    size_t f = find_vm_label(c, &c[i + 1]);
+    if (f == BUF_LEN(c) || f < i + 3 || c[f - 1].op != VM_GOTO || count_vm_jumps(c, &c[f]) != 1) {
+        return false;
+    }
+    size_t e = find_vm_label(c, &c[f - 1]);
+    if (e == BUF_LEN(c) || e < f || count_vm_jumps(c, &c[e]) != 1) {
+        return false;
+    }
+
+    VmInst* out = NULL;
+    BUF_FIT(out, BUF_LEN(c));
+    append_vm_range(&out, c, c + i);
+    BUF_PUSH(out, c[i + 1]);
+    append_vm_range(&out, c + f + 1, c + e);
+    BUF_PUSH(out, c[f - 1]);
+    BUF_PUSH(out, c[f]);
+    append_vm_range(&out, c + i + 2, c + f - 1);
+    append_vm_range(&out, c + e, BUF_END(c));
+    BUF_FREE(*code);
+    *code = out;
+    return true;
+}
+
+//*`label W; cond; not; if-goto E; body; goto W; label E` becomes `goto W; label B; body; label W;
+//*cond; if-goto B; label E`, which is the same size but runs two instructions less per iteration
+Internal bool rotate_loop(VmInst** code, size_t k) {
+    VmInst* c = *code;
+    size_t w = k;
+    while (w > 0 && !(c[w - 1].op == VM_LABEL || is_vm_jump(c[w - 1].op) || c[w - 1].op == VM_RETURN || c[w - 1].op == VM_FUNCTION)) {
+        w--;
+    }
+    if (w == 0 || c[w - 1].op != VM_LABEL) {
+        return false;
+    }
+    w--;
+    //*the body label is numbered after the loop's, labels read from a .vm file have no number
+    if (c[w].arg < 0) {
+        return false;
+    }
+    size_t e = find_vm_label(c, &c[k + 1]);
+    if (e == BUF_LEN(c) || e < k + 3 || c[e - 1].op != VM_GOTO || !same_vm_label(&c[e - 1], &c[w]) || count_vm_jumps(c, &c[e]) != 1) {
+        return false;
+    }
+
+    VmInst body = { VM_LABEL, 0, c[w].arg, while_body_label };
+    VmInst* out = NULL;
+    BUF_FIT(out, BUF_LEN(c));
+    append_vm_range(&out, c, c + w);
+    BUF_PUSH(out, (VmInst) { VM_GOTO, 0, c[w].arg, c[w].name });
+    BUF_PUSH(out, body);
+    append_vm_range(&out, c + k + 2, c + e - 1);
+    BUF_PUSH(out, c[w]);
+    append_vm_range(&out, c + w + 1, c + k);
+    BUF_PUSH(out, (VmInst) { VM_IF_GOTO, 0, body.arg, body.name });
+    append_vm_range(&out, c + e, BUF_END(c));
+    BUF_FREE(*code);
+    *code = out;
+    return true;
+}
+
+Internal bool flip_branches(VmInst** code) {
+    bool changed = false;
+    for (size_t i = 0; i + 1 < BUF_LEN(*code); i++) {
+        if ((*code)[i].op == VM_NOT && (*code)[i + 1].op == VM_IF_GOTO && vm_is_boolean(*code, i)) {
+            changed |= flip_if_else(code, i) || rotate_loop(code, i);
+        }
+    }
+    return changed;
+}
+
+Internal bool thread_jumps(VmInst** code) {
+    VmInst* c = *code;
+    size_t len = BUF_LEN(c);
+    bool changed = false;
+
+    //*jumps to an unconditional jump go straight to its target, the hop count guards against cycles
+    for (size_t i = 0; i < len; i++) {
+        if (!is_vm_jump(c[i].op)) {
+            continue;
+        }
+        for (size_t hops = 0; hops < len; hops++) {
+            size_t t = find_vm_label(c, &c[i]);
+            while (t < len && c[t].op == VM_LABEL) {
+                t++;
+            }
+            if (t == len || c[t].op != VM_GOTO || same_vm_label(&c[t], &c[i])) {
+                break;
+            }
+            c[i].name = c[t].name;
+            c[i].arg = c[t].arg;
+            changed = true;
+        }
+    }
+
+    VmInst* out = NULL;
+    BUF_FIT(out, len);
+    for (size_t i = 0; i < len; i++) {
+        //*a goto to the label right behind it
+        if (c[i].op == VM_GOTO) {
+            size_t t = i + 1;
+            while (t < len && c[t].op == VM_LABEL && !same_vm_label(&c[t], &c[i])) {
+                t++;
+            }
+            if (t < len && c[t].op == VM_LABEL) {
+                changed = true;
+                continue;
+            }
+        }
+        if (c[i].op == VM_LABEL && !count_vm_jumps(c, &c[i])) {
+            changed = true;
+            continue;
+        }
+        BUF_PUSH(out, c[i]);
+        //*code behind a goto or return is unreachable up to the next label
+        if (c[i].op == VM_GOTO || c[i].op == VM_RETURN) {
+            while (i + 1 < len && c[i + 1].op != VM_LABEL) {
+                i++;
+                changed = true;
+            }
+        }
+    }
+    BUF_FREE(*code);
+    *code = out;
+    return changed;
+}
+
+Internal void optimize_function(VmInst** code) {
+    bool changed = true;
+    while (changed) {
+        peep_function(code);
+        changed = flip_branches(code);
+        changed |= thread_jumps(code);
+    }
+}
+
+//*Optimises the code of a class in place
+Internal void vm_optimize(VmInst** code) {
+    init_gen();
+    VmInst* in = *code;
+    VmInst* out = NULL;
+    VmInst* func = NULL;
+    for (size_t start = 0; start < BUF_LEN(in);) {
+        size_t end = start + 1;
+        while (end < BUF_LEN(in) && in[end].op != VM_FUNCTION) {
+            end++;
+        }
+        BUF_CLEAR(func);
+        append_vm_range(&func, in + start, in + end);
+        optimize_function(&func);
+        append_vm_range(&out, func, BUF_END(func));
+        start = end;
+    }
+    vm_opt_stats.insts_before += BUF_LEN(in);
+    vm_opt_stats.insts_after += BUF_LEN(out);
+    BUF_FREE(func);
+    BUF_FREE(in);
+    *code = out;
+}
+
+Internal char* vm_text(VmInst* code) {
+    Writer w = writer_new(NULL);
+    vm_write(&w, code, BUF_LEN(code));
+    writer_close(&w);
+    BUF_PUSH(w.mem, 0);
+    return w.mem;
+}
+
+Internal void opt_tests(void) {
+    init_keywords();
+    init_stream("opt_tests", "class O { function int f(int x) { var int y; let y = y; let x = (2 + 3) * 4 - 21; if (x = 1) { let x = -x; } else { let y = 1; } while (x < 10) { let x = x + 1; } while (true) { if (x) { return x; } } return ~true; } }");
+    VmInst* code = gen_class(parse_class());
+    vm_optimize(&code);
+    char* text = vm_text(code);
+    const char* expected =
+        "function O.f 1\n"
+        //*let y = y is gone and the constant folds to -1
+        "push constant 0\nnot\npop argument 0\n"
+        //*the if/else blocks swap so the condition is tested without `not`
+        "push argument 0\npush constant 1\neq\nif-goto IF_FALSE0\npush constant 1\npop local 0\ngoto WHILE_EXP1\n"
+        "label IF_FALSE0\npush argument 0\nneg\npop argument 0\n"
+        //*the loop is rotated and both if/else exits thread to its condition
+        "goto WHILE_EXP1\nlabel WHILE_BODY1\npush argument 0\npush constant 1\nadd\npop argument 0\n"
+        "label WHILE_EXP1\npush argument 0\npush constant 10\nlt\nif-goto WHILE_BODY1\n"
+        //*while (true) loses its condition, the if inside jumps straight back and the last return is dead
+        "label WHILE_EXP2\npush argument 0\nnot\nif-goto WHILE_EXP2\npush argument 0\nreturn\n";
+    assert(strcmp(text, expected) == 0);
+    BUF_FREE(text);
+    BUF_FREE(code);
+
+    //*an int condition of 1 takes the else branch and leaves the loop, so the `not` has to stay
+    init_stream("opt_tests", "class O { function void f(int b) { var int a, c; if (b) { let a = 1; } else { let c = 3; } while (b & 1) { let a = a + 1; } "
+        "while ((b < 1) | ~(b = 2)) { let a = a - 1; } return; } }");
+    code = gen_class(parse_class());
+    vm_optimize(&code);
+    text = vm_text(code);
+    expected =
+        "function O.f 2\n"
+        "push argument 0\nnot\nif-goto IF_FALSE0\npush constant 1\npop local 0\ngoto IF_END0\n"
+        "label IF_FALSE0\npush constant 3\npop local 1\nlabel IF_END0\n"
+        "label WHILE_EXP1\npush argument 0\npush constant 1\nand\nnot\nif-goto WHILE_EXP2\n"
+        "push local 0\npush constant 1\nadd\npop local 0\ngoto WHILE_EXP1\n"
+        //*a logic of comparisons is boolean, the loop is rotated
+        "label WHILE_BODY2\npush local 0\npush constant 1\nsub\npop local 0\n"
+        "label WHILE_EXP2\npush argument 0\npush constant 1\nlt\npush argument 0\npush constant 2\neq\nnot\nor\nif-goto WHILE_BODY2\n"
+        "push constant 0\nreturn\n";
+    assert(strcmp(text, expected) == 0);
+    BUF_FREE(text);
+    BUF_FREE(code);
+
+    //*loops read back from a .vm file are left as they are, their labels have no number to derive one from
+    const char* lib = "function L.f 0\nlabel A\npush argument 0\npush constant 1\neq\nnot\nif-goto B\ngoto A\nlabel B\n"
+        "label C\npush argument 0\npush constant 2\neq\nnot\nif-goto D\ngoto C\nlabel D\npush constant 0\nreturn\n";
+    code = NULL;
+    assert(vm_read("opt_tests", lib, &code));
+    vm_optimize(&code);
+    text = vm_text(code);
+    assert(strcmp(text, lib) == 0);
+    BUF_FREE(text);
+    BUF_FREE(code);
+}
@@ -1,15 +1,20 @@
+//*token.name is only meaningful for names and keywords, so keywords are always checked through here
+Internal bool is_keyword(const char* keyword) {
+    return is_token(TOKEN_KEYWORD) && token.name == keyword;
+}
+
 Internal Type* parse_type(void) {
     TypeKind kind;
-    if (token.name == void_keyword) {
+    if (is_keyword(void_keyword)) {
         kind = TYPE_VOID;
     }
-    else if (token.name == int_keyword) {
+    else if (is_keyword(int_keyword)) {
         kind = TYPE_INT;
     }
-    else if (token.name == char_keyword) {
+    else if (is_keyword(char_keyword)) {
         kind = TYPE_CHAR;
     }
-    else if (token.name == boolean_keyword) {
+    else if (is_keyword(boolean_keyword)) {
         kind = TYPE_BOOLEAN;
     }
     else {
@@ -42,101 +47,326 @@ Internal VarDecl parse_var(void) {
     return var;
 }
 
-Internal ClassDecl* parse_class(void) {
-    const char* class_name = token.name;
-    expect_token(TOKEN_NAME);
+Internal bool match_keyword(const char* keyword) {
+    if (is_keyword(keyword)) {
+        next_token();
+        return true;
+    }
+    return false;
+}
+
+Internal void expect_keyword(const char* keyword) {
+    if (!match_keyword(keyword)) {
+        fatal_syntax_error("expected keyword %s, got %s", keyword, token_info());
+    }
+}
+
+//*counts one level of nesting, see parse_depth
+Internal void parse_enter(void) {
+    if (parse_depth == PARSE_MAX_DEPTH) {
+        fatal_syntax_error("nesting deeper than %d levels", PARSE_MAX_DEPTH);
+    }
+    parse_depth++;
+}
+
+Internal Expr* parse_expr(void);
+
+Internal Expr* parse_call(SrcPos pos, const char* first_name) {
+    CallKind kind = CALL_METHOD;
+    const char* field_name = NULL;
+    const char* sub_name = first_name;
+    if (match_token(TOKEN_DOT)) {
+        kind = CALL_FUNCTION;
+        field_name = first_name;
+        sub_name = parse_name();
+    }
+
+    expect_token(TOKEN_LPAREN);
+    AstList args = ast_list_begin();
+    if (!is_token(TOKEN_RPAREN)) {
+        AST_LIST_PUSH(args, Expr*, parse_expr());
+        while (match_token(TOKEN_COMMA)) {
+            AST_LIST_PUSH(args, Expr*, parse_expr());
+        }
+    }
+    expect_token(TOKEN_RPAREN);
+
+    return expr_call(pos, kind, field_name, sub_name, ast_list_commit(&args, sizeof(Expr*)), args.len);
+}
+
+Internal Expr* parse_term(void) {
+    SrcPos pos = token.pos;
+    if (is_token(TOKEN_INT)) {
+        i32 val = token.int_val;
+        next_token();
+        return expr_int(pos, val);
+    }
+    else if (is_token(TOKEN_STR)) {
+        const char* val = token.str_val;
+        next_token();
+        return expr_str(pos, val);
+    }
+    else if (is_keyword(true_keyword) || is_keyword(false_keyword) || is_keyword(null_keyword) || is_keyword(this_keyword)) {
+        const char* keyword = token.name;
+        next_token();
+        return expr_keyword(pos, keyword);
+    }
+    else if (is_token(TOKEN_NAME)) {
+        const char* name = parse_name();
+        if (match_token(TOKEN_LBRACKET)) {
+            Expr* index = parse_expr();
+            expect_token(TOKEN_RBRACKET);
+            return expr_index(pos, name, index);
+        }
+        else if (is_token(TOKEN_LPAREN) || is_token(TOKEN_DOT)) {
+            return parse_call(pos, name);
+        }
+        return expr_name(pos, name);
+    }
+    else if (match_token(TOKEN_LPAREN)) {
+        Expr* expr = parse_expr();
+        expect_token(TOKEN_RPAREN);
+        return expr_paren(pos, expr);
+    }
+    else if (is_token(TOKEN_SUB) || is_token(TOKEN_NOT)) {
+        TokenKind op = is_token(TOKEN_SUB) ? TOKEN_NEG : TOKEN_NOT;
+        next_token();
+        parse_enter();
+        Expr* expr = expr_unary(pos, op, parse_term());
+        parse_depth--;
+        return expr;
+    }
+
+    fatal_syntax_error("unexpected token %s in expression", token_info());
+    return NULL;
+}
+
+Internal Expr* parse_mul_expr(void) {
+    Expr* expr = parse_term();
+    while (token.kind >= TOKEN_FIRST_MUL && token.kind <= TOKEN_LAST_MUL) {
+        SrcPos pos = token.pos;
+        TokenKind op = token.kind;
+        next_token();
+        expr = expr_binary(pos, op, expr, parse_term());
+    }
+    return expr;
+}
+
+Internal Expr* parse_add_expr(void) {
+    Expr* expr = parse_mul_expr();
+    while (token.kind >= TOKEN_FIRST_ADD && token.kind <= TOKEN_LAST_ADD) {
+        SrcPos pos = token.pos;
+        TokenKind op = token.kind;
+        next_token();
+        expr = expr_binary(pos, op, expr, parse_mul_expr());
+    }
+    return expr;
+}
+
+Internal Expr* parse_cmp_expr(void) {
+    Expr* expr = parse_add_expr();
+    while (token.kind >= TOKEN_FIRST_CMP && token.kind <= TOKEN_LAST_CMP) {
+        SrcPos pos = token.pos;
+        TokenKind op = token.kind;
+        next_token();
+        expr = expr_binary(pos, op, expr, parse_add_expr());
+    }
+    return expr;
+}
+
+Internal Expr* parse_expr(void) {
+    parse_enter();
+    Expr* expr = parse_cmp_expr();
+    parse_depth--;
+    return expr;
+}
+
+Internal Expr* parse_paren_expr(void) {
+    expect_token(TOKEN_LPAREN);
+    Expr* expr = parse_expr();
+    expect_token(TOKEN_RPAREN);
+    return expr;
+}
 
+Internal Stmt* parse_stmt(void);
+
+Internal bool is_stmt_keyword(void) {
+    return is_keyword(let_keyword) || is_keyword(if_keyword) || is_keyword(while_keyword) || is_keyword(do_keyword) || is_keyword(return_keyword);
+}
+
+Internal StmtList parse_stmt_list(void) {
+    SrcPos pos = token.pos;
+    AstList stmts = ast_list_begin();
+    while (is_stmt_keyword()) {
+        AST_LIST_PUSH(stmts, Stmt*, parse_stmt());
+    }
+    return stmt_list(pos, ast_list_commit(&stmts, sizeof(Stmt*)), stmts.len);
+}
+
+Internal StmtList parse_block(void) {
     expect_token(TOKEN_LBRACE);
+    parse_enter();
+    StmtList block = parse_stmt_list();
+    parse_depth--;
+    expect_token(TOKEN_RBRACE);
+    return block;
+}
+
+Internal Stmt* parse_stmt(void) {
+    SrcPos pos = token.pos;
+    if (match_keyword(let_keyword)) {
+        const char* name = parse_name();
+        Expr* index_expr = NULL;
+        if (match_token(TOKEN_LBRACKET)) {
+            index_expr = parse_expr();
+            expect_token(TOKEN_RBRACKET);
+        }
+        expect_token(TOKEN_EQ);
+        Expr* assign_expr = parse_expr();
+        expect_token(TOKEN_SEMICOLON);
+        return stmt_let(pos, name, index_expr, assign_expr);
+    }
+    else if (match_keyword(if_keyword)) {
+        Expr* cond = parse_paren_expr();
+        StmtList then_block = parse_block();
+        StmtList else_block = { 0 };
+        bool has_else = match_keyword(else_keyword);
+        if (has_else) {
+            else_block = parse_block();
+        }
+        return stmt_if(pos, cond, then_block, else_block, has_else);
+    }
+    else if (match_keyword(while_keyword)) {
+        Expr* cond = parse_paren_expr();
+        return stmt_while(pos, cond, parse_block());
+    }
+    else if (match_keyword(do_keyword)) {
+        SrcPos call_pos = token.pos;
+        Expr* call = parse_call(call_pos, parse_name());
+        expect_token(TOKEN_SEMICOLON);
+        return stmt_do(pos, call);
+    }
+    else {
+        expect_keyword(return_keyword);
+        Expr* expr = NULL;
+        if (!is_token(TOKEN_SEMICOLON)) {
+            expr = parse_expr();
+        }
+        expect_token(TOKEN_SEMICOLON);
+        return stmt_return(pos, expr);
+    }
+}
 
-    ClassVarDecl* class_vars = NULL;
-    size_t num_classvars = 0;
-    while (token.name == static_keyword || token.name == field_keyword) {
-        VarType var_type = token.name == static_keyword ? VAR_STATIC : VAR_FIELD;
+Internal ClassVarDecl* parse_class_vars(size_t* num_vars) {
+    AstList class_vars = ast_list_begin();
+    while (is_keyword(static_keyword) || is_keyword(field_keyword)) {
+        VarType var_type = is_keyword(static_keyword) ? VAR_STATIC : VAR_FIELD;
         expect_token(TOKEN_KEYWORD);
 
         Type* type = parse_type();
 
-        BUF_PUSH(class_vars, (ClassVarDecl) { var_type, type, parse_name() });
-        num_classvars++;
+        AST_LIST_PUSH(class_vars, ClassVarDecl, (ClassVarDecl) { var_type, type, parse_name() });
         while (match_token(TOKEN_COMMA)) {
-            BUF_PUSH(class_vars, (ClassVarDecl) { var_type, type, parse_name() });
-            num_classvars++;
+            AST_LIST_PUSH(class_vars, ClassVarDecl, (ClassVarDecl) { var_type, type, parse_name() });
         }
 
         expect_token(TOKEN_SEMICOLON);
     }
 
-    // typedef enum SubroutineType {
-    //     SUB_CONSTRUCTOR,
-    //     SUB_FUNCTION,
-    //     SUB_METHOD,
-    // } SubroutineType;
-
-    // typedef struct Subroutine {
-    //     SubroutineType sub_type;
-    //     FuncParam* params;
-    //     size_t num_params;
-    //     Type* ret_type;
-    //     VarDecl* vars;
-    //     StmtList block;
-    // } Subroutine;
-    Subroutine* subs = NULL;
-    size_t num_subs = 0;
-    while (token.name == constructor_keyword || token.name == method_keyword || token.name == function_keyword) {
-        SubroutineType sub_type = token.name == constructor_keyword ? SUB_CONSTRUCTOR : SUB_FUNCTION;
-        sub_type = token.name == method_keyword ? SUB_METHOD : sub_type;
-        expect_token(TOKEN_KEYWORD);
+    *num_vars = class_vars.len;
+    return ast_list_commit(&class_vars, sizeof(ClassVarDecl));
+}
 
-        Type* ret_type = parse_type();
+Internal bool is_subroutine_keyword(const char* name) {
+    return name == constructor_keyword || name == method_keyword || name == function_keyword;
+}
+
+Internal Subroutine parse_subroutine(void) {
+    SubroutineType sub_type = token.name == constructor_keyword ? SUB_CONSTRUCTOR : SUB_FUNCTION;
+    sub_type = token.name == method_keyword ? SUB_METHOD : sub_type;
+    expect_token(TOKEN_KEYWORD);
+
+    Type* ret_type = parse_type();
 
-        const char* sub_name = parse_name();
-        expect_token(TOKEN_LPAREN);
+    const char* sub_name = parse_name();
+    expect_token(TOKEN_LPAREN);
 
-        size_t num_params = 0;
-        VarDecl* params = NULL;
-        if (!is_token(TOKEN_RPAREN)) {
-            BUF_PUSH(params, parse_var());
-            num_params++;
-            while (match_token(TOKEN_COMMA)) {
-                BUF_PUSH(params, parse_var());
-                num_params++;
-            }
+    AstList params = ast_list_begin();
+    if (!is_token(TOKEN_RPAREN)) {
+        AST_LIST_PUSH(params, VarDecl, parse_var());
+        while (match_token(TOKEN_COMMA)) {
+            AST_LIST_PUSH(params, VarDecl, parse_var());
         }
-        expect_token(TOKEN_RPAREN);
+    }
+    expect_token(TOKEN_RPAREN);
+    VarDecl* param_decls = ast_list_commit(&params, sizeof(VarDecl));
 
-        //*subroutine body
-        expect_token(TOKEN_LBRACE);
-
-        VarDecl* vars = NULL;
-        size_t num_vars = 0;
-        while (token.name == var_keyword) {
-            expect_token(TOKEN_KEYWORD);
-
-            VarDecl first_var = parse_var();
-            BUF_PUSH(vars, first_var);
-            num_vars++;
-            while (match_token(TOKEN_COMMA)) {
-                BUF_PUSH(vars, (VarDecl) { first_var.type, parse_name() });
-                num_vars++;
-            }
-            expect_token(TOKEN_SEMICOLON);
+    //*subroutine body
+    expect_token(TOKEN_LBRACE);
+
+    AstList locals = ast_list_begin();
+    while (is_keyword(var_keyword)) {
+        expect_token(TOKEN_KEYWORD);
+
+        VarDecl first_var = parse_var();
+        AST_LIST_PUSH(locals, VarDecl, first_var);
+        while (match_token(TOKEN_COMMA)) {
+            AST_LIST_PUSH(locals, VarDecl, (VarDecl) { first_var.type, parse_name() });
         }
+        expect_token(TOKEN_SEMICOLON);
+    }
+    VarDecl* local_decls = ast_list_commit(&locals, sizeof(VarDecl));
+
+    StmtList block = parse_stmt_list();
+    expect_token(TOKEN_RBRACE);
 
-        expect_token(TOKEN_RBRACE);
+    return (Subroutine) { sub_type, sub_name, param_decls, params.len, ret_type, local_decls, locals.len, block };
+}
 
-        BUF_PUSH(subs, (Subroutine) { sub_type, sub_name, ast_rep(params, num_params * sizeof(VarDecl)), num_params, ret_type, ast_rep(vars, num_vars * sizeof(VarDecl)), num_vars, (StmtList) { 0 } });
-        num_subs++;
+Internal ClassDecl* parse_class(void) {
+    expect_keyword(class_keyword);
+    const char* class_name = token.name;
+    expect_token(TOKEN_NAME);
+
+    expect_token(TOKEN_LBRACE);
+
+    //*committed before the subroutines start their own lists
+    size_t num_vars;
+    ClassVarDecl* vars = parse_class_vars(&num_vars);
+    AstList subs = ast_list_begin();
+    while (is_token(TOKEN_KEYWORD) && is_subroutine_keyword(token.name)) {
+        AST_LIST_PUSH(subs, Subroutine, parse_subroutine());
     }
 
     expect_token(TOKEN_RBRACE);
 
-    return class_new(class_name, class_vars, num_classvars, subs, num_subs);
+    return class_new(class_name, vars, num_vars, ast_list_commit(&subs, sizeof(Subroutine)), subs.len);
 }
 
 Internal void parse_tests() {
     init_stream("parse_tests", "class\n Test {\n field int a, c, d;\n static char b;\n function void func(int a, char b) {\nvar int bar, foo, sdf;\n var char t;}\n method Foo meth() {\nvar Square asd;\n}\n}\n");
-    match_token(TOKEN_KEYWORD);
     ClassDecl* c = parse_class();
     print_class(c);
     flush_parse();
+
+    init_stream("parse_tests", "class T { method int f(int x) { let a[x] = 1 + 2 * -x; if (~(x < 3)) { do g(x, 2); } else { return; } while (x) { do Out.p(\"s\"); } return (x | y) & this; } }");
+    c = parse_class();
+    assert(is_token_eof());
+    StmtList* block = &c->subs[0].block;
+    assert(block->num_stmts == 4);
+    Stmt* let = block->stmts[0];
+    assert(let->kind == STMT_LET && let->let_stmt.index_expr->kind == EXPR_NAME);
+    Expr* sum = let->let_stmt.assign_expr;
+    assert(sum->kind == EXPR_BINARY && sum->binary.op == TOKEN_ADD);
+    assert(sum->binary.right->kind == EXPR_BINARY && sum->binary.right->binary.op == TOKEN_MUL);
+    assert(sum->binary.right->binary.right->kind == EXPR_UNARY && sum->binary.right->binary.right->unary.op == TOKEN_NEG);
+    Stmt* if_stmt = block->stmts[1];
+    assert(if_stmt->kind == STMT_IF && if_stmt->if_stmt.has_else && if_stmt->if_stmt.then_block.num_stmts == 1);
+    assert(if_stmt->if_stmt.cond->kind == EXPR_UNARY && if_stmt->if_stmt.cond->unary.expr->kind == EXPR_PAREN);
+    Expr* call = if_stmt->if_stmt.then_block.stmts[0]->do_stmt.subroutine_call;
+    assert(call->call.kind == CALL_METHOD && call->call.expr_list.num_exprs == 2);
+    Stmt* while_stmt = block->stmts[2];
+    assert(while_stmt->kind == STMT_WHILE && while_stmt->while_stmt.block.stmts[0]->do_stmt.subroutine_call->call.field_name == str_intern("Out"));
+    Expr* ret = block->stmts[3]->return_stmt.expr;
+    assert(ret->kind == EXPR_BINARY && ret->binary.op == TOKEN_AND && ret->binary.left->kind == EXPR_PAREN);
 }
\ No newline at end of file
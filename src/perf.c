@@ -0,0 +1,231 @@
+//*Hardware counters per compiler phase with `--perf-counters`: cycles, instructions, branch misses
+//*and last level cache misses from Linux perf_event_open, reported as IPC and misses per KB of
+//*source so a phase shows whether it is bound by branches or by memory. A phase is measured with
+//*    PerfSample sample = perf_begin();
+//*    ...
+//*    perf_end(PERF_PARSE, sample);
+//*
+//*The counters are one group on the calling thread, read with a single read() at each phase
+//*boundary, so they only see the work of the thread that opened them and the driver keeps to one
+//*thread in this mode. A counter the kernel or the machine does not provide is left out, without
+//*any the phases are still timed. In virtual machines and containers that is the usual case.
+
+typedef enum PerfPhase {
+    PERF_LEX,
+    PERF_INTERN,
+    PERF_PARSE,
+    PERF_GEN,
+    PERF_EMIT,
+    NUM_PERF_PHASES,
+} PerfPhase;
+
+typedef enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_LLC_MISSES,
+    NUM_PERF_COUNTERS,
+} PerfCounter;
+
+const char* perf_phase_names[NUM_PERF_PHASES] = {
+    [PERF_LEX] = "lex",
+    [PERF_INTERN] = "intern",
+    [PERF_PARSE] = "parse",
+    [PERF_GEN] = "gen",
+    [PERF_EMIT] = "emit",
+};
+
+typedef struct PerfSample {
+    f64 time;
+    //*scaled up when the kernel had to multiplex the counters
+    u64 counts[NUM_PERF_COUNTERS];
+} PerfSample;
+
+typedef struct PerfState {
+    bool enabled;
+    bool open[NUM_PERF_COUNTERS];
+    int fds[NUM_PERF_COUNTERS];
+    //*the first counter that opened, the others are read through it
+    int leader;
+    //*errno of the first counter that failed to open, cleared when another one opened
+    int error;
+    PerfSample totals[NUM_PERF_PHASES];
+    size_t source_bytes;
+} PerfState;
+
+PerfState perf;
+
+#if __linux__
+
+Internal int perf_open(PerfCounter counter, int group) {
+    LocalPersist const u64 configs[NUM_PERF_COUNTERS] = {
+        [PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+        [PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+        [PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+        [PERF_LLC_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    };
+    struct perf_event_attr attr = { 0 };
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[counter];
+    attr.disabled = group < 0;
+    //*user space only, which perf_event_paranoid 2 still allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+//*Opens the counters on the calling thread, false when none is available
+Internal bool perf_init(void) {
+    memset(&perf, 0, sizeof(perf));
+    perf.enabled = true;
+    perf.leader = -1;
+    for (PerfCounter counter = 0; counter < NUM_PERF_COUNTERS; counter++) {
+        perf.fds[counter] = perf_open(counter, perf.leader);
+        if (perf.fds[counter] < 0) {
+            perf.error = perf.error ? perf.error : errno;
+            continue;
+        }
+        perf.open[counter] = true;
+        if (perf.leader < 0) {
+            perf.leader = perf.fds[counter];
+        }
+    }
+    if (perf.leader < 0) {
+        return false;
+    }
+    perf.error = 0;
+    ioctl(perf.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+Internal void perf_close(void) {
+    for (PerfCounter counter = 0; counter < NUM_PERF_COUNTERS; counter++) {
+        if (perf.open[counter]) {
+            close(perf.fds[counter]);
+        }
+    }
+    perf.enabled = false;
+}
+
+//*the group's values come in the order the counters were opened
+Internal void perf_read(PerfSample* sample) {
+    u64 data[3 + NUM_PERF_COUNTERS];
+    if (perf.leader < 0 || read(perf.leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(u64))) {
+        return;
+    }
+    u64 enabled = data[1];
+    u64 running = data[2];
+    u64* value = data + 3;
+    for (PerfCounter counter = 0; counter < NUM_PERF_COUNTERS; counter++) {
+        if (perf.open[counter]) {
+            sample->counts[counter] = running ? (u64)((f64)*value * (f64)enabled / (f64)running) : 0;
+            value++;
+        }
+    }
+}
+
+#else
+
+Internal bool perf_init(void) {
+    memset(&perf, 0, sizeof(perf));
+    perf.enabled = true;
+    perf.leader = -1;
+    perf.error = ENOSYS;
+    return false;
+}
+
+Internal void perf_close(void) {
+    perf.enabled = false;
+}
+
+Internal void perf_read(PerfSample* sample) {
+    (void)sample;
+}
+
+#endif
+
+Internal PerfSample perf_begin(void) {
+    PerfSample sample = { 0 };
+    if (perf.enabled) {
+        perf_read(&sample);
+        sample.time = time_now();
+    }
+    return sample;
+}
+
+Internal void perf_end(PerfPhase phase, PerfSample start) {
+    if (!perf.enabled) {
+        return;
+    }
+    PerfSample now = { 0 };
+    now.time = time_now();
+    perf_read(&now);
+    PerfSample* total = &perf.totals[phase];
+    total->time += now.time - start.time;
+    for (PerfCounter counter = 0; counter < NUM_PERF_COUNTERS; counter++) {
+        total->counts[counter] += now.counts[counter] - start.counts[counter];
+    }
+}
+
+//*one line per phase, `-` for a counter that is not available
+Internal void perf_report(void) {
+    if (perf.error) {
+        printf("perf: hardware counters unavailable (%s), timing only\n", strerror(perf.error));
+    }
+    f64 kb = (f64)MAX(1, perf.source_bytes) / 1024.0;
+    printf("perf: %zu bytes of source\n", perf.source_bytes);
+    printf("perf: %-7s %10s %14s %14s %6s %16s %14s\n", "phase", "ms", "cycles", "instructions", "IPC", "branch misses/KB", "LLC misses/KB");
+    for (PerfPhase phase = 0; phase < NUM_PERF_PHASES; phase++) {
+        PerfSample* total = &perf.totals[phase];
+        char* line = NULL;
+        BUF_PRINTF(line, "perf: %-7s %10.3f", perf_phase_names[phase], total->time * 1000);
+        for (PerfCounter counter = PERF_CYCLES; counter <= PERF_INSTRUCTIONS; counter++) {
+            if (perf.open[counter]) {
+                BUF_PRINTF(line, " %14llu", (unsigned long long)total->counts[counter]);
+            }
+            else {
+                BUF_PRINTF(line, " %14s", "-");
+            }
+        }
+        if (perf.open[PERF_CYCLES] && perf.open[PERF_INSTRUCTIONS] && total->counts[PERF_CYCLES]) {
+            BUF_PRINTF(line, " %6.2f", (f64)total->counts[PERF_INSTRUCTIONS] / (f64)total->counts[PERF_CYCLES]);
+        }
+        else {
+            BUF_PRINTF(line, " %6s", "-");
+        }
+        for (PerfCounter counter = PERF_BRANCH_MISSES; counter <= PERF_LLC_MISSES; counter++) {
+            if (perf.open[counter]) {
+                BUF_PRINTF(line, " %*.1f", counter == PERF_BRANCH_MISSES ? 16 : 14, (f64)total->counts[counter] / kb);
+            }
+            else {
+                BUF_PRINTF(line, " %*s", counter == PERF_BRANCH_MISSES ? 16 : 14, "-");
+            }
+        }
+        printf("%s\n", line);
+        BUF_FREE(line);
+    }
+}
+
+Internal void perf_tests(void) {
+    bool available = perf_init();
+    assert(perf.enabled && available == !perf.error);
+    PerfSample sample = perf_begin();
+    volatile u64 sum = 0;
+    for (u64 i = 0; i < 1000000; i++) {
+        sum += i;
+    }
+    perf_end(PERF_GEN, sample);
+    assert(perf.totals[PERF_GEN].time > 0);
+    if (perf.open[PERF_INSTRUCTIONS]) {
+        assert(perf.totals[PERF_GEN].counts[PERF_INSTRUCTIONS] >= 1000000);
+    }
+    perf_close();
+    memset(&perf, 0, sizeof(perf));
+
+    //*switched off, nothing is measured
+    sample = perf_begin();
+    perf_end(PERF_GEN, sample);
+    assert(perf.totals[PERF_GEN].time == 0);
+}
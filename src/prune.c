@@ -0,0 +1,126 @@
+//*Whole program dead subroutine elimination. Code generation already resolved every SubCall to the
+//*`Class.sub` it targets, variables to their declared class, so the call graph is read off the `call`
+//*instructions of all classes at once. Everything reachable from the entry point is kept, functions,
+//*methods and constructors nothing reaches are cut out of their class. Calls into classes that are not
+//*part of the program (the OS) have no function here and are ignored.
+
+typedef struct PruneStats {
+    size_t subs;
+    size_t removed_subs;
+    size_t insts;
+    size_t removed_insts;
+} PruneStats;
+
+PruneStats prune_stats;
+
+//*one `function` block: code[start, end) of program `program`
+typedef struct VmFunc {
+    size_t program;
+    size_t start;
+    size_t end;
+    bool live;
+} VmFunc;
+
+//*Drops the unreachable functions of `programs`, one VM code buffer per class. Returns false, leaving
+//*the code alone, when none of the programs defines `entry`.
+Internal bool vm_prune_program(VmInst** programs[], size_t num_programs, const char* entry) {
+    VmFunc* funcs = NULL;
+    NameIndex func_index = { 0 };
+    for (size_t p = 0; p < num_programs; p++) {
+        VmInst* code = *programs[p];
+        for (size_t i = 0; i < BUF_LEN(code); i++) {
+            if (code[i].op != VM_FUNCTION) {
+                continue;
+            }
+            if (BUF_LEN(funcs) && funcs[BUF_LEN(funcs) - 1].program == p) {
+                funcs[BUF_LEN(funcs) - 1].end = i;
+            }
+            name_index_put(&func_index, code[i].name, (u32)BUF_LEN(funcs));
+            BUF_PUSH(funcs, (VmFunc) { p, i, BUF_LEN(code), false });
+        }
+    }
+
+    u32* root = name_index_get(&func_index, entry);
+    if (root) {
+        size_t* worklist = NULL;
+        funcs[*root].live = true;
+        BUF_PUSH(worklist, *root);
+        while (BUF_LEN(worklist)) {
+            VmFunc* func = &funcs[worklist[--_BUF_HDR(worklist)->len]];
+            VmInst* code = *programs[func->program];
+            for (size_t i = func->start; i < func->end; i++) {
+                if (code[i].op != VM_CALL) {
+                    continue;
+                }
+                u32* callee = name_index_get(&func_index, code[i].name);
+                if (callee && !funcs[*callee].live) {
+                    funcs[*callee].live = true;
+                    BUF_PUSH(worklist, *callee);
+                }
+            }
+        }
+        BUF_FREE(worklist);
+
+        //*functions of a program are contiguous in funcs and cover its code from the first `function` on
+        VmFunc* func = funcs;
+        for (size_t p = 0; p < num_programs; p++) {
+            VmInst* code = *programs[p];
+            VmInst* kept = NULL;
+            size_t i = 0;
+            for (; func != BUF_END(funcs) && func->program == p; func++) {
+                for (; i < func->start; i++) {
+                    BUF_PUSH(kept, code[i]);
+                }
+                if (func->live) {
+                    for (; i < func->end; i++) {
+                        BUF_PUSH(kept, code[i]);
+                    }
+                }
+                else {
+                    prune_stats.removed_subs++;
+                    prune_stats.removed_insts += func->end - func->start;
+                    i = func->end;
+                }
+            }
+            prune_stats.insts += BUF_LEN(code);
+            BUF_FREE(code);
+            *programs[p] = kept;
+        }
+        prune_stats.subs += BUF_LEN(funcs);
+    }
+
+    BUF_FREE(funcs);
+    name_index_free(&func_index);
+    return root != NULL;
+}
+
+Internal void prune_tests(void) {
+    const char* srcs[] = {
+        "class Main { function void main() { var Util u; let u = Util.new(); do u.used(); return; } function void unused() { do Util.helper(); return; } }",
+        "class Util { constructor Util new() { return this; } method void used() { do Output.printInt(1); do helper2(); return; } method void helper2() { return; } function void helper() { return; } }",
+    };
+    VmInst* code[2];
+    VmInst** programs[2];
+    for (size_t i = 0; i < 2; i++) {
+        init_keywords();
+        init_stream("prune_tests", srcs[i]);
+        code[i] = gen_class(parse_class());
+        programs[i] = &code[i];
+    }
+    prune_stats = (PruneStats) { 0 };
+    assert(!vm_prune_program(programs, 2, str_intern("Main.run")));
+    assert(prune_stats.removed_subs == 0);
+
+    size_t util_len = BUF_LEN(code[1]);
+    assert(vm_prune_program(programs, 2, str_intern("Main.main")));
+    //*Main.unused goes, and with it Util.helper which only it called
+    assert(prune_stats.subs == 6 && prune_stats.removed_subs == 2);
+    assert(code[0][0].op == VM_FUNCTION && code[0][0].name == str_intern("Main.main"));
+    for (size_t i = 0; i < BUF_LEN(code[0]); i++) {
+        assert(code[0][i].op != VM_FUNCTION || i == 0);
+    }
+    assert(BUF_LEN(code[1]) == util_len - 3);
+    assert(prune_stats.insts - prune_stats.removed_insts == BUF_LEN(code[0]) + BUF_LEN(code[1]));
+    BUF_FREE(code[0]);
+    BUF_FREE(code[1]);
+}
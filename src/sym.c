@@ -0,0 +1,153 @@
+//*Symbol tables for code generation. Names are interned, so a scope is an open addressing table keyed
+//*on the name pointer and a lookup yields kind, index and type from one probe sequence.
+//*
+//*A scope starts out in SYM_SCOPE_INLINE slots inside the struct, which holds every subroutine and
+//*nearly every class. Only a scope outgrowing them moves to the heap. The subroutine scope lives in
+//*Gen on the stack and is reset for each subroutine without freeing anything.
+
+#define SYM_SCOPE_INLINE 64
+
+typedef enum SymKind {
+    SYM_STATIC,
+    SYM_FIELD,
+    SYM_ARG,
+    SYM_LOCAL,
+} SymKind;
+
+//*a slot is free while its name is NULL
+typedef struct Sym {
+    const char* name;
+    Type* type;
+    SymKind kind;
+    i32 index;
+} Sym;
+
+typedef struct SymScope {
+    //*NULL while the inline slots are in use
+    Sym* heap;
+    size_t heap_cap;
+    size_t len;
+    Sym slots[SYM_SCOPE_INLINE];
+} SymScope;
+
+Internal Sym* sym_slots(SymScope* scope, size_t* cap) {
+    *cap = scope->heap ? scope->heap_cap : SYM_SCOPE_INLINE;
+    return scope->heap ? scope->heap : scope->slots;
+}
+
+Internal Sym* sym_get(SymScope* scope, const char* name) {
+    if (!scope->len) {
+        return NULL;
+    }
+    size_t cap;
+    Sym* slots = sym_slots(scope, &cap);
+    for (size_t i = (size_t)hash_ptr((void*)name);; i++) {
+        Sym* sym = &slots[i & (cap - 1)];
+        if (sym->name == name) {
+            return sym;
+        }
+        if (!sym->name) {
+            return NULL;
+        }
+    }
+}
+
+Internal Sym* sym_put(SymScope* scope, Sym sym);
+
+Internal void sym_grow(SymScope* scope) {
+    size_t old_cap;
+    Sym* old = sym_slots(scope, &old_cap);
+    Sym* old_heap = scope->heap;
+    scope->heap_cap = old_cap * 2;
+    scope->heap = xcalloc(scope->heap_cap, sizeof(Sym));
+    scope->len = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].name) {
+            sym_put(scope, old[i]);
+        }
+    }
+    if (old_heap) {
+        free(old_heap);
+    }
+    else {
+        memset(scope->slots, 0, sizeof(scope->slots));
+    }
+}
+
+//*Declares `sym` and returns its slot. A name already declared in the scope keeps its first
+//*declaration, which is what the returned slot holds then.
+Internal Sym* sym_put(SymScope* scope, Sym sym) {
+    assert(sym.name);
+    size_t cap;
+    sym_slots(scope, &cap);
+    if (2 * (scope->len + 1) > cap) {
+        sym_grow(scope);
+    }
+    Sym* slots = sym_slots(scope, &cap);
+    for (size_t i = (size_t)hash_ptr((void*)sym.name);; i++) {
+        Sym* slot = &slots[i & (cap - 1)];
+        if (slot->name == sym.name) {
+            return slot;
+        }
+        if (!slot->name) {
+            *slot = sym;
+            scope->len++;
+            return slot;
+        }
+    }
+}
+
+//*Empties the scope for reuse, a scope that moved to the heap stays there
+Internal void sym_reset(SymScope* scope) {
+    if (!scope->len) {
+        return;
+    }
+    size_t cap;
+    Sym* slots = sym_slots(scope, &cap);
+    memset(slots, 0, cap * sizeof(Sym));
+    scope->len = 0;
+}
+
+Internal void sym_free(SymScope* scope) {
+    free(scope->heap);
+    scope->heap = NULL;
+    scope->heap_cap = 0;
+    scope->len = 0;
+}
+
+Internal void sym_tests(void) {
+    char name[16];
+    const char* names[200];
+    for (i32 i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "sym%d", i);
+        names[i] = str_intern(name);
+    }
+    Type int_type = { TYPE_INT, NULL };
+    SymScope scope = { 0 };
+    assert(!sym_get(&scope, names[0]));
+    for (i32 i = 0; i < 20; i++) {
+        sym_put(&scope, (Sym) { names[i], &int_type, SYM_LOCAL, i });
+    }
+    assert(!scope.heap && scope.len == 20);
+    //*the first declaration stays
+    assert(sym_put(&scope, (Sym) { names[3], &int_type, SYM_ARG, 100 })->index == 3);
+    for (i32 i = 0; i < 20; i++) {
+        Sym* sym = sym_get(&scope, names[i]);
+        assert(sym && sym->index == i && sym->kind == SYM_LOCAL);
+    }
+    assert(!sym_get(&scope, names[20]));
+    sym_reset(&scope);
+    assert(!sym_get(&scope, names[0]) && scope.len == 0);
+
+    //*outgrowing the inline slots
+    for (i32 i = 0; i < 200; i++) {
+        sym_put(&scope, (Sym) { names[i], &int_type, SYM_FIELD, i });
+    }
+    assert(scope.heap && scope.len == 200);
+    for (i32 i = 0; i < 200; i++) {
+        assert(sym_get(&scope, names[i])->index == i);
+    }
+    sym_reset(&scope);
+    assert(!sym_get(&scope, names[199]));
+    sym_free(&scope);
+}
@@ -0,0 +1,191 @@
+//*Threads and the few atomics the driver needs, wrapping Win32 and pthreads
+
+#if _WIN32
+typedef HANDLE Thread;
+#else
+typedef pthread_t Thread;
+#endif
+
+typedef void (*ThreadFunc)(void* arg);
+
+typedef struct ThreadStart {
+    ThreadFunc func;
+    void* arg;
+} ThreadStart;
+
+#if _WIN32
+Internal DWORD WINAPI thread_entry(LPVOID param) {
+#else
+Internal void* thread_entry(void* param) {
+#endif
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+Internal Thread thread_create(ThreadFunc func, void* arg) {
+    ThreadStart* start = xmalloc(sizeof(ThreadStart));
+    start->func = func;
+    start->arg = arg;
+    Thread thread;
+#if _WIN32
+    thread = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+    if (!thread) {
+        fatal("Could not create thread");
+    }
+#else
+    if (pthread_create(&thread, NULL, thread_entry, start) != 0) {
+        fatal("Could not create thread");
+    }
+#endif
+    return thread;
+}
+
+Internal void thread_join(Thread thread) {
+#if _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+Internal void thread_yield(void) {
+#if _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+Internal size_t num_cpus(void) {
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return MAX(1, info.dwNumberOfProcessors);
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+//*acquire load / release store of a size_t shared between exactly two threads, and a compare and
+//*swap of a pointer any number of threads may race on, true when `*ptr` still was `expected`
+#if _MSC_VER
+Internal size_t atomic_load_acquire(volatile size_t* ptr) {
+    size_t val = *ptr;
+    _ReadWriteBarrier();
+    return val;
+}
+
+Internal void atomic_store_release(volatile size_t* ptr, size_t val) {
+    _ReadWriteBarrier();
+    *ptr = val;
+}
+
+Internal bool atomic_cas_ptr(void* volatile* ptr, void* expected, void* desired) {
+    return InterlockedCompareExchangePointer(ptr, desired, expected) == expected;
+}
+#else
+Internal size_t atomic_load_acquire(volatile size_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+Internal void atomic_store_release(volatile size_t* ptr, size_t val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+Internal bool atomic_cas_ptr(void* volatile* ptr, void* expected, void* desired) {
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+//*Lock free single producer single consumer ring of pointers. The producer owns `tail` and the
+//*consumer owns `head`, each side only reads the other's index, so one release store per push/pop
+//*is all the synchronisation needed. The indices live on separate cache lines to avoid false sharing.
+#define CACHE_LINE_SIZE 64
+
+typedef struct SpscQueue {
+    void** items;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+    volatile size_t head;
+    char pad1[CACHE_LINE_SIZE];
+    volatile size_t tail;
+    char pad2[CACHE_LINE_SIZE];
+} SpscQueue;
+
+Internal void spsc_init(SpscQueue* queue, size_t cap) {
+    cap = MAX(2, cap);
+    while (!IS_POW2(cap)) {
+        cap++;
+    }
+    queue->items = xcalloc(cap, sizeof(void*));
+    queue->mask = cap - 1;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+Internal void spsc_free(SpscQueue* queue) {
+    free(queue->items);
+    queue->items = NULL;
+}
+
+Internal bool spsc_try_push(SpscQueue* queue, void* item) {
+    size_t tail = queue->tail;
+    if (tail - atomic_load_acquire(&queue->head) > queue->mask) {
+        return false;
+    }
+    queue->items[tail & queue->mask] = item;
+    atomic_store_release(&queue->tail, tail + 1);
+    return true;
+}
+
+Internal bool spsc_try_pop(SpscQueue* queue, void** item) {
+    size_t head = queue->head;
+    if (head == atomic_load_acquire(&queue->tail)) {
+        return false;
+    }
+    *item = queue->items[head & queue->mask];
+    atomic_store_release(&queue->head, head + 1);
+    return true;
+}
+
+//*blocking variants spin with a yield, the stages are expected to be busy most of the time
+Internal void spsc_push(SpscQueue* queue, void* item) {
+    while (!spsc_try_push(queue, item)) {
+        thread_yield();
+    }
+}
+
+Internal void* spsc_pop(SpscQueue* queue) {
+    void* item;
+    while (!spsc_try_pop(queue, &item)) {
+        thread_yield();
+    }
+    return item;
+}
+
+Internal void spsc_producer(void* arg) {
+    SpscQueue* queue = arg;
+    for (size_t i = 1; i <= 100000; i++) {
+        spsc_push(queue, (void*)i);
+    }
+}
+
+Internal void thread_tests(void) {
+    SpscQueue queue;
+    spsc_init(&queue, 5);
+    assert(queue.mask == 7);
+
+    Thread producer = thread_create(spsc_producer, &queue);
+    for (size_t i = 1; i <= 100000; i++) {
+        void* item = spsc_pop(&queue);
+        assert(item == (void*)i);
+    }
+    thread_join(producer);
+    void* item;
+    assert(!spsc_try_pop(&queue, &item));
+    spsc_free(&queue);
+}
@@ -0,0 +1,111 @@
+//*Writer for the binary token stream described in tokbin.h
+
+Internal void tokbin_put_varint(char** buf, u64 val) {
+    while (val >= 0x80) {
+        BUF_PUSH(*buf, (char)((val & 0x7f) | 0x80));
+        val >>= 7;
+    }
+    BUF_PUSH(*buf, (char)val);
+}
+
+Internal void tokbin_put_string(char** table, const char* str) {
+    size_t len = strlen(str);
+    tokbin_put_varint(table, len);
+    BUF_FIT(*table, BUF_LEN(*table) + len);
+    memcpy(BUF_END(*table), str, len);
+    _BUF_HDR(*table)->len += len;
+}
+
+//*The header has to come first but the string table is only known after the walk over the tokens,
+//*so table and token bytes are gathered separately and written behind the header at the end.
+//*Names are interned, one map lookup by pointer dedups every keyword and identifier.
+Internal void tokbin_write(Writer* w, const Token* tokens, size_t num_tokens) {
+    char* table = NULL;
+    char* body = NULL;
+    NameIndex string_index = { 0 };
+    u64 num_strings = 0;
+    i64 line = 1;
+    for (const Token* tok = tokens; tok != tokens + num_tokens; tok++) {
+        u8 head = (u8)tok->kind;
+        if (tok->pos.line != line) {
+            BUF_PUSH(body, (char)(head | TOKBIN_NEWLINE));
+            tokbin_put_varint(&body, (u64)(tok->pos.line - line));
+            line = tok->pos.line;
+        }
+        else {
+            BUF_PUSH(body, (char)head);
+        }
+
+        if (tok->kind == TOKEN_KEYWORD || tok->kind == TOKEN_NAME) {
+            u32* index = name_index_get(&string_index, tok->name);
+            if (!index) {
+                index = name_index_put(&string_index, tok->name, (u32)num_strings++);
+                tokbin_put_string(&table, tok->name);
+            }
+            tokbin_put_varint(&body, *index);
+        }
+        else if (tok->kind == TOKEN_STR) {
+            tokbin_put_string(&table, tok->str_val);
+            tokbin_put_varint(&body, num_strings++);
+        }
+        else if (tok->kind == TOKEN_INT) {
+            tokbin_put_varint(&body, (u32)tok->int_val);
+        }
+    }
+
+    char* header = NULL;
+    BUF_PRINTF(header, "%s", TOKBIN_MAGIC);
+    BUF_PUSH(header, TOKBIN_VERSION);
+    tokbin_put_varint(&header, num_strings);
+    writer_write(w, header, BUF_LEN(header));
+    writer_write(w, table, BUF_LEN(table));
+    BUF_CLEAR(header);
+    tokbin_put_varint(&header, num_tokens);
+    writer_write(w, header, BUF_LEN(header));
+    writer_write(w, body, BUF_LEN(body));
+
+    BUF_FREE(header);
+    BUF_FREE(table);
+    BUF_FREE(body);
+    name_index_free(&string_index);
+}
+
+Internal void tokbin_tests(void) {
+    //*the stream stores TokenKind values as they are
+    assert((int)TOKBIN_NAME == TOKEN_NAME && (int)TOKBIN_MUL == TOKEN_MUL && (int)TOKBIN_ADD == TOKEN_ADD && (int)TOKBIN_GT == TOKEN_GT);
+
+    const char* src = "class A {\n  field int x, x;\n\n\n  method void f() { let x = 300 + \"s<&\" ; return 16383; }\n}\n";
+    Token* tokens = lex_tokens("tokbin_tests", src);
+    Writer w = writer_new(NULL);
+    tokbin_write(&w, tokens, BUF_LEN(tokens));
+    writer_close(&w);
+
+    TokBin bin;
+    assert(tokbin_read(w.mem, BUF_LEN(w.mem), &bin) == 0);
+    assert(bin.num_tokens == BUF_LEN(tokens));
+    //*class A field int x method void f let return, x only once
+    assert(bin.num_strings == 11);
+    for (size_t i = 0; i < BUF_LEN(tokens); i++) {
+        TokBinToken* tok = &bin.tokens[i];
+        assert((TokenKind)tok->kind == tokens[i].kind);
+        assert(tok->line == tokens[i].pos.line);
+        if (tok->kind == TOKBIN_NAME || tok->kind == TOKBIN_KEYWORD) {
+            assert(strcmp(bin.strings[tok->value], tokens[i].name) == 0);
+        }
+        else if (tok->kind == TOKBIN_STR) {
+            assert(strcmp(bin.strings[tok->value], tokens[i].str_val) == 0);
+        }
+        else if (tok->kind == TOKBIN_INT) {
+            assert(tok->value == (u32)tokens[i].int_val);
+        }
+    }
+    tokbin_free(&bin);
+
+    //*every truncation of a valid stream is rejected
+    for (size_t len = 0; len < BUF_LEN(w.mem); len++) {
+        assert(tokbin_read(w.mem, len, &bin) != 0);
+    }
+
+    BUF_FREE(w.mem);
+    free_tokens(tokens);
+}
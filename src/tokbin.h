@@ -0,0 +1,181 @@
+//*Binary token stream, written by `main --emit=tokens-bin` as `<stem>.tok`. This header is the whole
+//*reader library: it only needs the C standard library, so tools can copy it and include it on its own.
+//*
+//*Layout, all counts and payloads are unsigned LEB128 varints:
+//*    magic "JTOK", u8 version
+//*    varint num_strings, then per string: varint len, len bytes (not NUL terminated)
+//*    varint num_tokens, then per token:
+//*        u8 kind | TOKBIN_NEWLINE, followed by varint line delta if TOKBIN_NEWLINE is set
+//*        keyword, identifier and string tokens: varint string index
+//*        integer tokens: varint value
+//*        symbols have no payload
+//*Lines start at 1 and only grow, so most tokens are a single byte. Identifiers and keywords are
+//*stored once in the string table, string constants get an entry each.
+
+#ifndef TOKBIN_H
+#define TOKBIN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOKBIN_MAGIC "JTOK"
+#define TOKBIN_VERSION 1
+#define TOKBIN_NEWLINE 0x80
+
+//*kind numbers as written in the stream, in the order of the compiler's TokenKind
+typedef enum TokBinKind {
+    TOKBIN_EOF,
+    TOKBIN_LBRACKET,
+    TOKBIN_RBRACKET,
+    TOKBIN_LPAREN,
+    TOKBIN_RPAREN,
+    TOKBIN_LBRACE,
+    TOKBIN_RBRACE,
+    TOKBIN_DOT,
+    TOKBIN_COMMA,
+    TOKBIN_SEMICOLON,
+    TOKBIN_NEG,
+    TOKBIN_NOT,
+    TOKBIN_KEYWORD,
+    TOKBIN_INT,
+    TOKBIN_STR,
+    TOKBIN_NAME,
+    TOKBIN_MUL,
+    TOKBIN_DIV,
+    TOKBIN_AND,
+    TOKBIN_ADD,
+    TOKBIN_SUB,
+    TOKBIN_OR,
+    TOKBIN_EQ,
+    TOKBIN_LT,
+    TOKBIN_GT,
+    TOKBIN_NUM_KINDS,
+} TokBinKind;
+
+typedef struct TokBinToken {
+    TokBinKind kind;
+    int64_t line;
+    //*the value of integer tokens, the index into TokBin.strings for keywords, identifiers and strings
+    uint32_t value;
+} TokBinToken;
+
+typedef struct TokBin {
+    //*NUL terminated copies of the string table
+    char** strings;
+    uint32_t num_strings;
+    TokBinToken* tokens;
+    uint32_t num_tokens;
+} TokBin;
+
+typedef struct TokBinCursor {
+    const uint8_t* ptr;
+    const uint8_t* end;
+    int error;
+} TokBinCursor;
+
+static uint64_t tokbin_varint(TokBinCursor* cur) {
+    uint64_t val = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (cur->ptr == cur->end) {
+            break;
+        }
+        uint8_t byte = *cur->ptr++;
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+    cur->error = 1;
+    return 0;
+}
+
+static void tokbin_free(TokBin* bin) {
+    for (uint32_t i = 0; i < bin->num_strings; i++) {
+        free(bin->strings[i]);
+    }
+    free(bin->strings);
+    free(bin->tokens);
+    memset(bin, 0, sizeof(*bin));
+}
+
+//*Decodes a whole stream, returns 0 on success. On failure nothing needs to be freed.
+static int tokbin_read(const void* data, size_t len, TokBin* bin) {
+    TokBinCursor cur = { (const uint8_t*)data, (const uint8_t*)data + len, 0 };
+    memset(bin, 0, sizeof(*bin));
+    if (len < 5 || memcmp(cur.ptr, TOKBIN_MAGIC, 4) != 0 || cur.ptr[4] != TOKBIN_VERSION) {
+        return -1;
+    }
+    cur.ptr += 5;
+
+    uint64_t num_strings = tokbin_varint(&cur);
+    if (cur.error || num_strings > (size_t)(cur.end - cur.ptr)) {
+        return -1;
+    }
+    bin->strings = (char**)calloc(num_strings ? num_strings : 1, sizeof(char*));
+    if (!bin->strings) {
+        return -1;
+    }
+    for (; bin->num_strings < num_strings; bin->num_strings++) {
+        uint64_t str_len = tokbin_varint(&cur);
+        if (cur.error || str_len > (size_t)(cur.end - cur.ptr)) {
+            tokbin_free(bin);
+            return -1;
+        }
+        char* str = (char*)malloc(str_len + 1);
+        if (!str) {
+            tokbin_free(bin);
+            return -1;
+        }
+        memcpy(str, cur.ptr, str_len);
+        str[str_len] = 0;
+        cur.ptr += str_len;
+        bin->strings[bin->num_strings] = str;
+    }
+
+    //*every token takes at least one byte, which bounds the count before allocating
+    uint64_t num_tokens = tokbin_varint(&cur);
+    if (cur.error || num_tokens > (size_t)(cur.end - cur.ptr)) {
+        tokbin_free(bin);
+        return -1;
+    }
+    bin->tokens = (TokBinToken*)calloc(num_tokens ? num_tokens : 1, sizeof(TokBinToken));
+    if (!bin->tokens) {
+        tokbin_free(bin);
+        return -1;
+    }
+    int64_t line = 1;
+    for (; bin->num_tokens < num_tokens; bin->num_tokens++) {
+        TokBinToken* tok = &bin->tokens[bin->num_tokens];
+        if (cur.ptr == cur.end) {
+            tokbin_free(bin);
+            return -1;
+        }
+        uint8_t head = *cur.ptr++;
+        if (head & TOKBIN_NEWLINE) {
+            line += (int64_t)tokbin_varint(&cur);
+        }
+        tok->kind = (TokBinKind)(head & ~TOKBIN_NEWLINE);
+        tok->line = line;
+        if (tok->kind == TOKBIN_KEYWORD || tok->kind == TOKBIN_NAME || tok->kind == TOKBIN_STR) {
+            uint64_t index = tokbin_varint(&cur);
+            cur.error |= index >= bin->num_strings;
+            tok->value = (uint32_t)index;
+        }
+        else if (tok->kind == TOKBIN_INT) {
+            uint64_t val = tokbin_varint(&cur);
+            cur.error |= val > UINT32_MAX;
+            tok->value = (uint32_t)val;
+        }
+        else if (tok->kind == TOKBIN_EOF || tok->kind >= TOKBIN_NUM_KINDS) {
+            cur.error = 1;
+        }
+        if (cur.error) {
+            tokbin_free(bin);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#endif
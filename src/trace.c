@@ -0,0 +1,220 @@
+//*Spans of the compile phases in the Chrome trace event format, written by `--trace=out.json` for
+//*chrome://tracing or Perfetto. A phase is timed with
+//*    f64 start = trace_begin();
+//*    ...
+//*    trace_end("parse", path, start);
+//*and both are a test of `trace_enabled` when tracing is off.
+//*
+//*Each thread records into a TraceThread of its own, chunks of events on its own arena, so recording
+//*takes no lock and no atomic. The TraceThread is pushed on the `trace_threads` list with one
+//*compare and swap when the thread records its first event and outlives the thread, trace_write()
+//*walks the list once every other thread is joined.
+
+#define TRACE_CHUNK_EVENTS 1024
+
+typedef struct TraceEvent {
+    const char* name;
+    //*copied to the thread's arena, the job's path is freed before the trace is written
+    const char* file;
+    f64 start;
+    f64 end;
+} TraceEvent;
+
+typedef struct TraceChunk TraceChunk;
+
+struct TraceChunk {
+    TraceChunk* next;
+    size_t len;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+};
+
+typedef struct TraceThread TraceThread;
+
+struct TraceThread {
+    TraceThread* next;
+    //*1 for the first thread to record, in the order threads start recording
+    u32 tid;
+    const char* name;
+    Arena arena;
+    TraceChunk* first;
+    TraceChunk* last;
+};
+
+bool trace_enabled;
+f64 trace_epoch;
+TraceThread* volatile trace_threads;
+ThreadLocal TraceThread* trace_thread;
+
+Internal void trace_init(void) {
+    trace_enabled = true;
+    trace_epoch = time_now();
+}
+
+Internal TraceThread* trace_get_thread(void) {
+    if (trace_thread) {
+        return trace_thread;
+    }
+    TraceThread* t = xcalloc(1, sizeof(TraceThread));
+    do {
+        t->next = trace_threads;
+        t->tid = t->next ? t->next->tid + 1 : 1;
+    } while (!atomic_cas_ptr((void* volatile*)&trace_threads, t->next, t));
+    trace_thread = t;
+    return t;
+}
+
+//*names the calling thread in the trace, `name` must outlive the trace
+Internal void trace_thread_name(const char* name) {
+    if (trace_enabled) {
+        trace_get_thread()->name = name;
+    }
+}
+
+Internal f64 trace_begin(void) {
+    return trace_enabled ? time_now() : 0;
+}
+
+Internal void trace_push(const char* name, const char* file, f64 start, f64 end) {
+    TraceThread* t = trace_get_thread();
+    if (!t->last || t->last->len == TRACE_CHUNK_EVENTS) {
+        TraceChunk* chunk = arena_alloc(&t->arena, sizeof(TraceChunk));
+        chunk->next = NULL;
+        chunk->len = 0;
+        if (t->last) {
+            t->last->next = chunk;
+        }
+        else {
+            t->first = chunk;
+        }
+        t->last = chunk;
+    }
+    if (file) {
+        size_t len = strlen(file);
+        char* copy = arena_alloc(&t->arena, len + 1);
+        memcpy(copy, file, len + 1);
+        file = copy;
+    }
+    t->last->events[t->last->len++] = (TraceEvent) { name, file, start, end };
+}
+
+//*records the span of phase `name` from `start` until now, `file` may be NULL
+Internal void trace_end(const char* name, const char* file, f64 start) {
+    if (trace_enabled) {
+        trace_push(name, file, start, time_now());
+    }
+}
+
+//*Appends the trace as a JSON object, counting events and threads. Times are in microseconds
+//*since trace_init().
+Internal void trace_format(char** buf, size_t* num_events, size_t* num_threads) {
+    *num_events = 0;
+    *num_threads = 0;
+    BUF_PRINTF(*buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    BUF_PRINTF(*buf, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"compiler\"}}");
+    for (TraceThread* t = trace_threads; t; t = t->next) {
+        (*num_threads)++;
+        if (t->name) {
+            BUF_PRINTF(*buf, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", t->tid);
+            json_write_str(buf, t->name, strlen(t->name));
+            BUF_PRINTF(*buf, "}}");
+        }
+        for (TraceChunk* chunk = t->first; chunk; chunk = chunk->next) {
+            for (TraceEvent* e = chunk->events; e != chunk->events + chunk->len; e++) {
+                BUF_PRINTF(*buf, ",\n{\"name\":\"%s\",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    e->name, t->tid, (e->start - trace_epoch) * 1e6, (e->end - e->start) * 1e6);
+                if (e->file) {
+                    BUF_PRINTF(*buf, ",\"args\":{\"file\":");
+                    json_write_str(buf, e->file, strlen(e->file));
+                    BUF_PUSH(*buf, '}');
+                }
+                BUF_PUSH(*buf, '}');
+                (*num_events)++;
+            }
+        }
+    }
+    BUF_PRINTF(*buf, "\n]}\n");
+}
+
+//*Drops every recorded event, only once the threads that recorded them are joined
+Internal void trace_free(void) {
+    TraceThread* t = trace_threads;
+    while (t) {
+        TraceThread* next = t->next;
+        arena_free(&t->arena);
+        free(t);
+        t = next;
+    }
+    trace_threads = NULL;
+    trace_thread = NULL;
+    trace_enabled = false;
+}
+
+Internal void trace_write(const char* path) {
+    char* buf = NULL;
+    size_t num_events;
+    size_t num_threads;
+    trace_format(&buf, &num_events, &num_threads);
+    if (!write_file(path, buf, BUF_LEN(buf))) {
+        fatal("Could not write file: %s", path);
+    }
+    printf("trace: %zu spans on %zu threads written to %s\n", num_events, num_threads, path);
+    BUF_FREE(buf);
+    trace_free();
+}
+
+Internal void trace_worker(void* arg) {
+    trace_thread_name("trace worker");
+    for (size_t i = 0; i < TRACE_CHUNK_EVENTS + 5; i++) {
+        f64 start = trace_begin();
+        trace_end("lex", (const char*)arg, start);
+    }
+}
+
+Internal void trace_tests(void) {
+    trace_begin();
+    trace_end("off", NULL, 0);
+    assert(!trace_threads);
+
+    trace_init();
+    trace_thread_name("main");
+    f64 start = trace_begin();
+    Thread a = thread_create(trace_worker, (void*)"a\"quoted\".jack");
+    Thread b = thread_create(trace_worker, (void*)"b.jack");
+    thread_join(a);
+    thread_join(b);
+    trace_end("parse", NULL, start);
+
+    char* buf = NULL;
+    size_t num_events;
+    size_t num_threads;
+    trace_format(&buf, &num_events, &num_threads);
+    BUF_PUSH(buf, 0);
+    assert(num_threads == 3 && num_events == 2 * (TRACE_CHUNK_EVENTS + 5) + 1);
+
+    Arena arena = { 0 };
+    Json* json = json_parse(&arena, buf);
+    assert(json);
+    Json* events = json_get(json, "traceEvents");
+    assert(events && events->num_items == 1 + 3 + num_events);
+    u32 tids = 0;
+    size_t quoted = 0;
+    for (size_t i = 0; i < events->num_items; i++) {
+        Json* e = events->items[i];
+        i64 tid = json_int(json_get(e, "tid"), -1);
+        assert(tid >= 0 && tid <= 3);
+        tids |= 1u << tid;
+        const char* file = json_str(json_get(json_get(e, "args"), "file"));
+        if (file && strcmp(file, "a\"quoted\".jack") == 0) {
+            quoted++;
+        }
+        if (strcmp(json_str(json_get(e, "ph")), "X") == 0) {
+            assert(json_get(e, "dur")->num >= 0);
+        }
+    }
+    assert(tids == 0xf && quoted == TRACE_CHUNK_EVENTS + 5);
+
+    arena_free(&arena);
+    BUF_FREE(buf);
+    trace_free();
+    assert(!trace_enabled && !trace_threads);
+}
@@ -18,4 +18,14 @@ typedef double f64;
 
 #define Internal static //*Internal function linkage
 #define LocalPersist static //*Local function variable for program lifetime
-#define GlobalVariable static //*Internal Variable Linkage 
\ No newline at end of file
+#define GlobalVariable static //*Internal Variable Linkage
+#if _MSC_VER
+#define ThreadLocal __declspec(thread) //*Variable with one instance per thread
+#else
+#define ThreadLocal _Thread_local //*Variable with one instance per thread
+#endif 
+#if _MSC_VER
+#define NoReturn __declspec(noreturn) //*Function that never returns to its caller
+#else
+#define NoReturn __attribute__((noreturn)) //*Function that never returns to its caller
+#endif
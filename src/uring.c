@@ -0,0 +1,270 @@
+//*Batched file I/O on Linux io_uring, selected with `--io-uring`. The driver reads every source of a
+//*directory build in one go before compiling and hands each output file over as a finished buffer
+//*whose write completes in the background while the next class compiles. Files are opened and
+//*closed synchronously, the reads and writes themselves go through the ring, at most
+//*IO_RING_ENTRIES at a time. io_ring_init() fails where io_uring is missing or not permitted and the
+//*driver then stays with read_file() and stdio.
+//*
+//*The ring is used through the raw system calls, there is no liburing dependency. Only one thread
+//*at a time may use a ring.
+
+#define IO_RING_ENTRIES 64
+
+typedef enum IoOpKind {
+    IO_OP_NONE,
+    IO_OP_READ,
+    IO_OP_WRITE,
+} IoOpKind;
+
+//*a read or write in flight, `done` bytes of `len` have completed, short transfers are resubmitted
+typedef struct IoOp {
+    IoOpKind kind;
+    int fd;
+    char* buf;
+    size_t len;
+    size_t done;
+    //*owned, for the error message
+    char* path;
+} IoOp;
+
+#if __linux__
+
+typedef struct IoRing {
+    int fd;
+    u32* sq_head;
+    u32* sq_tail;
+    u32 sq_mask;
+    u32* sq_array;
+    struct io_uring_sqe* sqes;
+    u32* cq_head;
+    u32* cq_tail;
+    u32 cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    u32 in_flight;
+    //*queued but not yet submitted
+    u32 pending;
+    IoOp ops[IO_RING_ENTRIES];
+} IoRing;
+
+Internal bool io_ring_init(IoRing* ring) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params = { 0 };
+    int fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring->fd = fd;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_size = ring->cq_size = MAX(ring->sq_size, ring->cq_size);
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = single_mmap ? ring->sq_ptr : mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    char* sq = ring->sq_ptr;
+    ring->sq_head = (u32*)(sq + params.sq_off.head);
+    ring->sq_tail = (u32*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(u32*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (u32*)(sq + params.sq_off.array);
+    char* cq = ring->cq_ptr;
+    ring->cq_head = (u32*)(cq + params.cq_off.head);
+    ring->cq_tail = (u32*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+Internal void io_ring_free(IoRing* ring) {
+    assert(!ring->in_flight);
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+//*queues the next transfer of ops[index], the next io_ring_reap() submits it
+Internal void io_ring_queue(IoRing* ring, u32 index) {
+    IoOp* op = &ring->ops[index];
+    u32 tail = *ring->sq_tail;
+    u32 slot = tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->kind == IO_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = op->fd;
+    sqe->addr = (u64)(uintptr_t)(op->buf + op->done);
+    //*one transfer moves at most 1 GiB
+    size_t left = op->len - op->done;
+    sqe->len = (u32)(left < (1u << 30) ? left : 1u << 30);
+    sqe->off = op->done;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+//*Submits the queued transfers and handles the completions there are, after waiting for at least
+//*`wait` of them, all in one system call
+Internal void io_ring_reap(IoRing* ring, u32 wait) {
+    if (ring->pending || wait) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted < 0 && errno != EINTR) {
+            fatal("io_uring_enter failed: %s", strerror(errno));
+        }
+        ring->pending -= submitted > 0 ? (u32)submitted : 0;
+    }
+    u32 head = *ring->cq_head;
+    u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        u32 index = (u32)cqe->user_data;
+        IoOp* op = &ring->ops[index];
+        if (cqe->res < 0 || (cqe->res == 0 && op->kind == IO_OP_WRITE)) {
+            fatal("Could not %s file: %s", op->kind == IO_OP_READ ? "read" : "write", op->path);
+        }
+        op->done += (size_t)cqe->res;
+        //*a read returning 0 early means the file shrank since fstat
+        if (op->done < op->len && cqe->res) {
+            io_ring_queue(ring, index);
+            continue;
+        }
+        close(op->fd);
+        if (op->kind == IO_OP_READ) {
+            op->buf[op->done] = 0;
+        }
+        else {
+            BUF_FREE(op->buf);
+        }
+        free(op->path);
+        op->kind = IO_OP_NONE;
+        ring->in_flight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+//*takes a free op, waiting for a transfer to finish when all are in flight
+Internal u32 io_ring_op(IoRing* ring) {
+    while (ring->in_flight == IO_RING_ENTRIES) {
+        io_ring_reap(ring, 1);
+    }
+    u32 index = 0;
+    while (ring->ops[index].kind != IO_OP_NONE) {
+        index++;
+    }
+    ring->in_flight++;
+    return index;
+}
+
+//*Reads the files `paths` into `bufs`, NUL terminated like read_file(). The reads are queued as long
+//*as the ring has room and submitted together. Returns once all are read.
+Internal void io_ring_read_files(IoRing* ring, const char** paths, char** bufs, size_t num_paths) {
+    for (size_t i = 0; i < num_paths; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fatal("Could not find file: %s", paths[i]);
+        }
+        bufs[i] = xmalloc((size_t)st.st_size + 1);
+        if (!st.st_size) {
+            bufs[i][0] = 0;
+            close(fd);
+            continue;
+        }
+        u32 index = io_ring_op(ring);
+        ring->ops[index] = (IoOp) { IO_OP_READ, fd, bufs[i], (size_t)st.st_size, 0, strf("%s", paths[i]) };
+        io_ring_queue(ring, index);
+    }
+    while (ring->in_flight) {
+        io_ring_reap(ring, 1);
+    }
+}
+
+//*Queues writing the BUF `data` to `path`, the ring owns and frees it. The write may still be in
+//*flight on return, io_ring_drain() waits for all of them.
+Internal void io_ring_write_file(IoRing* ring, const char* path, char* data) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fatal("Could not write file: %s", path);
+    }
+    if (!BUF_LEN(data)) {
+        close(fd);
+        BUF_FREE(data);
+        return;
+    }
+    u32 index = io_ring_op(ring);
+    ring->ops[index] = (IoOp) { IO_OP_WRITE, fd, data, BUF_LEN(data), 0, strf("%s", path) };
+    io_ring_queue(ring, index);
+    io_ring_reap(ring, 0);
+}
+
+Internal void io_ring_drain(IoRing* ring) {
+    while (ring->in_flight) {
+        io_ring_reap(ring, 1);
+    }
+}
+
+#else
+
+typedef struct IoRing {
+    u32 in_flight;
+} IoRing;
+
+Internal bool io_ring_init(IoRing* ring) {
+    ring->in_flight = 0;
+    return false;
+}
+
+Internal void io_ring_free(IoRing* ring) { (void)ring; }
+Internal void io_ring_read_files(IoRing* ring, const char** paths, char** bufs, size_t num_paths) { (void)ring; (void)paths; (void)bufs; (void)num_paths; }
+Internal void io_ring_write_file(IoRing* ring, const char* path, char* data) { (void)ring; (void)path; BUF_FREE(data); }
+Internal void io_ring_drain(IoRing* ring) { (void)ring; }
+
+#endif
+
+Internal void uring_tests(void) {
+    IoRing ring;
+    if (!io_ring_init(&ring)) {
+        printf("uring_tests: io_uring unavailable, skipped\n");
+        return;
+    }
+    //*more files than ring entries, one of them empty, one larger than a single short write
+    char path[64];
+    const char* paths[IO_RING_ENTRIES + 8];
+    char* expected[IO_RING_ENTRIES + 8];
+    for (size_t i = 0; i < IO_RING_ENTRIES + 8; i++) {
+        snprintf(path, sizeof(path), "uring_test_%zu.tmp", i);
+        paths[i] = strf("%s", path);
+        char* data = NULL;
+        for (size_t j = 0; j < (i == 3 ? 0 : i == 5 ? 300000 : i + 1); j++) {
+            BUF_PRINTF(data, "%zu ", j);
+        }
+        expected[i] = data ? strf("%s", data) : strf("%s", "");
+        io_ring_write_file(&ring, paths[i], data);
+    }
+    io_ring_drain(&ring);
+
+    char* bufs[IO_RING_ENTRIES + 8];
+    io_ring_read_files(&ring, paths, bufs, IO_RING_ENTRIES + 8);
+    for (size_t i = 0; i < IO_RING_ENTRIES + 8; i++) {
+        assert(strcmp(bufs[i], expected[i]) == 0);
+        remove(paths[i]);
+        free(bufs[i]);
+        free(expected[i]);
+        free((void*)paths[i]);
+    }
+    io_ring_free(&ring);
+}
@@ -0,0 +1,216 @@
+//*Recursive discovery of the `.jack` sources below a directory. The walk keeps a stack of
+//*directories still to list and visits each once; on Linux the entries come from getdents64 in
+//*WALK_DENTS_SIZE batches with their type, so a tree of thousands of entries takes a handful of
+//*system calls per directory and no stat. Directories starting with a dot (`.git`) are skipped and
+//*symbolic links to directories are not followed, which keeps the walk free of cycles.
+//*
+//*The result is sorted by path, so output that depends on the order of the classes is the same on
+//*every filesystem.
+
+#define WALK_DENTS_SIZE (64 * 1024)
+
+typedef enum WalkKind {
+    WALK_OTHER,
+    WALK_FILE,
+    WALK_DIR,
+    //*a symbolic link, followed to a file but never to a directory
+    WALK_LINK,
+    //*the filesystem does not report types in the listing
+    WALK_UNKNOWN,
+} WalkKind;
+
+Internal int walk_cmp_paths(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+Internal WalkKind walk_stat_kind(const char* path, bool is_link) {
+    struct stat st;
+#if !_WIN32
+    if (!is_link && lstat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFLNK) {
+        is_link = true;
+    }
+#endif
+    if (stat(path, &st) != 0) {
+        return WALK_OTHER;
+    }
+    switch (st.st_mode & S_IFMT) {
+        case S_IFREG: return WALK_FILE;
+        case S_IFDIR: return is_link ? WALK_OTHER : WALK_DIR;
+        default: return WALK_OTHER;
+    }
+}
+
+Internal void walk_entry(char*** paths, char*** dirs, const char* dir, const char* name, WalkKind kind) {
+    if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+        return;
+    }
+    bool is_jack = check_jack_extension(get_extension(name));
+    if (kind == WALK_OTHER || ((kind == WALK_FILE || kind == WALK_LINK) && !is_jack) || (kind == WALK_DIR && name[0] == '.')) {
+        return;
+    }
+    size_t dir_len = strlen(dir);
+    const char* separator = dir[dir_len - 1] == '/' ? "" : "/";
+    char* path = strf("%s%s%s", dir, separator, name);
+    if (kind == WALK_LINK || kind == WALK_UNKNOWN) {
+        kind = walk_stat_kind(path, kind == WALK_LINK);
+    }
+    if (kind == WALK_DIR && name[0] != '.') {
+        BUF_PUSH(*dirs, path);
+    }
+    else if (kind == WALK_FILE && is_jack) {
+        BUF_PUSH(*paths, path);
+    }
+    else {
+        free(path);
+    }
+}
+
+#if __linux__
+
+//*the record getdents64 fills in, the kernel headers do not export it to user space
+typedef struct WalkDirent {
+    u64 d_ino;
+    i64 d_off;
+    u16 d_reclen;
+    u8 d_type;
+    char d_name[];
+} WalkDirent;
+
+Internal int walk_open(const char* dir) {
+    return open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+Internal void walk_dir(int fd, const char* dir, char*** paths, char*** dirs, u64* dents) {
+    for (;;) {
+        long len = syscall(SYS_getdents64, fd, dents, WALK_DENTS_SIZE);
+        if (len < 0) {
+            fatal("Could not list directory: %s", dir);
+        }
+        if (len == 0) {
+            break;
+        }
+        for (long pos = 0; pos < len;) {
+            WalkDirent* de = (WalkDirent*)((char*)dents + pos);
+            WalkKind kind = de->d_type == DT_REG ? WALK_FILE : de->d_type == DT_DIR ? WALK_DIR : de->d_type == DT_LNK ? WALK_LINK : de->d_type == DT_UNKNOWN ? WALK_UNKNOWN : WALK_OTHER;
+            walk_entry(paths, dirs, dir, de->d_name, kind);
+            pos += de->d_reclen;
+        }
+    }
+    close(fd);
+}
+
+#else
+
+Internal void walk_dir_posix(DIR* handle, const char* dir, char*** paths, char*** dirs) {
+    for (struct dirent* de = readdir(handle); de; de = readdir(handle)) {
+#if defined(DT_DIR)
+        WalkKind kind = de->d_type == DT_REG ? WALK_FILE : de->d_type == DT_DIR ? WALK_DIR : WALK_UNKNOWN;
+#else
+        WalkKind kind = WALK_UNKNOWN;
+#endif
+        walk_entry(paths, dirs, dir, de->d_name, kind);
+    }
+    closedir(handle);
+}
+
+#endif
+
+//*Lists the `.jack` files below `root` into `paths`, sorted. Returns false with errno set when
+//*`root` cannot be opened as a directory, ENOTDIR for a file.
+Internal bool walk_sources(const char* root, char*** paths) {
+#if __linux__
+    int fd = walk_open(root);
+    if (fd < 0) {
+        return false;
+    }
+    u64* dents = xmalloc(WALK_DENTS_SIZE);
+#else
+    DIR* handle = opendir(root);
+    if (!handle) {
+        return false;
+    }
+#endif
+    char** dirs = NULL;
+    const char* dir = root;
+    for (;;) {
+#if __linux__
+        walk_dir(fd, dir, paths, &dirs, dents);
+#else
+        walk_dir_posix(handle, dir, paths, &dirs);
+#endif
+        if (dir != root) {
+            free((void*)dir);
+        }
+        if (!BUF_LEN(dirs)) {
+            break;
+        }
+        dir = dirs[BUF_LEN(dirs) - 1];
+        _BUF_HDR(dirs)->len--;
+#if __linux__
+        fd = walk_open(dir);
+        if (fd < 0) {
+            fatal("Could not open directory: %s", dir);
+        }
+#else
+        handle = opendir(dir);
+        if (!handle) {
+            fatal("Could not open directory: %s", dir);
+        }
+#endif
+    }
+#if __linux__
+    free(dents);
+#endif
+    BUF_FREE(dirs);
+    if (*paths) {
+        qsort(*paths, BUF_LEN(*paths), sizeof(char*), walk_cmp_paths);
+    }
+    return true;
+}
+
+#if _WIN32
+#define walk_mkdir(path) _mkdir(path)
+#define walk_rmdir(path) _rmdir(path)
+#else
+#define walk_mkdir(path) mkdir(path, 0755)
+#define walk_rmdir(path) rmdir(path)
+#endif
+
+Internal void walk_tests(void) {
+    LocalPersist const char* dirs[] = { "walk_test", "walk_test/b", "walk_test/a", "walk_test/a/deep", "walk_test/.hidden" };
+    LocalPersist const char* files[] = {
+        "walk_test/Main.jack", "walk_test/b/Zed.jack", "walk_test/a/deep/Inner.jack", "walk_test/a/Alpha.jack",
+        //*none of these are sources
+        "walk_test/Main.jackfoo", "walk_test/Main.jac", "walk_test/Main.vm", "walk_test/jack", "walk_test/.hidden/Skip.jack",
+    };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        walk_mkdir(dirs[i]);
+    }
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        FILE* f = fopen(files[i], "wb");
+        assert(f);
+        fclose(f);
+    }
+
+    char** paths = NULL;
+    assert(walk_sources("walk_test", &paths));
+    assert(BUF_LEN(paths) == 4);
+    assert(strcmp(paths[0], "walk_test/Main.jack") == 0);
+    assert(strcmp(paths[1], "walk_test/a/Alpha.jack") == 0);
+    assert(strcmp(paths[2], "walk_test/a/deep/Inner.jack") == 0);
+    assert(strcmp(paths[3], "walk_test/b/Zed.jack") == 0);
+    for (size_t i = 0; i < BUF_LEN(paths); i++) {
+        free(paths[i]);
+    }
+    BUF_FREE(paths);
+
+    assert(!walk_sources("walk_test/Main.jack", &paths) && errno == ENOTDIR);
+    assert(!paths);
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        remove(files[i]);
+    }
+    for (size_t i = sizeof(dirs) / sizeof(dirs[0]); i > 0; i--) {
+        walk_rmdir(dirs[i - 1]);
+    }
+}
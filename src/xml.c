@@ -0,0 +1,359 @@
+//*Parse tree XML in the nand2tetris analyzer format (`Main.xml`), written straight from the AST into a
+//*Writer. Every line is an indentation prefix cut from one precomputed run of spaces followed by
+//*fixed strings, so emitting is little more than a sequence of memcpys.
+
+#define XML_SPACES8 "        "
+#define XML_SPACES32 XML_SPACES8 XML_SPACES8 XML_SPACES8 XML_SPACES8
+#define XML_MAX_DEPTH 64
+
+const char xml_indent_spaces[] = XML_SPACES32 XML_SPACES32 XML_SPACES32 XML_SPACES32;
+
+typedef struct XmlTree {
+    Writer* w;
+    size_t depth;
+} XmlTree;
+
+Internal void tree_indent(XmlTree* x) {
+    size_t n = 2 * x->depth;
+    while (n > 2 * XML_MAX_DEPTH) {
+        writer_write(x->w, xml_indent_spaces, 2 * XML_MAX_DEPTH);
+        n -= 2 * XML_MAX_DEPTH;
+    }
+    writer_write(x->w, xml_indent_spaces, n);
+}
+
+Internal void tree_open(XmlTree* x, const char* tag) {
+    tree_indent(x);
+    writer_write(x->w, "<", 1);
+    writer_puts(x->w, tag);
+    writer_write(x->w, ">\n", 2);
+    x->depth++;
+}
+
+Internal void tree_close(XmlTree* x, const char* tag) {
+    x->depth--;
+    tree_indent(x);
+    writer_write(x->w, "</", 2);
+    writer_puts(x->w, tag);
+    writer_write(x->w, ">\n", 2);
+}
+
+Internal void tree_leaf_start(XmlTree* x, const char* tag) {
+    tree_indent(x);
+    writer_write(x->w, "<", 1);
+    writer_puts(x->w, tag);
+    writer_write(x->w, "> ", 2);
+}
+
+Internal void tree_leaf_end(XmlTree* x, const char* tag) {
+    writer_write(x->w, " </", 3);
+    writer_puts(x->w, tag);
+    writer_write(x->w, ">\n", 2);
+}
+
+Internal void tree_leaf(XmlTree* x, const char* tag, const char* text) {
+    tree_leaf_start(x, tag);
+    writer_puts(x->w, text);
+    tree_leaf_end(x, tag);
+}
+
+Internal void tree_keyword(XmlTree* x, const char* keyword) {
+    tree_leaf(x, "keyword", keyword);
+}
+
+Internal void tree_ident(XmlTree* x, const char* name) {
+    tree_leaf(x, "identifier", name);
+}
+
+Internal void tree_symbol(XmlTree* x, TokenKind kind) {
+    tree_leaf(x, "symbol", token_kind_xml(kind));
+}
+
+Internal void tree_int(XmlTree* x, i32 val) {
+    tree_leaf_start(x, "integerConstant");
+    writer_u32(x->w, (u32)val);
+    tree_leaf_end(x, "integerConstant");
+}
+
+Internal void tree_str(XmlTree* x, const char* str) {
+    tree_leaf_start(x, "stringConstant");
+    for (const char* start = str;; str++) {
+        const char* entity = NULL;
+        switch (*str) {
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '"': entity = "&quot;"; break;
+            case 0: break;
+            default: continue;
+        }
+        writer_write(x->w, start, str - start);
+        if (!entity) {
+            break;
+        }
+        writer_puts(x->w, entity);
+        start = str + 1;
+    }
+    tree_leaf_end(x, "stringConstant");
+}
+
+Internal void tree_type(XmlTree* x, Type* type) {
+    if (type->kind == TYPE_CLASSNAME) {
+        tree_ident(x, type->name);
+    }
+    else {
+        tree_keyword(x, type->name);
+    }
+}
+
+Internal void tree_expr(XmlTree* x, Expr* expr);
+
+Internal void tree_expr_list(XmlTree* x, ExprList* list) {
+    tree_open(x, "expressionList");
+    for (size_t i = 0; i < list->num_exprs; i++) {
+        if (i) {
+            tree_symbol(x, TOKEN_COMMA);
+        }
+        tree_expr(x, list->exprs[i]);
+    }
+    tree_close(x, "expressionList");
+}
+
+Internal void tree_call(XmlTree* x, SubCall* call) {
+    if (call->field_name) {
+        tree_ident(x, call->field_name);
+        tree_symbol(x, TOKEN_DOT);
+    }
+    tree_ident(x, call->sub_name);
+    tree_symbol(x, TOKEN_LPAREN);
+    tree_expr_list(x, &call->expr_list);
+    tree_symbol(x, TOKEN_RPAREN);
+}
+
+Internal void tree_term(XmlTree* x, Expr* expr) {
+    tree_open(x, "term");
+    switch (expr->kind) {
+        case EXPR_INT: {
+            tree_int(x, expr->int_val);
+            break;
+        }
+        case EXPR_STR: {
+            tree_str(x, expr->str_val);
+            break;
+        }
+        case EXPR_KEYWORD: {
+            tree_keyword(x, expr->keyword);
+            break;
+        }
+        case EXPR_NAME: {
+            tree_ident(x, expr->name);
+            break;
+        }
+        case EXPR_INDEX: {
+            tree_ident(x, expr->index.name);
+            tree_symbol(x, TOKEN_LBRACKET);
+            tree_expr(x, expr->index.expr);
+            tree_symbol(x, TOKEN_RBRACKET);
+            break;
+        }
+        case EXPR_CALL: {
+            tree_call(x, &expr->call);
+            break;
+        }
+        case EXPR_UNARY: {
+            tree_symbol(x, expr->unary.op);
+            tree_term(x, expr->unary.expr);
+            break;
+        }
+        case EXPR_PAREN: {
+            tree_symbol(x, TOKEN_LPAREN);
+            tree_expr(x, expr->paren.expr);
+            tree_symbol(x, TOKEN_RPAREN);
+            break;
+        }
+        default: {
+            assert(0);
+            break;
+        }
+    }
+    tree_close(x, "term");
+}
+
+//*an <expression> is the flat `term (op term)*` sequence, which is the in-order walk of the binary tree
+Internal void tree_expr_terms(XmlTree* x, Expr* expr) {
+    if (expr->kind == EXPR_BINARY) {
+        tree_expr_terms(x, expr->binary.left);
+        tree_symbol(x, expr->binary.op);
+        tree_expr_terms(x, expr->binary.right);
+    }
+    else {
+        tree_term(x, expr);
+    }
+}
+
+Internal void tree_expr(XmlTree* x, Expr* expr) {
+    tree_open(x, "expression");
+    tree_expr_terms(x, expr);
+    tree_close(x, "expression");
+}
+
+Internal void tree_stmt_list(XmlTree* x, StmtList* list);
+
+Internal void tree_block(XmlTree* x, StmtList* block) {
+    tree_symbol(x, TOKEN_LBRACE);
+    tree_stmt_list(x, block);
+    tree_symbol(x, TOKEN_RBRACE);
+}
+
+Internal void tree_stmt(XmlTree* x, Stmt* stmt) {
+    switch (stmt->kind) {
+        case STMT_LET: {
+            tree_open(x, "letStatement");
+            tree_keyword(x, let_keyword);
+            tree_ident(x, stmt->let_stmt.name);
+            if (stmt->let_stmt.index_expr) {
+                tree_symbol(x, TOKEN_LBRACKET);
+                tree_expr(x, stmt->let_stmt.index_expr);
+                tree_symbol(x, TOKEN_RBRACKET);
+            }
+            tree_symbol(x, TOKEN_EQ);
+            tree_expr(x, stmt->let_stmt.assign_expr);
+            tree_symbol(x, TOKEN_SEMICOLON);
+            tree_close(x, "letStatement");
+            break;
+        }
+        case STMT_IF: {
+            tree_open(x, "ifStatement");
+            tree_keyword(x, if_keyword);
+            tree_symbol(x, TOKEN_LPAREN);
+            tree_expr(x, stmt->if_stmt.cond);
+            tree_symbol(x, TOKEN_RPAREN);
+            tree_block(x, &stmt->if_stmt.then_block);
+            if (stmt->if_stmt.has_else) {
+                tree_keyword(x, else_keyword);
+                tree_block(x, &stmt->if_stmt.else_block);
+            }
+            tree_close(x, "ifStatement");
+            break;
+        }
+        case STMT_WHILE: {
+            tree_open(x, "whileStatement");
+            tree_keyword(x, while_keyword);
+            tree_symbol(x, TOKEN_LPAREN);
+            tree_expr(x, stmt->while_stmt.cond);
+            tree_symbol(x, TOKEN_RPAREN);
+            tree_block(x, &stmt->while_stmt.block);
+            tree_close(x, "whileStatement");
+            break;
+        }
+        case STMT_DO: {
+            tree_open(x, "doStatement");
+            tree_keyword(x, do_keyword);
+            tree_call(x, &stmt->do_stmt.subroutine_call->call);
+            tree_symbol(x, TOKEN_SEMICOLON);
+            tree_close(x, "doStatement");
+            break;
+        }
+        case STMT_RETURN: {
+            tree_open(x, "returnStatement");
+            tree_keyword(x, return_keyword);
+            if (stmt->return_stmt.expr) {
+                tree_expr(x, stmt->return_stmt.expr);
+            }
+            tree_symbol(x, TOKEN_SEMICOLON);
+            tree_close(x, "returnStatement");
+            break;
+        }
+    }
+}
+
+Internal void tree_stmt_list(XmlTree* x, StmtList* list) {
+    tree_open(x, "statements");
+    for (size_t i = 0; i < list->num_stmts; i++) {
+        tree_stmt(x, list->stmts[i]);
+    }
+    tree_close(x, "statements");
+}
+
+//*`var int i, j;` lines, consecutive declarations sharing a Type node came from the same line
+Internal void tree_var_decs(XmlTree* x, VarDecl* vars, size_t num_vars) {
+    for (size_t i = 0; i < num_vars;) {
+        tree_open(x, "varDec");
+        tree_keyword(x, var_keyword);
+        tree_type(x, vars[i].type);
+        tree_ident(x, vars[i].name);
+        size_t j = i + 1;
+        for (; j < num_vars && vars[j].type == vars[i].type; j++) {
+            tree_symbol(x, TOKEN_COMMA);
+            tree_ident(x, vars[j].name);
+        }
+        tree_symbol(x, TOKEN_SEMICOLON);
+        tree_close(x, "varDec");
+        i = j;
+    }
+}
+
+Internal void tree_class_var_decs(XmlTree* x, ClassVarDecl* vars, size_t num_vars) {
+    for (size_t i = 0; i < num_vars;) {
+        tree_open(x, "classVarDec");
+        tree_keyword(x, vars[i].var_type == VAR_STATIC ? static_keyword : field_keyword);
+        tree_type(x, vars[i].type);
+        tree_ident(x, vars[i].name);
+        size_t j = i + 1;
+        for (; j < num_vars && vars[j].type == vars[i].type && vars[j].var_type == vars[i].var_type; j++) {
+            tree_symbol(x, TOKEN_COMMA);
+            tree_ident(x, vars[j].name);
+        }
+        tree_symbol(x, TOKEN_SEMICOLON);
+        tree_close(x, "classVarDec");
+        i = j;
+    }
+}
+
+Internal const char* sub_type_keyword(SubroutineType sub_type) {
+    switch (sub_type) {
+        case SUB_CONSTRUCTOR: return constructor_keyword;
+        case SUB_METHOD: return method_keyword;
+        default: return function_keyword;
+    }
+}
+
+Internal void tree_subroutine(XmlTree* x, Subroutine* sub) {
+    tree_open(x, "subroutineDec");
+    tree_keyword(x, sub_type_keyword(sub->sub_type));
+    tree_type(x, sub->ret_type);
+    tree_ident(x, sub->name);
+    tree_symbol(x, TOKEN_LPAREN);
+    tree_open(x, "parameterList");
+    for (size_t i = 0; i < sub->num_params; i++) {
+        if (i) {
+            tree_symbol(x, TOKEN_COMMA);
+        }
+        tree_type(x, sub->params[i].type);
+        tree_ident(x, sub->params[i].name);
+    }
+    tree_close(x, "parameterList");
+    tree_symbol(x, TOKEN_RPAREN);
+
+    tree_open(x, "subroutineBody");
+    tree_symbol(x, TOKEN_LBRACE);
+    tree_var_decs(x, sub->vars, sub->num_vars);
+    tree_stmt_list(x, &sub->block);
+    tree_symbol(x, TOKEN_RBRACE);
+    tree_close(x, "subroutineBody");
+    tree_close(x, "subroutineDec");
+}
+
+Internal void tree_class(Writer* w, ClassDecl* c) {
+    XmlTree x = { w, 0 };
+    tree_open(&x, "class");
+    tree_keyword(&x, class_keyword);
+    tree_ident(&x, c->name);
+    tree_symbol(&x, TOKEN_LBRACE);
+    tree_class_var_decs(&x, c->vars, c->num_vars);
+    for (size_t i = 0; i < c->num_subs; i++) {
+        tree_subroutine(&x, &c->subs[i]);
+    }
+    tree_symbol(&x, TOKEN_RBRACE);
+    tree_close(&x, "class");
+}